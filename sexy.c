@@ -1,21 +1,44 @@
 #define _GNU_SOURCE
+#include <cpuid.h>
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <immintrin.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <locale.h>
+#include <malloc.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -30,15 +53,98 @@ struct {
     uint32_t* message;
 } typedef error;
 
+// The data of an owning "bytes" object follows the header, a slice points into the data of its parent.
+struct bytes {
+    uint64_t      rc;
+    uint64_t      length;
+    uint8_t*      data;
+    struct bytes* parent;
+} typedef bytes;
+
+// A waiter is either a thread sleeping on the condition variable or a parked coroutine ("coroutine" is not "NULL").
 struct {
-    uint64_t        use_counter;
-    uint64_t        capacity;
-    uint64_t        index_of_first;
-    uint64_t        count;
-    pthread_mutex_t mutex;
-    type*           items;
+    pthread_mutex_t   mutex;
+    pthread_cond_t    cond;
+    bool              signaled;
+    struct coroutine* coroutine;
+} typedef pipeline_waiter;
+
+struct pipeline_wait_node {
+    pipeline_waiter*           waiter;
+    struct pipeline_wait_node* prev;
+    struct pipeline_wait_node* next;
+} typedef pipeline_wait_node;
+
+// A segment file of a spilling pipeline, the items are read from the first segment and written to the last one.
+struct pipeline_segment {
+    int                      fd;
+    uint64_t                 write_offset;
+    uint64_t                 read_offset;
+    struct pipeline_segment* next;
+} typedef pipeline_segment;
+
+// The part of a spilling pipeline on disk, "count" items are in the segments and in the write buffer.
+struct {
+    uint64_t          threshold;
+    uint64_t          count;
+    pipeline_segment* first;
+    pipeline_segment* last;
+    uint8_t*          write_buffer;
+    uint64_t          write_length;
+    uint8_t*          read_buffer;
+    uint64_t          read_position;
+    uint64_t          read_length;
+} typedef pipeline_spill;
+
+// A level of a priority pipeline is a ring buffer, its capacity is a power of two.
+struct {
+    type*    items;
+    uint64_t capacity;
+    uint64_t first;
+    uint64_t count;
+} typedef pipeline_level;
+
+// The levels of a priority pipeline, bit "n" of "non_empty" is set while level "n" has items.
+// With aging, after "aging" pops in a row that bypass a lower level, an item of the lowest non-empty level is popped.
+struct {
+    uint64_t       levels_count;
+    uint64_t       non_empty;
+    uint64_t       aging;
+    uint64_t       bypassing_pops;
+    pipeline_level levels[];
+} typedef pipeline_levels;
+
+struct pipeline_group;
+
+struct pipeline {
+    uint64_t            use_counter;
+    uint64_t            capacity;
+    uint64_t            index_of_first;
+    uint64_t            count;
+    uint64_t            max_count;
+    uint64_t            waiting_pushers;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      not_full;
+    pipeline_wait_node* waiters;
+    pipeline_wait_node* push_waiters;
+    int                 event_fd;
+    type*               items;
+    pipeline_spill*        spill;
+    pipeline_levels*       levels;
+    struct pipeline_group* group;
 } typedef pipeline;
 
+// A sharded pipeline: producers push to the front pipeline, the items are spread over the shards, every consumer pops from its own shard.
+// The group lives while the front or any shard handle is in use ("rc"), the shards are freed with the group.
+struct pipeline_group {
+    uint64_t  rc;
+    uint64_t  shards_count;
+    bool      is_keyed;
+    pipeline* front;
+    type*     shard_pipes;
+    pipeline* shards[];
+} typedef pipeline_group;
+
 struct {
     uint64_t id;
     uint64_t random_number_source[3];
@@ -46,6 +152,55 @@ struct {
     uint64_t cryptographic_random_number_index;
 } typedef thread_data;
 
+// A file opened by "fs__open_native_file", it works directly with the file descriptor and has its own buffer.
+// The buffer contains either a read window ("window_offset" is the file offset of its first byte)
+// or data not yet written ("window_is_dirty").
+struct {
+    int      fd;
+    bool     is_stream;
+    bool     is_direct;
+    bool     is_append;
+    bool     window_is_dirty;
+    uint8_t* buffer;
+    uint64_t buffer_size;
+    uint64_t position;
+    uint64_t window_offset;
+    uint64_t window_length;
+} typedef native_file;
+
+#define shm_pipeline__slot_size 4096
+#define shm_pipeline__max_peers 64
+
+// A slot of the shared ring, the payload holds the chars of a string or the data of a byte buffer.
+struct {
+    uint64_t sequence;
+    uint32_t type;
+    uint32_t length;
+    uint64_t data;
+    uint8_t  payload[shm_pipeline__slot_size - 3 * sizeof(uint64_t)];
+} typedef shm_pipeline_slot;
+
+// The header occupies the first slot of the shared memory, the positions live on separate cache lines.
+struct {
+    uint64_t magic;
+    uint64_t capacity;
+    uint64_t enqueue_position  __attribute__((aligned(64)));
+    uint32_t items_futex;
+    uint32_t waiting_producers;
+    uint64_t dequeue_position  __attribute__((aligned(64)));
+    uint32_t space_futex;
+    uint32_t waiting_consumers;
+} typedef shm_pipeline_header;
+
+struct {
+    shm_pipeline_header* header;
+    shm_pipeline_slot*   slots;
+    uint64_t             mapping_size;
+    int                  fd;
+    uint32_t             peer_index;
+    char*                name;
+} typedef shm_pipeline;
+
 struct {
     type (*worker)(type, type, void*, bool);
     type in;
@@ -57,6 +212,7 @@ struct {
 #define bool__type_numer     2
 #define int__type_number     3
 #define string__type_number  4
+#define bytes__type_number   5
 
 #define error__id_no_error 2
 #define error__id_fail     3
@@ -64,30 +220,179 @@ struct {
 static type (*shar__rc_free)(type, void*, bool);
 static type (*shar__rc_use)(type, void*, bool);
 
+void bytes__use(type bytes_obj);
+void bytes__free(type bytes_obj);
+
+// Byte buffers are created by the runtime itself (for example, by the network loop), so the runtime releases them,
+// the other objects are released by the callbacks of the compiler.
+static inline void shar__object_free(type object, void* th_data) {
+    if (object.type == bytes__type_number) {bytes__free(object);}
+    else {shar__rc_free(object, th_data, false);}
+}
+
+static inline void shar__object_use(type object, void* th_data) {
+    if (object.type == bytes__type_number) {bytes__use(object);}
+    else {shar__rc_use(object, th_data, false);}
+}
+
 #pragma region Alloc
-static inline void* safe_realloc(void* pointer, uint64_t size) {
+// Allocation accounting is enabled by the "SHAR_MEMORY_STATS" environment variable, the statistics are printed at exit.
+// Every region of the runtime tags its allocations with its own category ("alloc__category").
+#define alloc__category__other    0
+#define alloc__category__string   1
+#define alloc__category__error    2
+#define alloc__category__pipeline 3
+#define alloc__category__thread   4
+#define alloc__category__fs       5
+#define alloc__category__trace    6
+#define alloc__category__bytes    7
+#define alloc__category__net      8
+#define alloc__categories_count   9
+
+// Size classes: up to 16 bytes, up to 32 bytes, ..., up to 1 MiB, larger.
+#define alloc__size_classes_count 18
+
+// The live bytes of a thread are added to the global counter in portions, so threads do not compete for one cache line.
+#define alloc__live_bytes_portion 65536
+
+static const char* const alloc__category_names[alloc__categories_count] = {"other", "string", "error", "pipeline", "thread", "fs", "trace", "bytes", "net"};
+
+struct alloc_stats {
+    uint64_t            allocations[alloc__categories_count];
+    uint64_t            allocated_bytes[alloc__categories_count];
+    uint64_t            size_classes[alloc__size_classes_count];
+    uint64_t            frees;
+    int64_t             pending_live_bytes;
+    struct alloc_stats* next;
+} typedef alloc_stats;
+
+static bool alloc__accounting = false;
+static alloc_stats* alloc__all_stats = NULL;
+static int64_t alloc__live_bytes = 0;
+static int64_t alloc__peak_bytes = 0;
+static __thread alloc_stats* alloc__thread_stats = NULL;
+
+static alloc_stats* alloc__get_thread_stats() {
+    alloc_stats* stats = alloc__thread_stats;
+    if (__builtin_expect(stats == NULL, false)) {
+        stats = calloc(1, sizeof(alloc_stats));
+        if (__builtin_expect(stats == NULL, false)) {
+            fprintf(stderr, "Not enough memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        stats->next = __atomic_load_n(&alloc__all_stats, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&alloc__all_stats, &(stats->next), stats, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+        alloc__thread_stats = stats;
+    }
+    return stats;
+}
+
+static void alloc__add_live_bytes(alloc_stats* stats, int64_t bytes) {
+    stats->pending_live_bytes += bytes;
+    if (stats->pending_live_bytes >= alloc__live_bytes_portion || stats->pending_live_bytes <= -alloc__live_bytes_portion) {
+        int64_t const live_bytes = __atomic_add_fetch(&alloc__live_bytes, stats->pending_live_bytes, __ATOMIC_RELAXED);
+        stats->pending_live_bytes = 0;
+        int64_t peak_bytes = __atomic_load_n(&alloc__peak_bytes, __ATOMIC_RELAXED);
+        while (live_bytes > peak_bytes && !__atomic_compare_exchange_n(&alloc__peak_bytes, &peak_bytes, live_bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+}
+
+__attribute__((noinline)) static void alloc__account(void* pointer, uint64_t size, uint8_t category) {
+    alloc_stats* const stats = alloc__get_thread_stats();
+    uint64_t const size_class = size <= 16 ? 0 : 60 - __builtin_clzll(size - 1);
+    stats->allocations[category]++;
+    stats->allocated_bytes[category] += size;
+    stats->size_classes[size_class < alloc__size_classes_count ? size_class : alloc__size_classes_count - 1]++;
+    alloc__add_live_bytes(stats, malloc_usable_size(pointer));
+}
+
+__attribute__((noinline)) static void alloc__account_free(uint64_t usable_size) {
+    alloc_stats* const stats = alloc__get_thread_stats();
+    stats->frees++;
+    alloc__add_live_bytes(stats, -(int64_t)usable_size);
+}
+
+// The function prints the statistics without allocating memory, so it can be used when the memory has run out.
+static void alloc__print_stats(FILE* file) {
+    struct mallinfo2 const heap_info = mallinfo2();
+    fprintf(file, "Memory statistics:\n  heap in use: %zu bytes, heap size: %zu bytes, mapped: %zu bytes\n", heap_info.uordblks, heap_info.arena, heap_info.hblkhd);
+    if (!alloc__accounting) {
+        fprintf(file, "  allocation accounting is disabled (set SHAR_MEMORY_STATS to enable it)\n");
+        return;
+    }
+    uint64_t allocations[alloc__categories_count] = {0};
+    uint64_t allocated_bytes[alloc__categories_count] = {0};
+    uint64_t size_classes[alloc__size_classes_count] = {0};
+    uint64_t frees = 0;
+    int64_t live_bytes = __atomic_load_n(&alloc__live_bytes, __ATOMIC_RELAXED);
+    for (const alloc_stats* stats = __atomic_load_n(&alloc__all_stats, __ATOMIC_ACQUIRE); stats != NULL; stats = stats->next) {
+        for (uint64_t category = 0; category < alloc__categories_count; category++) {
+            allocations[category] += __atomic_load_n(&(stats->allocations[category]), __ATOMIC_RELAXED);
+            allocated_bytes[category] += __atomic_load_n(&(stats->allocated_bytes[category]), __ATOMIC_RELAXED);
+        }
+        for (uint64_t size_class = 0; size_class < alloc__size_classes_count; size_class++) {size_classes[size_class] += __atomic_load_n(&(stats->size_classes[size_class]), __ATOMIC_RELAXED);}
+        frees += __atomic_load_n(&(stats->frees), __ATOMIC_RELAXED);
+        live_bytes += __atomic_load_n(&(stats->pending_live_bytes), __ATOMIC_RELAXED);
+    }
+    int64_t const peak_bytes = __atomic_load_n(&alloc__peak_bytes, __ATOMIC_RELAXED);
+    fprintf(file, "  runtime live: %" PRId64 " bytes, peak: %" PRId64 " bytes, frees: %" PRIu64 "\n", live_bytes, peak_bytes > live_bytes ? peak_bytes : live_bytes, frees);
+    for (uint64_t category = 0; category < alloc__categories_count; category++) {
+        fprintf(file, "  %-8s allocations: %" PRIu64 ", bytes: %" PRIu64 "\n", alloc__category_names[category], allocations[category], allocated_bytes[category]);
+    }
+    fprintf(file, "  size classes:");
+    for (uint64_t size_class = 0; size_class < alloc__size_classes_count; size_class++) {
+        if (size_classes[size_class] == 0) {continue;}
+        if (size_class == alloc__size_classes_count - 1) {fprintf(file, " >%" PRIu64 ": %" PRIu64, (uint64_t)16 << (size_class - 1), size_classes[size_class]);}
+        else {fprintf(file, " <=%" PRIu64 ": %" PRIu64, (uint64_t)16 << size_class, size_classes[size_class]);}
+    }
+    fprintf(file, "\n");
+}
+
+__attribute__((noreturn, cold)) static void alloc__out_of_memory() {
+    fprintf(stderr, "Not enough memory.\n");
+    alloc__print_stats(stderr);
+    exit(EXIT_FAILURE);
+}
+
+static inline void* safe_realloc(void* pointer, uint64_t size, uint8_t category) {
+    uint64_t const old_size = __builtin_expect(alloc__accounting, false) && pointer != NULL ? malloc_usable_size(pointer) : 0;
     void* const result = realloc(pointer, size);
-    if (__builtin_expect(result == NULL, false)) {
-        fprintf(stderr, "Not enough memory.\n");
-        exit(EXIT_FAILURE);
+    if (__builtin_expect(result == NULL, false)) {alloc__out_of_memory();}
+    if (__builtin_expect(alloc__accounting, false)) {
+        if (old_size != 0) {alloc__account_free(old_size);}
+        alloc__account(result, size, category);
     }
     return result;
 }
 
-static inline void* safe_malloc(uint64_t size) {
+static inline void* safe_malloc(uint64_t size, uint8_t category) {
     void* const result = malloc(size);
-    if (__builtin_expect(result == NULL, false)) {
-        fprintf(stderr, "Not enough memory.\n");
-        exit(EXIT_FAILURE);
-    }
+    if (__builtin_expect(result == NULL, false)) {alloc__out_of_memory();}
+    if (__builtin_expect(alloc__accounting, false)) {alloc__account(result, size, category);}
+    return result;
+}
+
+static inline void* safe_aligned_malloc(uint64_t alignment, uint64_t size, uint8_t category) {
+    void* result;
+    if (__builtin_expect(posix_memalign(&result, alignment, size) != 0, false)) {alloc__out_of_memory();}
+    if (__builtin_expect(alloc__accounting, false)) {alloc__account(result, size, category);}
     return result;
 }
+
+static inline void safe_free(void* pointer) {
+    if (__builtin_expect(alloc__accounting, false) && pointer != NULL) {alloc__account_free(malloc_usable_size(pointer));}
+    free(pointer);
+}
 #pragma endregion Alloc
 
-#define realloc(p, size) safe_realloc(p, size)
-#define malloc(size) safe_malloc(size)
+#define realloc(p, size) safe_realloc(p, size, alloc__category)
+#define malloc(size) safe_malloc(size, alloc__category)
+#define free(p) safe_free(p)
+#define aligned_malloc(alignment, size) safe_aligned_malloc(alignment, size, alloc__category)
 
 #pragma region String
+#define alloc__category alloc__category__string
+
 static type const string__empty = (type){.data = (uint64_t)(const uint64_t[]) {0, 0}, .type = string__type_number};
 
 static inline uint8_t char__utf32_to_utf8(uint32_t utf32_char, uint8_t* utf8_char) {
@@ -206,6 +511,44 @@ type string__utf8_to_utf32(const uint8_t* utf8_string) {
     return (type){.data = (uint64_t)result, .type = string__type_number};
 }
 
+// The function decodes exactly "length" bytes of UTF-8 (zero bytes are regular chars), the result is allocated once.
+// If the data is not valid UTF-8, then "nothing" is returned as a result.
+type string__utf8_to_utf32_n(const uint8_t* utf8_string, uint64_t length) {
+    uint64_t max_chars_count = 0;
+    for (uint64_t index = 0; index < length; index++) {max_chars_count += (utf8_string[index] & 192) != 128;}
+    uint32_t* const result = malloc((max_chars_count + 4) * sizeof(uint32_t));
+    uint32_t* const chars = &(result[4]);
+    uint64_t chars_count = 0;
+    const uint8_t* current_utf8_char_ptr = utf8_string;
+    const uint8_t* const end = &(utf8_string[length]);
+    // The decoder may look up to 3 bytes ahead, so the tail is decoded from a zero-padded copy.
+    while (end - current_utf8_char_ptr >= 4) {
+        uint32_t const current_utf32_char = char__utf8_to_utf32(&current_utf8_char_ptr);
+        if (__builtin_expect(current_utf32_char == -1, false)) {
+            free(result);
+            return (type){.data = 0, .type = nothing__type_number};
+        }
+        chars[chars_count] = current_utf32_char;
+        chars_count++;
+    }
+    uint8_t tail[8] = {0};
+    uint64_t const tail_length = end - current_utf8_char_ptr;
+    memcpy(tail, current_utf8_char_ptr, tail_length);
+    current_utf8_char_ptr = tail;
+    while (current_utf8_char_ptr < &(tail[tail_length])) {
+        uint32_t const current_utf32_char = char__utf8_to_utf32(&current_utf8_char_ptr);
+        if (__builtin_expect(current_utf32_char == -1 || current_utf8_char_ptr > &(tail[tail_length]), false)) {
+            free(result);
+            return (type){.data = 0, .type = nothing__type_number};
+        }
+        chars[chars_count] = current_utf32_char;
+        chars_count++;
+    }
+    ((uint64_t*)result)[0] = 1;
+    ((uint64_t*)result)[1] = chars_count;
+    return (type){.data = (uint64_t)result, .type = string__type_number};
+}
+
 static void print(type string, FILE* file, bool end_is_new_line) {
     uint64_t const string_length = ((const uint64_t*)string.data)[1];
     const uint32_t* const chars = &(((const uint32_t* )string.data)[4]);
@@ -255,9 +598,215 @@ __attribute__((noreturn, cold)) void string__print_utf8_error(const uint8_t* mes
     fprintf(stderr, "Error: %s\n", message);
     exit(EXIT_FAILURE);
 }
+
+static bool cpu_has_avx2 = false;
+static uint64_t string__hash_key[2];
+
+__attribute__((target("avx2"))) static uint64_t chars__mismatch_avx2(const uint32_t* a, const uint32_t* b, uint64_t length) {
+    uint64_t index = 0;
+    for (; index + 8 <= length; index += 8) {
+        __m256i const equal = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)&(a[index])), _mm256_loadu_si256((const __m256i*)&(b[index])));
+        uint32_t const mask = _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+        if (mask != 0xff) {return index + __builtin_ctz(~mask);}
+    }
+    for (; index < length; index++) {if (a[index] != b[index]) {return index;}}
+    return length;
+}
+
+static uint64_t chars__mismatch_sse(const uint32_t* a, const uint32_t* b, uint64_t length) {
+    uint64_t index = 0;
+    for (; index + 4 <= length; index += 4) {
+        __m128i const equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&(a[index])), _mm_loadu_si128((const __m128i*)&(b[index])));
+        uint32_t const mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+        if (mask != 0xf) {return index + __builtin_ctz(~mask);}
+    }
+    for (; index < length; index++) {if (a[index] != b[index]) {return index;}}
+    return length;
+}
+
+// Returns the index of the first differing char or "length" if the arrays are equal.
+static inline uint64_t chars__mismatch(const uint32_t* a, const uint32_t* b, uint64_t length) {
+    if (cpu_has_avx2) {return chars__mismatch_avx2(a, b, length);}
+    return chars__mismatch_sse(a, b, length);
+}
+
+__attribute__((target("avx2"))) static uint64_t chars__find_avx2(const uint32_t* chars, uint64_t length, uint64_t start, uint32_t needle) {
+    __m256i const pattern = _mm256_set1_epi32(needle);
+    uint64_t index = start;
+    for (; index + 8 <= length; index += 8) {
+        __m256i const equal = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)&(chars[index])), pattern);
+        uint32_t const mask = _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+        if (mask != 0) {return index + __builtin_ctz(mask);}
+    }
+    for (; index < length; index++) {if (chars[index] == needle) {return index;}}
+    return length;
+}
+
+static uint64_t chars__find_sse(const uint32_t* chars, uint64_t length, uint64_t start, uint32_t needle) {
+    __m128i const pattern = _mm_set1_epi32(needle);
+    uint64_t index = start;
+    for (; index + 4 <= length; index += 4) {
+        __m128i const equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&(chars[index])), pattern);
+        uint32_t const mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+        if (mask != 0) {return index + __builtin_ctz(mask);}
+    }
+    for (; index < length; index++) {if (chars[index] == needle) {return index;}}
+    return length;
+}
+
+// Returns the index of the first occurrence of the char, starting from "start", or "length" if there is none.
+static inline uint64_t chars__find(const uint32_t* chars, uint64_t length, uint64_t start, uint32_t needle) {
+    if (cpu_has_avx2) {return chars__find_avx2(chars, length, start, needle);}
+    return chars__find_sse(chars, length, start, needle);
+}
+
+// Substring search: the first and the last chars of the needle are compared with 8 positions of the haystack at once,
+// only the positions where both match are checked completely.
+__attribute__((target("avx2"))) static uint64_t chars__find_substring_avx2(const uint32_t* haystack, uint64_t haystack_length, uint64_t start, const uint32_t* needle, uint64_t needle_length) {
+    __m256i const first = _mm256_set1_epi32(needle[0]);
+    __m256i const last = _mm256_set1_epi32(needle[needle_length - 1]);
+    uint64_t index = start;
+    for (; index + needle_length + 7 <= haystack_length; index += 8) {
+        __m256i const equal_first = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)&(haystack[index])), first);
+        __m256i const equal_last = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)&(haystack[index + needle_length - 1])), last);
+        uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(equal_first, equal_last)));
+        while (mask != 0) {
+            uint64_t const position = index + __builtin_ctz(mask);
+            if (memcmp(&(haystack[position + 1]), &(needle[1]), (needle_length - 2) * sizeof(uint32_t)) == 0) {return position;}
+            mask &= mask - 1;
+        }
+    }
+    for (; index + needle_length <= haystack_length; index++) {
+        if (haystack[index] == needle[0] && memcmp(&(haystack[index + 1]), &(needle[1]), (needle_length - 1) * sizeof(uint32_t)) == 0) {return index;}
+    }
+    return haystack_length;
+}
+
+static uint64_t chars__find_substring_sse(const uint32_t* haystack, uint64_t haystack_length, uint64_t start, const uint32_t* needle, uint64_t needle_length) {
+    __m128i const first = _mm_set1_epi32(needle[0]);
+    __m128i const last = _mm_set1_epi32(needle[needle_length - 1]);
+    uint64_t index = start;
+    for (; index + needle_length + 3 <= haystack_length; index += 4) {
+        __m128i const equal_first = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&(haystack[index])), first);
+        __m128i const equal_last = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&(haystack[index + needle_length - 1])), last);
+        uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(equal_first, equal_last)));
+        while (mask != 0) {
+            uint64_t const position = index + __builtin_ctz(mask);
+            if (memcmp(&(haystack[position + 1]), &(needle[1]), (needle_length - 2) * sizeof(uint32_t)) == 0) {return position;}
+            mask &= mask - 1;
+        }
+    }
+    for (; index + needle_length <= haystack_length; index++) {
+        if (haystack[index] == needle[0] && memcmp(&(haystack[index + 1]), &(needle[1]), (needle_length - 1) * sizeof(uint32_t)) == 0) {return index;}
+    }
+    return haystack_length;
+}
+
+// If both strings contain the same chars, the function returns "true", otherwise "false".
+type string__equals(type string1, type string2) {
+    if (string1.data == string2.data) {return (type){.data = true, .type = bool__type_numer};}
+    uint64_t const length = ((const uint64_t*)string1.data)[1];
+    if (length != ((const uint64_t*)string2.data)[1]) {return (type){.data = false, .type = bool__type_numer};}
+    const uint32_t* const chars1 = &(((const uint32_t*)string1.data)[4]);
+    const uint32_t* const chars2 = &(((const uint32_t*)string2.data)[4]);
+    return (type){.data = chars__mismatch(chars1, chars2, length) == length, .type = bool__type_numer};
+}
+
+// The function compares strings char by char (by code points).
+// Returns -1 if the first string is less than the second, 0 if they are equal and 1 if the first string is greater.
+type string__compare(type string1, type string2) {
+    uint64_t const length1 = ((const uint64_t*)string1.data)[1];
+    uint64_t const length2 = ((const uint64_t*)string2.data)[1];
+    uint64_t const length = length1 < length2 ? length1 : length2;
+    const uint32_t* const chars1 = &(((const uint32_t*)string1.data)[4]);
+    const uint32_t* const chars2 = &(((const uint32_t*)string2.data)[4]);
+    uint64_t const index = string1.data == string2.data ? length : chars__mismatch(chars1, chars2, length);
+    int64_t result;
+    if (index != length) {result = chars1[index] < chars2[index] ? -1 : 1;}
+    else {result = length1 == length2 ? 0 : (length1 < length2 ? -1 : 1);}
+    return (type){.data = (uint64_t)result, .type = int__type_number};
+}
+
+#define string__sip_round(v0, v1, v2, v3) { \
+    v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0; v0 = (v0 << 32) | (v0 >> 32); \
+    v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2; \
+    v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0; \
+    v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2; v2 = (v2 << 32) | (v2 >> 32); \
+}
+
+// SipHash-1-3 of the bytes with the random secret key, the seed is mixed into the key.
+static uint64_t string__hash_bytes(const uint8_t* data, uint64_t size, uint64_t seed) {
+    uint64_t const k0 = string__hash_key[0] ^ seed;
+    uint64_t const k1 = string__hash_key[1];
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ull;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ull;
+    uint64_t v3 = k1 ^ 0x7465646279746573ull;
+    uint64_t index = 0;
+    for (; index + sizeof(uint64_t) <= size; index += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, &(data[index]), sizeof(uint64_t));
+        v3 ^= word;
+        string__sip_round(v0, v1, v2, v3);
+        v0 ^= word;
+    }
+    uint64_t last_word = 0;
+    if (index < size) {memcpy(&last_word, &(data[index]), size - index);}
+    last_word |= size << 56;
+    v3 ^= last_word;
+    string__sip_round(v0, v1, v2, v3);
+    v0 ^= last_word;
+    v2 ^= 0xff;
+    string__sip_round(v0, v1, v2, v3);
+    string__sip_round(v0, v1, v2, v3);
+    string__sip_round(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef string__sip_round
+
+// The function returns a 64-bit hash of the string (SipHash-1-3).
+// The hash key is made of the seed and a random secret, so the result is stable only during one run of the program.
+type string__hash(type string, type seed) {
+    uint64_t const length = ((const uint64_t*)string.data)[1];
+    const uint8_t* const chars = (const uint8_t*)&(((const uint32_t*)string.data)[4]);
+    return (type){.data = string__hash_bytes(chars, length * sizeof(uint32_t), seed.data), .type = int__type_number};
+}
+
+// The function searches for the char in the string, starting from the specified index.
+// Returns the index of the char, or "nothing" if the char was not found.
+type string__find_char(type string, type character, type start_index) {
+    uint64_t const length = ((const uint64_t*)string.data)[1];
+    if (start_index.data >= length) {return (type){.data = 0, .type = nothing__type_number};}
+    const uint32_t* const chars = &(((const uint32_t*)string.data)[4]);
+    uint64_t const index = chars__find(chars, length, start_index.data, character.data);
+    if (index == length) {return (type){.data = 0, .type = nothing__type_number};}
+    return (type){.data = index, .type = int__type_number};
+}
+
+// The function searches for the substring in the string, starting from the specified index.
+// Returns the index of the first occurrence, or "nothing" if the substring was not found.
+type string__find(type string, type substring, type start_index) {
+    uint64_t const length = ((const uint64_t*)string.data)[1];
+    uint64_t const substring_length = ((const uint64_t*)substring.data)[1];
+    if (start_index.data > length || substring_length > length - start_index.data) {return (type){.data = 0, .type = nothing__type_number};}
+    if (substring_length == 0) {return (type){.data = start_index.data, .type = int__type_number};}
+    const uint32_t* const chars = &(((const uint32_t*)string.data)[4]);
+    const uint32_t* const substring_chars = &(((const uint32_t*)substring.data)[4]);
+    uint64_t index;
+    if (substring_length == 1) {index = chars__find(chars, length, start_index.data, substring_chars[0]);}
+    else if (cpu_has_avx2) {index = chars__find_substring_avx2(chars, length, start_index.data, substring_chars, substring_length);}
+    else {index = chars__find_substring_sse(chars, length, start_index.data, substring_chars, substring_length);}
+    if (index == length) {return (type){.data = 0, .type = nothing__type_number};}
+    return (type){.data = index, .type = int__type_number};
+}
+
+#undef alloc__category
 #pragma endregion String
 
 #pragma region Error
+#define alloc__category alloc__category__error
+
 type error__create(type id, type message, type data) {
     error* const error_mem = malloc(sizeof(error));
     *error_mem = (error) {
@@ -319,7 +868,7 @@ type error__get_data(type error_obj) {
 
 void error__free(type error_obj, void* th_data) {
     error* err = (error*)error_obj.data;
-    shar__rc_free(err->data, th_data, false);
+    shar__object_free(err->data, th_data);
     uint64_t const error_message_rc = ((uint64_t*)(err->message))[0];
     switch (error_message_rc) {
     case 0:
@@ -332,13 +881,294 @@ void error__free(type error_obj, void* th_data) {
     }
     free(err);
 }
+
+#undef alloc__category
 #pragma endregion Error
 
+#pragma region Bytes
+#define alloc__category alloc__category__bytes
+
+static bytes* bytes__new(uint64_t length) {
+    bytes* const result = malloc(sizeof(bytes) + length);
+    *result = (bytes) {
+        .rc     = 1,
+        .length = length,
+        .data   = (uint8_t*)&(result[1]),
+        .parent = NULL
+    };
+    return result;
+}
+
+// The function creates a byte buffer of the specified length filled with zeros.
+type bytes__create(type length) {
+    bytes* const result = bytes__new(length.data);
+    memset(result->data, 0, length.data);
+    return (type){.data = (uint64_t)result, .type = bytes__type_number};
+}
+
+// The function creates a byte buffer with a copy of the memory.
+type bytes__create_from_memory(const uint8_t* memory, uint64_t length) {
+    bytes* const result = bytes__new(length);
+    memcpy(result->data, memory, length);
+    return (type){.data = (uint64_t)result, .type = bytes__type_number};
+}
+
+// The function increments the reference counter, it is safe to call from any thread.
+void bytes__use(type bytes_obj) {
+    __atomic_add_fetch(&(((bytes*)bytes_obj.data)->rc), 1, __ATOMIC_RELAXED);
+}
+
+// The function decrements the reference counter, the last release of a slice releases its parent.
+void bytes__free(type bytes_obj) {
+    bytes* const object = (bytes*)bytes_obj.data;
+    if (__atomic_sub_fetch(&(object->rc), 1, __ATOMIC_ACQ_REL) != 0) {return;}
+    if (object->parent != NULL) {bytes__free((type){.data = (uint64_t)object->parent, .type = bytes__type_number});}
+    free(object);
+}
+
+type bytes__get_length(type bytes_obj) {
+    return (type){.data = ((const bytes*)bytes_obj.data)->length, .type = int__type_number};
+}
+
+// The function returns the memory of the buffer for native code, the memory lives as long as the buffer.
+uint8_t* bytes__get_data(type bytes_obj) {
+    return ((const bytes*)bytes_obj.data)->data;
+}
+
+// The function returns the byte by the index.
+// If the index is out of range, then "nothing" is returned as a result.
+type bytes__get(type bytes_obj, type index) {
+    const bytes* const object = (const bytes*)bytes_obj.data;
+    if (index.data >= object->length) {return (type){.data = 0, .type = nothing__type_number};}
+    return (type){.data = object->data[index.data], .type = int__type_number};
+}
+
+// The function returns a view of a part of the buffer without copying, the view keeps the whole buffer alive.
+// If the range is out of the buffer, then "nothing" is returned as a result.
+type bytes__slice(type bytes_obj, type start, type length) {
+    bytes* const object = (bytes*)bytes_obj.data;
+    if (start.data > object->length || length.data > object->length - start.data) {return (type){.data = 0, .type = nothing__type_number};}
+    bytes* const root = object->parent != NULL ? object->parent : object;
+    __atomic_add_fetch(&(root->rc), 1, __ATOMIC_RELAXED);
+    bytes* const result = malloc(sizeof(bytes));
+    *result = (bytes) {
+        .rc     = 1,
+        .length = length.data,
+        .data   = &(object->data[start.data]),
+        .parent = root
+    };
+    return (type){.data = (uint64_t)result, .type = bytes__type_number};
+}
+
+// If the buffers contain the same bytes, the function returns "true", otherwise "false".
+type bytes__equals(type bytes1, type bytes2) {
+    const bytes* const object1 = (const bytes*)bytes1.data;
+    const bytes* const object2 = (const bytes*)bytes2.data;
+    bool const result = object1->length == object2->length && memcmp(object1->data, object2->data, object1->length) == 0;
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function encodes the string to UTF-8.
+type bytes__from_string(type string) {
+    uint64_t const string_length = ((const uint64_t*)string.data)[1];
+    const uint32_t* const chars = &(((const uint32_t*)string.data)[4]);
+    uint64_t length = 0;
+    uint8_t utf8_char[4];
+    for (uint64_t char_index = 0; char_index < string_length; char_index++) {length += char__utf32_to_utf8(chars[char_index], utf8_char);}
+    bytes* const result = bytes__new(length);
+    uint64_t offset = 0;
+    for (uint64_t char_index = 0; char_index < string_length; char_index++) {offset += char__utf32_to_utf8(chars[char_index], &(result->data[offset]));}
+    return (type){.data = (uint64_t)result, .type = bytes__type_number};
+}
+
+// The function decodes the buffer from UTF-8.
+// If the buffer is not valid UTF-8, then "nothing" is returned as a result.
+type bytes__to_string(type bytes_obj) {
+    const bytes* const object = (const bytes*)bytes_obj.data;
+    return string__utf8_to_utf32_n(object->data, object->length);
+}
+
+#undef alloc__category
+#pragma endregion Bytes
+
+#pragma region Trace
+#define alloc__category alloc__category__trace
+
+// Tracing is enabled by the "SHAR_TRACE" environment variable, which contains the name of the output file.
+// Each thread writes events only to its own ring buffer (the oldest events are overwritten),
+// the buffers are exported in the Chrome/Perfetto JSON format at "shar__end".
+// The buffer of an exited thread is reused by the next started thread, so the memory is bounded by the number of threads running at once.
+#define trace__buffer_size 16384
+
+struct {
+    uint64_t    time_ns;
+    const char* name;
+    uint32_t    thread_id;
+    uint8_t     phase;
+    bool        owned_name;
+} typedef trace_event;
+
+struct trace_buffer {
+    uint64_t             thread_id;
+    uint64_t             events_count;
+    struct trace_buffer* next;
+    bool                 is_free;
+    bool                 is_recording;
+    trace_event          events[trace__buffer_size];
+} typedef trace_buffer;
+
+static const char* trace__file_name = NULL;
+static trace_buffer* trace__buffers = NULL;
+static bool trace__is_stopped = false;
+static __thread trace_buffer* trace__current_buffer = NULL;
+
+// The function gives the current thread a free buffer of an exited thread or a new one (if tracing is enabled).
+static void trace__start_thread(uint64_t thread_id) {
+    if (trace__file_name == NULL) {return;}
+    // The list only grows, so a buffer can be claimed without removing it.
+    for (trace_buffer* buffer = __atomic_load_n(&trace__buffers, __ATOMIC_ACQUIRE); buffer != NULL; buffer = buffer->next) {
+        bool expected = true;
+        if (__atomic_load_n(&(buffer->is_free), __ATOMIC_RELAXED) && __atomic_compare_exchange_n(&(buffer->is_free), &expected, false, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            buffer->thread_id = thread_id;
+            trace__current_buffer = buffer;
+            return;
+        }
+    }
+    trace_buffer* const buffer = malloc(sizeof(trace_buffer));
+    buffer->thread_id = thread_id;
+    buffer->events_count = 0;
+    buffer->is_free = false;
+    buffer->is_recording = false;
+    buffer->next = __atomic_load_n(&trace__buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace__buffers, &(buffer->next), buffer, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+    trace__current_buffer = buffer;
+}
+
+// The function returns the buffer of the exiting thread for reuse, its events are kept until they are overwritten.
+static void trace__stop_thread() {
+    trace_buffer* const buffer = trace__current_buffer;
+    if (buffer == NULL) {return;}
+    trace__current_buffer = NULL;
+    __atomic_store_n(&(buffer->is_free), true, __ATOMIC_RELEASE);
+}
+
+static void trace__record(trace_buffer* buffer, uint8_t phase, const char* name, bool owned_name) {
+    // The export sets "trace__is_stopped" and waits for "is_recording" to be cleared, after that nothing is recorded.
+    __atomic_store_n(&(buffer->is_recording), true, __ATOMIC_SEQ_CST);
+    if (__builtin_expect(__atomic_load_n(&trace__is_stopped, __ATOMIC_SEQ_CST), false)) {
+        __atomic_store_n(&(buffer->is_recording), false, __ATOMIC_RELEASE);
+        if (owned_name) {free((void*)name);}
+        return;
+    }
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    trace_event* const event = &(buffer->events[buffer->events_count % trace__buffer_size]);
+    if (buffer->events_count >= trace__buffer_size && event->owned_name) {free((void*)event->name);}
+    *event = (trace_event){
+        .time_ns    = (uint64_t)time.tv_sec * 1000000000ull + time.tv_nsec,
+        .name       = name,
+        .thread_id  = (uint32_t)buffer->thread_id,
+        .phase      = phase,
+        .owned_name = owned_name
+    };
+    buffer->events_count++;
+    __atomic_store_n(&(buffer->is_recording), false, __ATOMIC_RELEASE);
+}
+
+// Phases: 'B' - the beginning of a span, 'E' - the end of the last span, 'i' - an instant event.
+// When tracing is disabled, the function costs one check of a thread local variable.
+static inline void trace__event(uint8_t phase, const char* name) {
+    trace_buffer* const buffer = trace__current_buffer;
+    if (__builtin_expect(buffer != NULL, false)) {trace__record(buffer, phase, name, false);}
+}
+
+static void trace__write_json_string(FILE* file, const char* string) {
+    fputc('"', file);
+    for (const uint8_t* current = (const uint8_t*)string; *current != 0; current++) {
+        if (*current == '"' || *current == '\\') {fprintf(file, "\\%c", *current);}
+        else if (*current < 0x20) {fprintf(file, "\\u%04x", *current);}
+        else {fputc(*current, file);}
+    }
+    fputc('"', file);
+}
+
+// The function stops the recording of all threads and writes their events to the trace file.
+// The buffers are not freed: the detached timer, network and scheduler threads keep pointers to them until the process exits.
+static void trace__export() {
+    if (trace__file_name == NULL) {return;}
+    trace__current_buffer = NULL;
+    __atomic_store_n(&trace__is_stopped, true, __ATOMIC_SEQ_CST);
+    for (trace_buffer* buffer = __atomic_load_n(&trace__buffers, __ATOMIC_ACQUIRE); buffer != NULL; buffer = buffer->next) {
+        while (__atomic_load_n(&(buffer->is_recording), __ATOMIC_ACQUIRE)) {sched_yield();}
+    }
+    FILE* const file = fopen(trace__file_name, "w");
+    if (file == NULL) {fprintf(stderr, "Can't write the trace file \x22%s\x22.\n", trace__file_name);}
+    else {fprintf(file, "{\"traceEvents\":[");}
+    uint64_t const pid = getpid();
+    bool first_event = true;
+    for (trace_buffer* buffer = trace__buffers; buffer != NULL; buffer = buffer->next) {
+        uint64_t const first = buffer->events_count > trace__buffer_size ? buffer->events_count - trace__buffer_size : 0;
+        for (uint64_t index = first; index < buffer->events_count; index++) {
+            trace_event* const event = &(buffer->events[index % trace__buffer_size]);
+            if (file != NULL) {
+                fprintf(file, "%s\n{\"ph\":\"%c\",\"pid\":%" PRIu64 ",\"tid\":%" PRIu32 ",\"ts\":%" PRIu64 ".%03" PRIu64, first_event ? "" : ",", event->phase, pid, event->thread_id, event->time_ns / 1000, event->time_ns % 1000);
+                if (event->name != NULL) {
+                    fprintf(file, ",\"name\":");
+                    trace__write_json_string(file, event->name);
+                }
+                if (event->phase == 'i') {fprintf(file, ",\"s\":\"t\"");}
+                fputc('}', file);
+                first_event = false;
+            }
+            if (event->owned_name) {
+                free((void*)event->name);
+                event->owned_name = false;
+            }
+        }
+        buffer->events_count = 0;
+    }
+    if (file != NULL) {
+        fprintf(file, "\n]}\n");
+        fclose(file);
+    }
+}
+
+// If tracing is enabled (the "SHAR_TRACE" environment variable is set), the function returns "true", otherwise "false".
+type trace__is_enabled() {return (type){.data = trace__file_name != NULL, .type = bool__type_numer};}
+
+// The function begins a span with the specified name in the trace of the current thread.
+void trace__begin(type name) {
+    trace_buffer* const buffer = trace__current_buffer;
+    if (__builtin_expect(buffer != NULL, false)) {trace__record(buffer, 'B', (const char*)string__utf32_to_utf8(name), true);}
+}
+
+// The function ends the last begun span of the current thread.
+void trace__end() {trace__event('E', NULL);}
+
+// The function adds an instant event with the specified name to the trace of the current thread.
+void trace__instant(type name) {
+    trace_buffer* const buffer = trace__current_buffer;
+    if (__builtin_expect(buffer != NULL, false)) {trace__record(buffer, 'i', (const char*)string__utf32_to_utf8(name), true);}
+}
+
+#undef alloc__category
+#pragma endregion Trace
+
 #pragma region Thread
+#define alloc__category alloc__category__pipeline
+
 static bool allow_threads = false;
 static _Atomic uint64_t number_of_threads = 1;
 static _Atomic bool ignored_errors = false;
 static _Atomic uint64_t new_worker_id = 0;
+
+// Coroutine workers (see the "Coroutine" region) park instead of blocking the carrier thread.
+struct coroutine;
+static __thread struct coroutine* coroutine__current = NULL;
+static void coroutine__notify(struct coroutine* coroutine_ptr);
+static bool coroutine__wait_for_signal(pipeline_waiter* waiter, const struct timespec* deadline);
+static void coroutine__sleep_until(const struct timespec* deadline);
+static void coroutine__yield();
 static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static inline void mutex__init(pthread_mutex_t* mutex) {
@@ -369,110 +1199,961 @@ static inline void mutex__destroy(pthread_mutex_t* mutex) {
     }
 }
 
+// Timed waits take CLOCK_MONOTONIC deadlines (see "pipeline__deadline").
+static inline void cond__init(pthread_cond_t* cond) {
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    if (__builtin_expect(pthread_cond_init(cond, &cond_attr) != 0, false)) {
+        fprintf(stderr, "Condition variable initialization error.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_condattr_destroy(&cond_attr);
+}
+
 static inline void global_lock() {mutex__lock(&global_mutex);}
 static inline void global_unlock() {mutex__unlock(&global_mutex);}
 
-uint64_t pipeline__create() {
+#define pipeline__min_capacity 32
+
+static pipeline* pipeline__new(uint64_t max_count) {
+    uint64_t const capacity = max_count != 0 && max_count < pipeline__min_capacity ? max_count : pipeline__min_capacity;
     pipeline* result = malloc(sizeof(pipeline));
     *result = (pipeline) {
-        .use_counter    = 1,
-        .capacity       = 32,
-        .index_of_first = 0,
-        .count          = 0,
-        .items          = (type*)malloc(32 * sizeof(type))
+        .use_counter     = 1,
+        .capacity        = capacity,
+        .index_of_first  = 0,
+        .count           = 0,
+        .max_count       = max_count,
+        .waiting_pushers = 0,
+        .waiters         = NULL,
+        .push_waiters    = NULL,
+        .event_fd        = -1,
+        .items           = (type*)malloc(capacity * sizeof(type)),
+        .spill           = NULL,
+        .levels          = NULL,
+        .group           = NULL
     };
     mutex__init(&(result->mutex));
-    return (uint64_t)result;
+    cond__init(&(result->not_full));
+    return result;
 }
 
-void pipeline__use(uint64_t pipe) {
-    pipeline* pipeline_ptr = (pipeline*)pipe;
-    mutex__lock(&(pipeline_ptr->mutex));
-    if (pipeline_ptr->use_counter != 0) {pipeline_ptr->use_counter++;}
-    mutex__unlock(&(pipeline_ptr->mutex));
+uint64_t pipeline__create() {return (uint64_t)pipeline__new(0);}
+
+// The function creates a pipeline that holds at most "capacity" items.
+// Pushing to a full bounded pipeline blocks until a consumer pops an item.
+uint64_t pipeline__create_bounded(type capacity) {return (uint64_t)pipeline__new(capacity.data == 0 ? 1 : capacity.data);}
+
+// A spilling pipeline keeps at most "threshold" items in memory, the next items are written to segment files
+// in the temporary directory and are read back in FIFO order. The segment files are created without names,
+// so the system removes them when the pipeline is freed (or the process ends).
+#define pipeline__spill_buffer_size  (64 * 1024)
+#define pipeline__spill_segment_size (64 * 1024 * 1024)
+
+// Kinds of spilled records, items of other types stay in memory and only their "type" values are spilled.
+#define pipeline__record_inline 0
+#define pipeline__record_string 1
+#define pipeline__record_bytes  2
+#define pipeline__record_error  3
+
+// The header of a spilled record, "length" bytes of the payload follow it.
+struct {
+    uint32_t type;
+    uint32_t kind;
+    uint64_t data;
+    uint64_t length;
+} typedef pipeline_record;
+
+type fs__get_tmp_dir_name();
+
+static pipeline_segment* pipeline__new_segment() {
+    uint8_t* const dir_name = string__utf32_to_utf8(fs__get_tmp_dir_name());
+    int fd = open((const char*)dir_name, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        uint64_t const dir_name_length = strlen((const char*)dir_name);
+        char* const file_name = malloc(dir_name_length + 32);
+        memcpy(file_name, dir_name, dir_name_length);
+        strcpy(&(file_name[dir_name_length]), "shar-pipeline-XXXXXX");
+        fd = mkostemp(file_name, O_CLOEXEC);
+        if (fd != -1) {unlink(file_name);}
+        free(file_name);
+    }
+    free(dir_name);
+    if (__builtin_expect(fd == -1, false)) {
+        fprintf(stderr, "Failed to create a segment file of a pipeline.\n");
+        exit(EXIT_FAILURE);
+    }
+    pipeline_segment* const result = malloc(sizeof(pipeline_segment));
+    *result = (pipeline_segment){.fd = fd, .write_offset = 0, .read_offset = 0, .next = NULL};
+    return result;
 }
 
-void pipeline__free(uint64_t pipe, void* th_data) {
-    pipeline* pipeline_ptr = (pipeline*)pipe;
-    mutex__lock(&(pipeline_ptr->mutex));
-    switch (pipeline_ptr->use_counter) {
-    case 0:
-        break;
-    case 1:
-        mutex__unlock(&(pipeline_ptr->mutex));
-        mutex__destroy(&(pipeline_ptr->mutex));
-        for (uint64_t offset = 0; offset < pipeline_ptr->count; offset++) {
-            type const item = pipeline_ptr->items[pipeline_ptr->index_of_first + offset];
-            if (item.type != error__type_number) {shar__rc_free(item, th_data, false);}
-            else {
-                string__println_as_error(error__get_message(item));
-                error__free(item, th_data);
-                ignored_errors = true;
-            }
+static void pipeline__spill_flush(pipeline_spill* spill) {
+    uint64_t written = 0;
+    while (written < spill->write_length) {
+        int64_t const result = pwrite(spill->last->fd, &(spill->write_buffer[written]), spill->write_length - written, spill->last->write_offset + written);
+        if (result == -1 && errno == EINTR) {continue;}
+        if (__builtin_expect(result <= 0, false)) {
+            fprintf(stderr, "Failed to write a segment file of a pipeline.\n");
+            exit(EXIT_FAILURE);
         }
-        free(pipeline_ptr->items);
-        free(pipeline_ptr);
-        return;
-    default:
-        pipeline_ptr->use_counter--;
+        written += result;
     }
-    mutex__unlock(&(pipeline_ptr->mutex));
+    spill->last->write_offset += written;
+    spill->write_length = 0;
 }
 
-void pipeline__to_const(uint64_t pipe) {
-    pipeline* pipeline_ptr = (pipeline*)pipe;
-    mutex__lock(&(pipeline_ptr->mutex));
-    if (pipeline_ptr->use_counter != 0) {pipeline_ptr->use_counter = 0;}
-    mutex__unlock(&(pipeline_ptr->mutex));
+static void pipeline__spill_write(pipeline_spill* spill, const void* data, uint64_t length) {
+    const uint8_t* source = data;
+    while (length != 0) {
+        if (spill->write_length == pipeline__spill_buffer_size) {pipeline__spill_flush(spill);}
+        uint64_t const portion = length < pipeline__spill_buffer_size - spill->write_length ? length : pipeline__spill_buffer_size - spill->write_length;
+        memcpy(&(spill->write_buffer[spill->write_length]), source, portion);
+        spill->write_length += portion;
+        source += portion;
+        length -= portion;
+    }
 }
 
-void pipeline__push(uint64_t pipe, type pushed_object) {
-    pipeline* pipeline_ptr = (pipeline*)pipe;
-    mutex__lock(&(pipeline_ptr->mutex));
-    if (pipeline_ptr->capacity == (pipeline_ptr->index_of_first + pipeline_ptr->count)) {
-        if (pipeline_ptr->index_of_first == 0) {
-            pipeline_ptr->capacity *= 2;
-            pipeline_ptr->items = realloc(pipeline_ptr->items, pipeline_ptr->capacity * sizeof(type));
-        } else {
-            memmove(pipeline_ptr->items, &(pipeline_ptr->items[pipeline_ptr->index_of_first]), pipeline_ptr->count * sizeof(type));
-            pipeline_ptr->index_of_first = 0;
+static void pipeline__spill_read(pipeline_spill* spill, void* data, uint64_t length) {
+    uint8_t* destination = data;
+    while (length != 0) {
+        if (spill->read_position == spill->read_length) {
+            pipeline_segment* const segment = spill->first;
+            if (segment == spill->last && spill->write_length != 0) {pipeline__spill_flush(spill);}
+            int64_t const result = pread(segment->fd, spill->read_buffer, pipeline__spill_buffer_size, segment->read_offset);
+            if (result == -1 && errno == EINTR) {continue;}
+            if (__builtin_expect(result <= 0, false)) {
+                fprintf(stderr, "Failed to read a segment file of a pipeline.\n");
+                exit(EXIT_FAILURE);
+            }
+            spill->read_position = 0;
+            spill->read_length = result;
+            segment->read_offset += spill->read_length;
         }
+        uint64_t const portion = length < spill->read_length - spill->read_position ? length : spill->read_length - spill->read_position;
+        memcpy(destination, &(spill->read_buffer[spill->read_position]), portion);
+        spill->read_position += portion;
+        destination += portion;
+        length -= portion;
     }
-    pipeline_ptr->items[pipeline_ptr->index_of_first + pipeline_ptr->count] = pushed_object;
-    pipeline_ptr->count++;
-    mutex__unlock(&(pipeline_ptr->mutex));
 }
 
-type pipeline__pop(uint64_t pipe) {
+// The item is written to the last segment, its memory is freed (except the objects that stay in memory).
+static void pipeline__spill_item(pipeline_spill* spill, type item) {
+    if (spill->last->write_offset + spill->write_length >= pipeline__spill_segment_size) {
+        pipeline__spill_flush(spill);
+        spill->last->next = pipeline__new_segment();
+        spill->last = spill->last->next;
+    }
+    pipeline_record record = {.type = item.type, .kind = pipeline__record_inline, .data = item.data, .length = 0};
+    switch (item.type) {
+    case string__type_number: {
+        uint64_t const chars_count = ((const uint64_t*)item.data)[1];
+        const uint32_t* const chars = &(((const uint32_t*)item.data)[4]);
+        // The chars are spilled as UTF-32, so any string (with zero or invalid chars too) is read back unchanged.
+        record.kind = pipeline__record_string;
+        record.length = chars_count * sizeof(uint32_t);
+        pipeline__spill_write(spill, &record, sizeof(record));
+        pipeline__spill_write(spill, chars, record.length);
+        uint64_t const rc = ((const uint64_t*)item.data)[0];
+        if (rc == 1) {free((void*)item.data);}
+        else if (rc != 0) {((uint64_t*)item.data)[0] = rc - 1;}
+        break;
+    }
+    case bytes__type_number:
+        record.kind = pipeline__record_bytes;
+        record.length = bytes__get_length(item).data;
+        pipeline__spill_write(spill, &record, sizeof(record));
+        pipeline__spill_write(spill, ((const bytes*)item.data)->data, record.length);
+        bytes__free(item);
+        break;
+    case error__type_number: {
+        // The data of the error stays in memory, the message is spilled as UTF-8.
+        error* const error_ptr = (error*)item.data;
+        uint8_t* const message = string__utf32_to_utf8(error__get_message(item));
+        record.kind = pipeline__record_error;
+        record.data = error_ptr->id;
+        record.length = strlen((const char*)message);
+        pipeline__spill_write(spill, &record, sizeof(record));
+        pipeline__spill_write(spill, &(error_ptr->data), sizeof(type));
+        pipeline__spill_write(spill, message, record.length);
+        free(message);
+        error_ptr->data = (type){.data = 0, .type = nothing__type_number};
+        error__free(item, NULL);
+        break;
+    }
+    default:
+        pipeline__spill_write(spill, &record, sizeof(record));
+    }
+    spill->count++;
+}
+
+// The function reads the oldest spilled item, the segments that have been read completely are closed.
+static type pipeline__unspill_item(pipeline_spill* spill) {
+    if (spill->read_position == spill->read_length && spill->first->read_offset == spill->first->write_offset && spill->first != spill->last) {
+        pipeline_segment* const segment = spill->first;
+        spill->first = segment->next;
+        close(segment->fd);
+        free(segment);
+    }
+    pipeline_record record;
+    pipeline__spill_read(spill, &record, sizeof(record));
+    type result = (type){.data = record.data, .type = record.type};
+    if (record.kind == pipeline__record_string) {
+        uint64_t* const string_ptr = malloc(2 * sizeof(uint64_t) + record.length);
+        string_ptr[0] = 1;
+        string_ptr[1] = record.length / sizeof(uint32_t);
+        pipeline__spill_read(spill, &(string_ptr[2]), record.length);
+        result = (type){.data = (uint64_t)string_ptr, .type = string__type_number};
+    } else if (record.kind != pipeline__record_inline) {
+        type error_data;
+        if (record.kind == pipeline__record_error) {pipeline__spill_read(spill, &error_data, sizeof(type));}
+        uint8_t* const payload = malloc(record.length + 1);
+        pipeline__spill_read(spill, payload, record.length);
+        switch (record.kind) {
+        case pipeline__record_bytes:
+            result = bytes__create_from_memory(payload, record.length);
+            break;
+        case pipeline__record_error:
+            payload[record.length] = 0;
+            result = error__create_utf8_message((type){.data = record.data, .type = int__type_number}, error_data, payload);
+            break;
+        }
+        free(payload);
+    }
+    spill->count--;
+    // When everything is read, the only segment is truncated, so the disk space is given back.
+    if (spill->count == 0 && spill->first == spill->last && spill->write_length == 0) {
+        if (ftruncate(spill->first->fd, 0) == 0) {
+            spill->first->read_offset = 0;
+            spill->first->write_offset = 0;
+            spill->read_position = 0;
+            spill->read_length = 0;
+        }
+    }
+    return result;
+}
+
+static void pipeline__free_spill(pipeline_spill* spill) {
+    for (pipeline_segment* segment = spill->first; segment != NULL;) {
+        pipeline_segment* const next = segment->next;
+        close(segment->fd);
+        free(segment);
+        segment = next;
+    }
+    free(spill->write_buffer);
+    free(spill->read_buffer);
+    free(spill);
+}
+
+// The items left in a freed pipeline are freed, errors among them are printed.
+static inline void pipeline__free_item(type item, void* th_data) {
+    if (item.type != error__type_number) {shar__object_free(item, th_data);}
+    else {
+        string__println_as_error(error__get_message(item));
+        error__free(item, th_data);
+        ignored_errors = true;
+    }
+}
+
+// The function creates a pipeline that keeps at most "threshold" items in memory, the rest is kept on disk.
+// Ints, bools, strings, byte buffers and errors are spilled, the other objects stay in memory (only their order is kept on disk).
+uint64_t pipeline__create_spilling(type threshold) {
+    pipeline* const result = pipeline__new(0);
+    result->spill = malloc(sizeof(pipeline_spill));
+    *result->spill = (pipeline_spill){
+        .threshold     = threshold.data == 0 ? 1 : threshold.data,
+        .count         = 0,
+        .first         = NULL,
+        .last          = NULL,
+        .write_buffer  = malloc(pipeline__spill_buffer_size),
+        .write_length  = 0,
+        .read_buffer   = malloc(pipeline__spill_buffer_size),
+        .read_position = 0,
+        .read_length   = 0
+    };
+    return (uint64_t)result;
+}
+
+void pipeline__use(uint64_t pipe) {
+    pipeline* pipeline_ptr = (pipeline*)pipe;
+    if (pipeline_ptr->group != NULL) {
+        __atomic_add_fetch(&(pipeline_ptr->group->rc), 1, __ATOMIC_RELAXED);
+        return;
+    }
+    mutex__lock(&(pipeline_ptr->mutex));
+    if (pipeline_ptr->use_counter != 0) {pipeline_ptr->use_counter++;}
+    mutex__unlock(&(pipeline_ptr->mutex));
+}
+
+void pipeline__free(uint64_t pipe, void* th_data) {
+    pipeline* pipeline_ptr = (pipeline*)pipe;
+    pipeline_group* const group = pipeline_ptr->group;
+    if (group != NULL) {
+        if (__atomic_sub_fetch(&(group->rc), 1, __ATOMIC_ACQ_REL) != 0) {return;}
+        for (uint64_t index = 0; index < group->shards_count; index++) {
+            group->shards[index]->group = NULL;
+            pipeline__free((uint64_t)(group->shards[index]), th_data);
+        }
+        group->front->group = NULL;
+        pipeline__free((uint64_t)(group->front), th_data);
+        free(group->shard_pipes);
+        free(group);
+        return;
+    }
+    mutex__lock(&(pipeline_ptr->mutex));
+    switch (pipeline_ptr->use_counter) {
+    case 0:
+        break;
+    case 1:
+        mutex__unlock(&(pipeline_ptr->mutex));
+        mutex__destroy(&(pipeline_ptr->mutex));
+        pthread_cond_destroy(&(pipeline_ptr->not_full));
+        if (pipeline_ptr->event_fd != -1) {close(pipeline_ptr->event_fd);}
+        if (pipeline_ptr->levels == NULL) {
+            for (uint64_t offset = 0; offset < pipeline_ptr->count; offset++) {pipeline__free_item(pipeline_ptr->items[pipeline_ptr->index_of_first + offset], th_data);}
+        }
+        if (pipeline_ptr->levels != NULL) {
+            for (uint64_t level_index = 0; level_index < pipeline_ptr->levels->levels_count; level_index++) {
+                pipeline_level* const level = &(pipeline_ptr->levels->levels[level_index]);
+                for (uint64_t offset = 0; offset < level->count; offset++) {pipeline__free_item(level->items[(level->first + offset) & (level->capacity - 1)], th_data);}
+                free(level->items);
+            }
+            free(pipeline_ptr->levels);
+        }
+        if (pipeline_ptr->spill != NULL) {
+            while (pipeline_ptr->spill->count != 0) {pipeline__free_item(pipeline__unspill_item(pipeline_ptr->spill), th_data);}
+            pipeline__free_spill(pipeline_ptr->spill);
+        }
+        free(pipeline_ptr->items);
+        free(pipeline_ptr);
+        return;
+    default:
+        pipeline_ptr->use_counter--;
+    }
+    mutex__unlock(&(pipeline_ptr->mutex));
+}
+
+void pipeline__to_const(uint64_t pipe) {
+    pipeline* pipeline_ptr = (pipeline*)pipe;
+    mutex__lock(&(pipeline_ptr->mutex));
+    if (pipeline_ptr->use_counter != 0) {pipeline_ptr->use_counter = 0;}
+    mutex__unlock(&(pipeline_ptr->mutex));
+}
+
+// The pipeline mutex must be locked.
+static inline bool pipeline__is_full(const pipeline* pipeline_ptr) {
+    return pipeline_ptr->max_count != 0 && pipeline_ptr->count >= pipeline_ptr->max_count;
+}
+
+#define pipeline__level_min_capacity 16
+
+static void pipeline__resize_level(pipeline_level* level, uint64_t capacity) {
+    type* const items = malloc(capacity * sizeof(type));
+    for (uint64_t offset = 0; offset < level->count; offset++) {items[offset] = level->items[(level->first + offset) & (level->capacity - 1)];}
+    free(level->items);
+    level->items = items;
+    level->capacity = capacity;
+    level->first = 0;
+}
+
+static inline void pipeline__append_to_level(pipeline_levels* levels, type pushed_object, uint64_t level_index) {
+    if (level_index >= levels->levels_count) {level_index = levels->levels_count - 1;}
+    pipeline_level* const level = &(levels->levels[level_index]);
+    if (level->count == level->capacity) {pipeline__resize_level(level, level->capacity * 2);}
+    level->items[(level->first + level->count) & (level->capacity - 1)] = pushed_object;
+    level->count++;
+    levels->non_empty |= (uint64_t)1 << level_index;
+}
+
+// The highest non-empty level is served, unless aging gives the turn to the lowest one.
+static inline type pipeline__take_from_levels(pipeline_levels* levels) {
+    uint64_t level_index = 63 - __builtin_clzll(levels->non_empty);
+    uint64_t const lowest_index = __builtin_ctzll(levels->non_empty);
+    if (level_index == lowest_index) {levels->bypassing_pops = 0;}
+    else if (levels->aging != 0) {
+        levels->bypassing_pops++;
+        if (levels->bypassing_pops > levels->aging) {
+            levels->bypassing_pops = 0;
+            level_index = lowest_index;
+        }
+    }
+    pipeline_level* const level = &(levels->levels[level_index]);
+    type const result = level->items[level->first];
+    level->first = (level->first + 1) & (level->capacity - 1);
+    level->count--;
+    if (level->count == 0) {
+        level->first = 0;
+        levels->non_empty &= ~((uint64_t)1 << level_index);
+    } else if (level->capacity > pipeline__level_min_capacity && level->count <= level->capacity / 4) {
+        pipeline__resize_level(level, level->capacity / 2);
+    }
+    return result;
+}
+
+// The event descriptor of the front of a sharded pipeline counts the non-empty shards, a shard adds itself
+// when it gets its first item and takes itself back when it becomes empty. The shard mutex must be locked.
+static inline void pipeline__signal_front(const pipeline* pipeline_ptr, bool has_items) {
+    pipeline_group* const group = pipeline_ptr->group;
+    if (__builtin_expect(group == NULL || pipeline_ptr == group->front || group->front->event_fd == -1, true)) {return;}
+    if (has_items) {eventfd_write(group->front->event_fd, 1);}
+    else {
+        eventfd_t value;
+        eventfd_read(group->front->event_fd, &value);
+    }
+}
+
+static inline void pipeline__signal_waiters(pipeline_wait_node* waiters) {
+    for (pipeline_wait_node* node = waiters; node != NULL; node = node->next) {
+        pipeline_waiter* const waiter = node->waiter;
+        mutex__lock(&(waiter->mutex));
+        waiter->signaled = true;
+        if (waiter->coroutine != NULL) {coroutine__notify(waiter->coroutine);}
+        else {pthread_cond_signal(&(waiter->cond));}
+        mutex__unlock(&(waiter->mutex));
+    }
+}
+
+// The pipeline mutex must be locked and the pipeline must not be full (only "pipeline__push_over" goes past the limit).
+// The level is used only by priority pipelines.
+static inline void pipeline__append_at(pipeline* pipeline_ptr, type pushed_object, uint64_t level) {
+    pipeline_spill* const spill = pipeline_ptr->spill;
+    // Once items are spilled, the new items follow them to disk until the disk part is read back.
+    if (spill != NULL && (spill->count != 0 || pipeline_ptr->count >= spill->threshold)) {
+        if (spill->first == NULL) {
+            spill->first = pipeline__new_segment();
+            spill->last = spill->first;
+        }
+        pipeline__spill_item(spill, pushed_object);
+        return;
+    }
+    if (pipeline_ptr->levels != NULL) {
+        pipeline__append_to_level(pipeline_ptr->levels, pushed_object, level);
+    } else {
+        if (pipeline_ptr->capacity == (pipeline_ptr->index_of_first + pipeline_ptr->count)) {
+            if (pipeline_ptr->index_of_first == 0) {
+                pipeline_ptr->capacity *= 2;
+                if (pipeline_ptr->max_count > pipeline_ptr->count && pipeline_ptr->capacity > pipeline_ptr->max_count) {pipeline_ptr->capacity = pipeline_ptr->max_count;}
+                pipeline_ptr->items = realloc(pipeline_ptr->items, pipeline_ptr->capacity * sizeof(type));
+            } else {
+                memmove(pipeline_ptr->items, &(pipeline_ptr->items[pipeline_ptr->index_of_first]), pipeline_ptr->count * sizeof(type));
+                pipeline_ptr->index_of_first = 0;
+            }
+        }
+        pipeline_ptr->items[pipeline_ptr->index_of_first + pipeline_ptr->count] = pushed_object;
+    }
+    pipeline_ptr->count++;
+    if (pipeline_ptr->count == 1) {
+        if (pipeline_ptr->event_fd != -1) {eventfd_write(pipeline_ptr->event_fd, 1);}
+        pipeline__signal_front(pipeline_ptr, true);
+    }
+    pipeline__signal_waiters(pipeline_ptr->waiters);
+}
+
+static inline void pipeline__append(pipeline* pipeline_ptr, type pushed_object) {pipeline__append_at(pipeline_ptr, pushed_object, 0);}
+
+// The pipeline mutex must be locked and the items array must be empty.
+// Half of the threshold is read back at once, so the segment files are read in large portions.
+static void pipeline__unspill(pipeline* pipeline_ptr) {
+    pipeline_spill* const spill = pipeline_ptr->spill;
+    uint64_t count = spill->threshold / 2;
+    if (count == 0) {count = 1;}
+    if (count > spill->count) {count = spill->count;}
+    if (pipeline_ptr->capacity < count) {
+        pipeline_ptr->capacity = count;
+        pipeline_ptr->items = realloc(pipeline_ptr->items, pipeline_ptr->capacity * sizeof(type));
+    }
+    pipeline_ptr->index_of_first = 0;
+    for (uint64_t index = 0; index < count; index++) {pipeline_ptr->items[index] = pipeline__unspill_item(spill);}
+    pipeline_ptr->count = count;
+}
+
+// The pipeline mutex must be locked and the pipeline must not be empty.
+// When the number of items falls to a quarter of the capacity, the items array is halved,
+// so the memory taken during a burst is given back.
+static inline type pipeline__take_first(pipeline* pipeline_ptr) {
+    if (pipeline_ptr->levels != NULL) {
+        type const result = pipeline__take_from_levels(pipeline_ptr->levels);
+        pipeline_ptr->count--;
+        if (pipeline_ptr->count == 0) {
+            if (pipeline_ptr->event_fd != -1) {
+                eventfd_t value;
+                eventfd_read(pipeline_ptr->event_fd, &value);
+            }
+            pipeline__signal_front(pipeline_ptr, false);
+        }
+        return result;
+    }
+    type const result = pipeline_ptr->items[pipeline_ptr->index_of_first];
+    pipeline_ptr->index_of_first++;
+    pipeline_ptr->count--;
+    if (pipeline_ptr->count == 0 && pipeline_ptr->spill != NULL && pipeline_ptr->spill->count != 0) {pipeline__unspill(pipeline_ptr);}
+    if (pipeline_ptr->count == 0) {
+        pipeline_ptr->index_of_first = 0;
+        if (pipeline_ptr->event_fd != -1) {
+            eventfd_t value;
+            eventfd_read(pipeline_ptr->event_fd, &value);
+        }
+        pipeline__signal_front(pipeline_ptr, false);
+    } else if (pipeline_ptr->capacity > pipeline__min_capacity && pipeline_ptr->count <= pipeline_ptr->capacity / 4) {
+        memmove(pipeline_ptr->items, &(pipeline_ptr->items[pipeline_ptr->index_of_first]), pipeline_ptr->count * sizeof(type));
+        pipeline_ptr->index_of_first = 0;
+        pipeline_ptr->capacity /= 2;
+        pipeline_ptr->items = realloc(pipeline_ptr->items, pipeline_ptr->capacity * sizeof(type));
+    }
+    if (pipeline_ptr->waiting_pushers != 0) {pthread_cond_signal(&(pipeline_ptr->not_full));}
+    pipeline__signal_waiters(pipeline_ptr->push_waiters);
+    return result;
+}
+
+static __thread uint64_t pipeline__shard_cursor = 0;
+
+// A push to the front of a sharded pipeline goes to the next shard, every thread goes round the shards on its own.
+static inline pipeline* pipeline__push_target(pipeline* pipeline_ptr) {
+    pipeline_group* const group = pipeline_ptr->group;
+    if (__builtin_expect(group == NULL || pipeline_ptr != group->front, true)) {return pipeline_ptr;}
+    if (pipeline__shard_cursor == 0) {pipeline__shard_cursor = (uint64_t)&pipeline__shard_cursor >> 6;}
+    pipeline__shard_cursor++;
+    return group->shards[pipeline__shard_cursor % group->shards_count];
+}
+
+// The pipeline mutex must be locked. The function returns when the pipeline has room or the deadline ("NULL" - without a deadline)
+// has passed, then it returns "true". A coroutine parks instead of blocking its carrier, so the consumers still get the carriers.
+__attribute__((noinline)) static bool pipeline__wait_not_full(pipeline* pipeline_ptr, const struct timespec* deadline) {
+    bool timed_out = false;
+    if (coroutine__current == NULL) {
+        if (!pipeline__is_full(pipeline_ptr)) {return false;}
+        trace__event('B', "pipeline__push wait");
+        pipeline_ptr->waiting_pushers++;
+        while (pipeline__is_full(pipeline_ptr) && !timed_out) {
+            if (deadline == NULL) {pthread_cond_wait(&(pipeline_ptr->not_full), &(pipeline_ptr->mutex));}
+            else {timed_out = pthread_cond_timedwait(&(pipeline_ptr->not_full), &(pipeline_ptr->mutex), deadline) == ETIMEDOUT;}
+        }
+        pipeline_ptr->waiting_pushers--;
+        trace__event('E', NULL);
+        return pipeline__is_full(pipeline_ptr);
+    }
+    pipeline_waiter waiter;
+    waiter.signaled = false;
+    waiter.coroutine = coroutine__current;
+    mutex__init(&(waiter.mutex));
+    pipeline_wait_node node;
+    while (pipeline__is_full(pipeline_ptr) && !timed_out) {
+        node = (pipeline_wait_node){.waiter = &waiter, .prev = NULL, .next = pipeline_ptr->push_waiters};
+        if (pipeline_ptr->push_waiters != NULL) {pipeline_ptr->push_waiters->prev = &node;}
+        pipeline_ptr->push_waiters = &node;
+        mutex__unlock(&(pipeline_ptr->mutex));
+        timed_out = coroutine__wait_for_signal(&waiter, deadline);
+        mutex__lock(&(pipeline_ptr->mutex));
+        if (node.prev == NULL) {pipeline_ptr->push_waiters = node.next;}
+        else {node.prev->next = node.next;}
+        if (node.next != NULL) {node.next->prev = node.prev;}
+    }
+    mutex__destroy(&(waiter.mutex));
+    return pipeline__is_full(pipeline_ptr);
+}
+
+void pipeline__push(uint64_t pipe, type pushed_object) {
+    pipeline* pipeline_ptr = pipeline__push_target((pipeline*)pipe);
+    mutex__lock(&(pipeline_ptr->mutex));
+    if (__builtin_expect(pipeline__is_full(pipeline_ptr), false)) {pipeline__wait_not_full(pipeline_ptr, NULL);}
+    pipeline__append(pipeline_ptr, pushed_object);
+    mutex__unlock(&(pipeline_ptr->mutex));
+}
+
+// The function pushes "count" objects with one lock of the pipeline, so other threads see the whole batch at once.
+// For a bounded pipeline the function waits for free space before each object, as "pipeline__push" does.
+void pipeline__push_many(uint64_t pipe, const type* pushed_objects, type count) {
+    pipeline* pipeline_ptr = pipeline__push_target((pipeline*)pipe);
+    mutex__lock(&(pipeline_ptr->mutex));
+    for (uint64_t index = 0; index < count.data; index++) {
+        if (__builtin_expect(pipeline__is_full(pipeline_ptr), false)) {pipeline__wait_not_full(pipeline_ptr, NULL);}
+        pipeline__append(pipeline_ptr, pushed_objects[index]);
+    }
+    mutex__unlock(&(pipeline_ptr->mutex));
+}
+
+// The function waits for room until the deadline, if the deadline passes, "false" is returned and the object stays with the caller.
+static bool pipeline__push_until(uint64_t pipe, type pushed_object, const struct timespec* deadline) {
+    pipeline* pipeline_ptr = pipeline__push_target((pipeline*)pipe);
+    mutex__lock(&(pipeline_ptr->mutex));
+    bool const is_full = pipeline__is_full(pipeline_ptr) && pipeline__wait_not_full(pipeline_ptr, deadline);
+    if (!is_full) {pipeline__append(pipeline_ptr, pushed_object);}
+    mutex__unlock(&(pipeline_ptr->mutex));
+    return !is_full;
+}
+
+// The function pushes the object even to a full pipeline, so the last items of a producer that stops are not lost.
+static void pipeline__push_over(uint64_t pipe, type pushed_object) {
+    pipeline* pipeline_ptr = pipeline__push_target((pipeline*)pipe);
+    mutex__lock(&(pipeline_ptr->mutex));
+    pipeline__append(pipeline_ptr, pushed_object);
+    mutex__unlock(&(pipeline_ptr->mutex));
+}
+
+// The function pushes the object only if the pipeline is not full.
+// If the object was pushed, then the function returns "true", otherwise "false" and the object stays with the caller.
+type pipeline__try_push(uint64_t pipe, type pushed_object) {
+    pipeline* pipeline_ptr = pipeline__push_target((pipeline*)pipe);
+    mutex__lock(&(pipeline_ptr->mutex));
+    bool const result = !pipeline__is_full(pipeline_ptr);
+    if (result) {pipeline__append(pipeline_ptr, pushed_object);}
+    mutex__unlock(&(pipeline_ptr->mutex));
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function creates a pipeline with "levels" priority levels (from 1 to 64), "pipeline__pop" takes the oldest item
+// of the highest non-empty level. Items pushed with "pipeline__push" go to the lowest level 0.
+uint64_t pipeline__create_priority(type levels) {
+    uint64_t const levels_count = levels.data == 0 ? 1 : levels.data > 64 ? 64 : levels.data;
+    pipeline* const result = pipeline__new(0);
+    result->levels = malloc(sizeof(pipeline_levels) + levels_count * sizeof(pipeline_level));
+    *result->levels = (pipeline_levels){.levels_count = levels_count, .non_empty = 0, .aging = 0, .bypassing_pops = 0};
+    for (uint64_t index = 0; index < levels_count; index++) {
+        result->levels->levels[index] = (pipeline_level){.items = malloc(pipeline__level_min_capacity * sizeof(type)), .capacity = pipeline__level_min_capacity, .first = 0, .count = 0};
+    }
+    return (uint64_t)result;
+}
+
+// The function pushes the object to the level (levels above the highest one mean the highest one).
+// For a pipeline without levels, it is the same as "pipeline__push".
+void pipeline__push_priority(uint64_t pipe, type pushed_object, type level) {
+    pipeline* pipeline_ptr = (pipeline*)pipe;
+    if (pipeline_ptr->levels == NULL) {
+        pipeline__push(pipe, pushed_object);
+        return;
+    }
+    mutex__lock(&(pipeline_ptr->mutex));
+    pipeline__append_at(pipeline_ptr, pushed_object, level.data);
+    mutex__unlock(&(pipeline_ptr->mutex));
+}
+
+// With aging, after "pops" pops in a row that bypass a lower non-empty level, the oldest item of the lowest non-empty level is popped,
+// so the low levels don't starve. 0 turns aging off.
+void pipeline__set_priority_aging(uint64_t pipe, type pops) {
     pipeline* pipeline_ptr = (pipeline*)pipe;
     mutex__lock(&(pipeline_ptr->mutex));
+    if (pipeline_ptr->levels != NULL) {
+        pipeline_ptr->levels->aging = pops.data;
+        pipeline_ptr->levels->bypassing_pops = 0;
+    }
+    mutex__unlock(&(pipeline_ptr->mutex));
+}
+
+// A consumer pops from its shard, when the shard is empty, it steals from the other shards (except in a keyed pipeline).
+// Stealing doesn't wait for locked shards, their owners are working on them. A pop from the front takes from any shard.
+static type pipeline__pop_group(pipeline* pipeline_ptr) {
+    pipeline_group* const group = pipeline_ptr->group;
+    type result = (type){.data = 0, .type = nothing__type_number};
+    bool const is_front = pipeline_ptr == group->front;
+    if (!is_front) {
+        mutex__lock(&(pipeline_ptr->mutex));
+        if (pipeline_ptr->count != 0) {result = pipeline__take_first(pipeline_ptr);}
+        mutex__unlock(&(pipeline_ptr->mutex));
+        if (result.type != nothing__type_number || group->is_keyed) {return result;}
+    }
+    if (pipeline__shard_cursor == 0) {pipeline__shard_cursor = (uint64_t)&pipeline__shard_cursor >> 6;}
+    uint64_t const first = pipeline__shard_cursor++;
+    for (uint64_t pass = 0; pass < 2; pass++) {
+        for (uint64_t offset = 0; offset < group->shards_count; offset++) {
+            pipeline* const shard = group->shards[(first + offset) % group->shards_count];
+            if (shard == pipeline_ptr || __atomic_load_n(&(shard->count), __ATOMIC_RELAXED) == 0) {continue;}
+            if (pass == 0) {
+                if (pthread_mutex_trylock(&(shard->mutex)) != 0) {continue;}
+            } else {
+                mutex__lock(&(shard->mutex));
+            }
+            if (shard->count != 0) {result = pipeline__take_first(shard);}
+            mutex__unlock(&(shard->mutex));
+            if (result.type != nothing__type_number) {return result;}
+        }
+    }
+    return result;
+}
+
+type pipeline__pop(uint64_t pipe) {
+    pipeline* pipeline_ptr = (pipeline*)pipe;
+    if (pipeline_ptr->group != NULL) {return pipeline__pop_group(pipeline_ptr);}
+    mutex__lock(&(pipeline_ptr->mutex));
     type result;
     if (pipeline_ptr->count == 0) {
         result = (type){.data = 0, .type = nothing__type_number};
     } else {
-        result = pipeline_ptr->items[pipeline_ptr->index_of_first];
-        pipeline_ptr->index_of_first++;
-        pipeline_ptr->count--;
+        result = pipeline__take_first(pipeline_ptr);
     }
     mutex__unlock(&(pipeline_ptr->mutex));
     return result;
 }
 
+// For the front of a sharded pipeline, the function returns the number of items in all shards.
 type pipeline__items_count(uint64_t pipe) {
     pipeline* pipeline_ptr = (pipeline*)pipe;
+    pipeline_group* const group = pipeline_ptr->group;
+    if (group != NULL && pipeline_ptr == group->front) {
+        uint64_t count = 0;
+        for (uint64_t index = 0; index < group->shards_count; index++) {count += pipeline__items_count((uint64_t)(group->shards[index])).data;}
+        return (type){.data = count, .type = int__type_number};
+    }
     mutex__lock(&(pipeline_ptr->mutex));
-    type const result = (type){.data = pipeline_ptr->count, .type = int__type_number};
+    type const result = (type){.data = pipeline_ptr->count + (pipeline_ptr->spill != NULL ? pipeline_ptr->spill->count : 0), .type = int__type_number};
     mutex__unlock(&(pipeline_ptr->mutex));
     return result;
 }
 
-static void* worker__run(void* args) {
-    worker worker_var = *(worker*)args;
-    type (*function)(type, type, void*, bool) = worker_var.worker;
+static uint64_t pipeline__create_group(type shards, bool is_keyed) {
+    uint64_t const shards_count = shards.data == 0 ? 1 : shards.data;
+    pipeline_group* const group = malloc(sizeof(pipeline_group) + shards_count * sizeof(pipeline*));
+    *group = (pipeline_group){.rc = 1, .shards_count = shards_count, .is_keyed = is_keyed, .front = pipeline__new(0), .shard_pipes = malloc(shards_count * sizeof(type))};
+    group->front->group = group;
+    for (uint64_t index = 0; index < shards_count; index++) {
+        group->shards[index] = pipeline__new(0);
+        group->shards[index]->group = group;
+        group->shard_pipes[index] = (type){.data = (uint64_t)(group->shards[index]), .type = int__type_number};
+    }
+    return (uint64_t)(group->front);
+}
+
+// The function creates a sharded pipeline with "shards" sub-pipelines and returns its front: producers push to the front,
+// consumers pop from their shards ("pipeline__get_shard"), an idle consumer steals items from the other shards.
+// The order of items is kept only within a shard.
+uint64_t pipeline__create_sharded(type shards) {return pipeline__create_group(shards, false);}
+
+// The function creates a sharded pipeline that is filled with "pipeline__push_keyed": all items with the same key go to one shard
+// and there is no stealing, so the items of a key are popped in the order of pushes by one consumer.
+uint64_t pipeline__create_sharded_keyed(type shards) {return pipeline__create_group(shards, true);}
+
+// The function returns the shard "index" (modulo the number of shards) of a sharded pipeline, the shard must be freed with "pipeline__free".
+// Pushes to a shard stay in it, pops and waits of a shard take items of the other shards when it is empty (except in a keyed pipeline).
+uint64_t pipeline__get_shard(uint64_t pipe, type index) {
+    pipeline_group* const group = ((pipeline*)pipe)->group;
+    if (group == NULL) {
+        pipeline__use(pipe);
+        return pipe;
+    }
+    __atomic_add_fetch(&(group->rc), 1, __ATOMIC_RELAXED);
+    return (uint64_t)(group->shards[index.data % group->shards_count]);
+}
+
+// Strings and byte buffers are hashed with the secret key of "string__hash", other keys are mixed with it,
+// so the shards of crafted keys can't be predicted from outside.
+static uint64_t pipeline__hash_key(type key) {
+    uint64_t hash;
+    switch (key.type) {
+    case string__type_number:
+        hash = string__hash(key, (type){.data = 0, .type = int__type_number}).data;
+        break;
+    case bytes__type_number: {
+        const bytes* const bytes_ptr = (const bytes*)key.data;
+        hash = string__hash_bytes(bytes_ptr->data, bytes_ptr->length, 0);
+        break;
+    }
+    default:
+        hash = key.data ^ string__hash_key[0];
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// The function pushes the object to the shard of the key (the key stays with the caller).
+// For a pipeline that is not sharded, it is the same as "pipeline__push".
+void pipeline__push_keyed(uint64_t pipe, type key, type pushed_object) {
+    pipeline_group* const group = ((pipeline*)pipe)->group;
+    if (group != NULL) {pipe = (uint64_t)(group->shards[pipeline__hash_key(key) % group->shards_count]);}
+    pipeline__push(pipe, pushed_object);
+}
+
+// Converts a timeout in milliseconds (negative means "forever") into an absolute CLOCK_MONOTONIC deadline.
+static inline bool pipeline__deadline(int64_t timeout_ms, struct timespec* deadline) {
+    if (timeout_ms < 0) {return false;}
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+    return true;
+}
+
+// The function waits until one of the pipelines has items or the deadline ("NULL" - without a deadline) passes.
+// The waiting thread is added to the waiters list of every pipeline, a push to any of them wakes it up.
+// Returns the index of a pipeline that has items, or -1 if the deadline has passed.
+static int64_t pipeline__wait_any(const type* pipes, uint64_t count, const struct timespec* deadline) {
+    pipeline_wait_node stack_nodes[8];
+    pipeline_wait_node* const nodes = count <= 8 ? stack_nodes : malloc(count * sizeof(pipeline_wait_node));
+    pipeline_waiter waiter;
+    waiter.signaled = false;
+    waiter.coroutine = coroutine__current;
+    mutex__init(&(waiter.mutex));
+    {
+        pthread_condattr_t cond_attr;
+        pthread_condattr_init(&cond_attr);
+        pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+        if (__builtin_expect(pthread_cond_init(&(waiter.cond), &cond_attr) != 0, false)) {
+            fprintf(stderr, "Condition variable initialization error.\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_condattr_destroy(&cond_attr);
+    }
+    int64_t result = -1;
+    bool timed_out = false;
+    bool final_pass = false;
+    for (;;) {
+        uint64_t registered = 0;
+        for (; registered < count; registered++) {
+            pipeline* const pipeline_ptr = (pipeline*)(pipes[registered].data);
+            mutex__lock(&(pipeline_ptr->mutex));
+            if (pipeline_ptr->count != 0) {
+                mutex__unlock(&(pipeline_ptr->mutex));
+                result = registered;
+                break;
+            }
+            pipeline_wait_node* const node = &(nodes[registered]);
+            *node = (pipeline_wait_node){.waiter = &waiter, .prev = NULL, .next = pipeline_ptr->waiters};
+            if (pipeline_ptr->waiters != NULL) {pipeline_ptr->waiters->prev = node;}
+            pipeline_ptr->waiters = node;
+            mutex__unlock(&(pipeline_ptr->mutex));
+        }
+        if (result == -1 && !timed_out && waiter.coroutine != NULL) {
+            timed_out = coroutine__wait_for_signal(&waiter, deadline);
+        } else if (result == -1 && !timed_out) {
+            trace__event('B', "pipeline wait");
+            mutex__lock(&(waiter.mutex));
+            while (!waiter.signaled && !timed_out) {
+                if (deadline == NULL) {pthread_cond_wait(&(waiter.cond), &(waiter.mutex));}
+                else {timed_out = pthread_cond_timedwait(&(waiter.cond), &(waiter.mutex), deadline) == ETIMEDOUT;}
+            }
+            waiter.signaled = false;
+            mutex__unlock(&(waiter.mutex));
+            trace__event('E', NULL);
+        }
+        for (uint64_t index = 0; index < registered; index++) {
+            pipeline* const pipeline_ptr = (pipeline*)(pipes[index].data);
+            pipeline_wait_node* const node = &(nodes[index]);
+            mutex__lock(&(pipeline_ptr->mutex));
+            if (node->prev == NULL) {pipeline_ptr->waiters = node->next;}
+            else {node->prev->next = node->next;}
+            if (node->next != NULL) {node->next->prev = node->prev;}
+            mutex__unlock(&(pipeline_ptr->mutex));
+        }
+        if (result != -1 || final_pass) {break;}
+        final_pass = timed_out;
+    }
+    mutex__destroy(&(waiter.mutex));
+    pthread_cond_destroy(&(waiter.cond));
+    if (nodes != stack_nodes) {free(nodes);}
+    return result;
+}
+
+// A sharded pipeline (its front or a shard that can steal) has items when any of its shards has items.
+static inline bool pipeline__waits_for_group(pipeline* pipeline_ptr) {
+    pipeline_group* const group = pipeline_ptr->group;
+    return group != NULL && (!group->is_keyed || pipeline_ptr == group->front);
+}
+
+// The function waits until one of the pipelines has items and returns the index of that pipeline.
+// If "timeout_ms" is negative, the function waits without a time limit, otherwise when the time runs out, "nothing" is returned.
+type pipeline__select(const type* pipes, type count, type timeout_ms) {
+    struct timespec deadline;
+    bool const has_deadline = pipeline__deadline((int64_t)timeout_ms.data, &deadline);
+    uint64_t expanded_count = 0;
+    for (uint64_t index = 0; index < count.data; index++) {
+        pipeline* const pipeline_ptr = (pipeline*)(pipes[index].data);
+        expanded_count += pipeline__waits_for_group(pipeline_ptr) ? pipeline_ptr->group->shards_count : 1;
+    }
+    int64_t index;
+    if (expanded_count == count.data) {
+        index = pipeline__wait_any(pipes, count.data, has_deadline ? &deadline : NULL);
+    } else {
+        type* const expanded_pipes = malloc(expanded_count * sizeof(type));
+        uint64_t* const owners = malloc(expanded_count * sizeof(uint64_t));
+        uint64_t expanded_index = 0;
+        for (uint64_t pipe_index = 0; pipe_index < count.data; pipe_index++) {
+            pipeline* const pipeline_ptr = (pipeline*)(pipes[pipe_index].data);
+            uint64_t const pipe_count = pipeline__waits_for_group(pipeline_ptr) ? pipeline_ptr->group->shards_count : 1;
+            for (uint64_t offset = 0; offset < pipe_count; offset++) {
+                expanded_pipes[expanded_index] = pipe_count == 1 ? pipes[pipe_index] : pipeline_ptr->group->shard_pipes[offset];
+                owners[expanded_index] = pipe_index;
+                expanded_index++;
+            }
+        }
+        index = pipeline__wait_any(expanded_pipes, expanded_count, has_deadline ? &deadline : NULL);
+        if (index != -1) {index = owners[index];}
+        free(expanded_pipes);
+        free(owners);
+    }
+    if (index == -1) {return (type){.data = 0, .type = nothing__type_number};}
+    return (type){.data = index, .type = int__type_number};
+}
+
+// The function pops an item, waiting for it to appear if the pipeline is empty.
+// If "timeout_ms" is negative, the function waits without a time limit, otherwise when the time runs out, "nothing" is returned.
+type pipeline__pop_wait(uint64_t pipe, type timeout_ms) {
+    struct timespec deadline;
+    bool const has_deadline = pipeline__deadline((int64_t)timeout_ms.data, &deadline);
+    type const pipe_obj = (type){.data = pipe, .type = int__type_number};
+    pipeline* const pipeline_ptr = (pipeline*)pipe;
+    bool const waits_for_group = pipeline__waits_for_group(pipeline_ptr);
+    const type* const wait_pipes = waits_for_group ? pipeline_ptr->group->shard_pipes : &pipe_obj;
+    uint64_t const wait_count = waits_for_group ? pipeline_ptr->group->shards_count : 1;
+    for (;;) {
+        type const result = pipeline__pop(pipe);
+        if (result.type != nothing__type_number) {return result;}
+        if (pipeline__wait_any(wait_pipes, wait_count, has_deadline ? &deadline : NULL) == -1) {return result;}
+    }
+}
+
+// The descriptor of the front is created with all shards locked, so it starts with the number of non-empty shards.
+static type pipeline__get_front_event_fd(pipeline_group* group) {
+    for (uint64_t index = 0; index < group->shards_count; index++) {mutex__lock(&(group->shards[index]->mutex));}
+    if (group->front->event_fd == -1) {
+        uint64_t non_empty_count = 0;
+        for (uint64_t index = 0; index < group->shards_count; index++) {non_empty_count += group->shards[index]->count != 0;}
+        group->front->event_fd = eventfd(non_empty_count, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+        if (__builtin_expect(group->front->event_fd == -1, false)) {
+            fprintf(stderr, "Failed to create an event file descriptor.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    type const result = (type){.data = group->front->event_fd, .type = int__type_number};
+    for (uint64_t index = 0; index < group->shards_count; index++) {mutex__unlock(&(group->shards[index]->mutex));}
+    return result;
+}
+
+// The function returns an eventfd descriptor that is readable while the pipeline has items
+// (for the front of a sharded pipeline - while any shard has items).
+// The descriptor can be added to epoll/poll based event loops, it is closed when the pipeline is freed.
+type pipeline__get_event_fd(uint64_t pipe) {
+    pipeline* pipeline_ptr = (pipeline*)pipe;
+    pipeline_group* const group = pipeline_ptr->group;
+    if (group != NULL && pipeline_ptr == group->front) {return pipeline__get_front_event_fd(group);}
+    mutex__lock(&(pipeline_ptr->mutex));
+    if (pipeline_ptr->event_fd == -1) {
+        pipeline_ptr->event_fd = eventfd(pipeline_ptr->count != 0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (__builtin_expect(pipeline_ptr->event_fd == -1, false)) {
+            fprintf(stderr, "Failed to create an event file descriptor.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    type const result = (type){.data = pipeline_ptr->event_fd, .type = int__type_number};
+    mutex__unlock(&(pipeline_ptr->mutex));
+    return result;
+}
+
+#undef alloc__category
+#define alloc__category alloc__category__thread
+
+// The function creates the data of a new runtime thread (a worker or a scheduler thread).
+static thread_data* thread_data__create() {
     thread_data* th_data = malloc(sizeof(thread_data));
     th_data->cryptographic_random_number_index = 64;
     th_data->id = new_worker_id++;
-    {
+    // Coroutine workers create their data by thousands, so the seed is taken with one system call when possible.
+    if (getrandom(th_data->random_number_source, sizeof(th_data->random_number_source), GRND_NONBLOCK) != sizeof(th_data->random_number_source)) {
         FILE* file = fopen("/dev/urandom", "r");
         if (__builtin_expect((file == NULL) || (fread(th_data->random_number_source, sizeof(uint64_t), 3, file) != 3), false)) {
             fprintf(stderr, "Can't read the file \x22/dev/urandom\x22.\n");
@@ -480,38 +2161,136 @@ static void* worker__run(void* args) {
         }
         fclose(file);
     }
+    return th_data;
+}
+
+#define worker__result_timeout_ms 10000
+
+// The result of a worker waits for room in a bounded out pipeline at most "worker__result_timeout_ms", so a consumer that
+// has stopped reading doesn't keep the worker forever. A result that still doesn't fit is reported and released.
+static void worker__push_result(type out_pipe, type result, void* th_data) {
+    struct timespec deadline;
+    pipeline__deadline(worker__result_timeout_ms, &deadline);
+    if (pipeline__push_until(out_pipe.data, result, &deadline)) {return;}
+    fprintf(stderr, "The result of a worker is lost: its out pipeline has stayed full.\n");
+    ignored_errors = true;
+    pipeline__free_item(result, th_data);
+}
+
+static void* worker__run(void* args) {
+    worker worker_var = *(worker*)args;
+    type (*function)(type, type, void*, bool) = worker_var.worker;
+    thread_data* th_data = thread_data__create();
     number_of_threads++;
+    trace__start_thread(th_data->id);
+    trace__event('B', "worker");
     type in_pipe = worker_var.in;
     type out_pipe = worker_var.out;
     type result = function(in_pipe, out_pipe, th_data, true);
-    pipeline__push(out_pipe.data, result);
+    worker__push_result(out_pipe, result, th_data);
     pipeline__free(in_pipe.data, th_data);
     pipeline__free(out_pipe.data, th_data);
+    trace__event('E', NULL);
+    trace__stop_thread();
     number_of_threads--;
     free(th_data);
     free(args);
     return NULL;
 }
 
-void worker__create(type (*function)(type, type, void*, bool), type in_pipe, type out_pipe) {
+// The function starts a worker thread, if "affinity" is not "NULL", the thread runs only on the specified CPUs.
+static void worker__start(type (*function)(type, type, void*, bool), type in_pipe, type out_pipe, const cpu_set_t* affinity) {
     if (__builtin_expect(!allow_threads, false)) {
         fprintf(stderr, "At the stage of calculating constants, it is forbidden to use threads.\n");
         exit(EXIT_FAILURE);
     }
     pthread_t thread;
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    if (affinity != NULL) {pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), affinity);}
     worker* worker_var = malloc(sizeof(worker));
     *worker_var = (worker) {.worker = function, .in = in_pipe, .out = out_pipe};
     pipeline__use(in_pipe.data);
     pipeline__use(out_pipe.data);
-    if (__builtin_expect(pthread_create(&thread, NULL, worker__run, worker_var) != 0, false)) {
+    if (__builtin_expect(pthread_create(&thread, &thread_attr, worker__run, worker_var) != 0, false)) {
         fprintf(stderr, "Failed to start new thread.\n");
         exit(EXIT_FAILURE);
     }
+    pthread_attr_destroy(&thread_attr);
 }
 
-void worker__yield() {sched_yield();}
+void worker__create(type (*function)(type, type, void*, bool), type in_pipe, type out_pipe) {worker__start(function, in_pipe, out_pipe, NULL);}
+
+// The function reads a small text file (from "/proc" or "/sys") into the buffer and terminates it with zero.
+// Returns the number of bytes read, or 0 if the file could not be read.
+static uint64_t sys__read_file(const char* file_name, char* buffer, uint64_t buffer_size) {
+    int const fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {return 0;}
+    int64_t const length = read(fd, buffer, buffer_size - 1);
+    close(fd);
+    if (length <= 0) {return 0;}
+    buffer[length] = 0;
+    return length;
+}
+
+// The function parses a CPU list in the kernel format ("0-3,8,10-11").
+static bool cpu_set__parse_list(const char* list, cpu_set_t* cpu_set) {
+    CPU_ZERO(cpu_set);
+    bool result = false;
+    for (;;) {
+        char* end;
+        uint64_t const first = strtoull(list, &end, 10);
+        if (end == list) {break;}
+        uint64_t last = first;
+        list = end;
+        if (*list == '-') {
+            list++;
+            last = strtoull(list, &end, 10);
+            if (end == list) {break;}
+            list = end;
+        }
+        for (uint64_t cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {CPU_SET(cpu, cpu_set);}
+        result = true;
+        if (*list != ',') {break;}
+        list++;
+    }
+    return result;
+}
+
+// The function starts a worker that runs only on the specified CPUs.
+// CPU numbers that do not exist are ignored, if no CPU is left, the worker runs without restrictions.
+void worker__create_on_cpus(type (*function)(type, type, void*, bool), type in_pipe, type out_pipe, const type* cpus, type cpus_count) {
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    for (uint64_t index = 0; index < cpus_count.data; index++) {
+        if (cpus[index].data < CPU_SETSIZE) {CPU_SET(cpus[index].data, &affinity);}
+    }
+    worker__start(function, in_pipe, out_pipe, CPU_COUNT(&affinity) != 0 ? &affinity : NULL);
+}
+
+// The function starts a worker that runs only on the CPUs of the specified NUMA node.
+// If the node is unknown, the worker runs without restrictions.
+void worker__create_on_numa_node(type (*function)(type, type, void*, bool), type in_pipe, type out_pipe, type node) {
+    char file_name[64];
+    char buffer[4096];
+    cpu_set_t affinity;
+    snprintf(file_name, sizeof(file_name), "/sys/devices/system/node/node%" PRIu64 "/cpulist", node.data);
+    bool const known_node = sys__read_file(file_name, buffer, sizeof(buffer)) != 0 && cpu_set__parse_list(buffer, &affinity);
+    worker__start(function, in_pipe, out_pipe, known_node ? &affinity : NULL);
+}
+
+// In a coroutine worker, the functions "worker__yield" and "worker__sleep" give the carrier thread to other coroutines.
+void worker__yield() {
+    if (coroutine__current != NULL) {coroutine__yield();}
+    else {sched_yield();}
+}
 
 void worker__sleep(type milliseconds) {
+    if (coroutine__current != NULL) {
+        struct timespec deadline;
+        coroutine__sleep_until(pipeline__deadline(milliseconds.data, &deadline) ? &deadline : NULL);
+        return;
+    }
     struct timespec time;
     time.tv_sec = milliseconds.data / 1000;
     time.tv_nsec = (milliseconds.data % 1000) * 1000000;
@@ -526,9 +2305,324 @@ type worker__id(void* th_data) {return (type){.data = ((thread_data*)th_data)->i
 
 // The function returns the number of running threads.
 type get_number_of_threads() {return (type){.data = number_of_threads, .type = int__type_number};}
+
+#undef alloc__category
 #pragma endregion Thread
 
+#pragma region Shm
+#define alloc__category alloc__category__pipeline
+
+#define shm_pipeline__magic   0x3165706970726873
+#define shm_pipeline__poll_ms 100
+
+// Every process that has the pipeline open holds an OFD lock on one byte of the shared memory object (its peer index).
+// The kernel drops the lock when the process dies, so a peer is alive while its byte is locked (zombies included).
+static bool shm_pipeline__peer_lock(int fd, uint32_t peer_index, int command, short lock_type, bool* is_locked) {
+    struct flock lock = {.l_type = lock_type, .l_whence = SEEK_SET, .l_start = peer_index, .l_len = 1, .l_pid = 0};
+    if (fcntl(fd, command, &lock) != 0) {return false;}
+    if (is_locked != NULL) {*is_locked = lock.l_type != F_UNLCK;}
+    return true;
+}
+
+static bool shm_pipeline__register(shm_pipeline* shm_pipe) {
+    for (uint32_t peer_index = 0; peer_index < shm_pipeline__max_peers; peer_index++) {
+        if (shm_pipeline__peer_lock(shm_pipe->fd, peer_index, F_OFD_SETLK, F_WRLCK, NULL)) {
+            shm_pipe->peer_index = peer_index;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool shm_pipeline__has_peer(const shm_pipeline* shm_pipe) {
+    for (uint32_t peer_index = 0; peer_index < shm_pipeline__max_peers; peer_index++) {
+        bool is_locked = false;
+        if (
+            peer_index != shm_pipe->peer_index &&
+            shm_pipeline__peer_lock(shm_pipe->fd, peer_index, F_OFD_GETLK, F_WRLCK, &is_locked) &&
+            is_locked
+        ) {return true;}
+    }
+    return false;
+}
+
+static char* shm_pipeline__object_name(type name) {
+    char* const utf8_name = (char*)string__utf32_to_utf8(name);
+    if (utf8_name[0] == '/') {return utf8_name;}
+    uint64_t const length = strlen(utf8_name);
+    char* const result = malloc(length + 2);
+    result[0] = '/';
+    memcpy(&(result[1]), utf8_name, length + 1);
+    free(utf8_name);
+    return result;
+}
+
+static shm_pipeline* shm_pipeline__map(int fd, uint64_t mapping_size) {
+    void* const memory = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {return NULL;}
+    shm_pipeline* const result = malloc(sizeof(shm_pipeline));
+    *result = (shm_pipeline) {
+        .header       = (shm_pipeline_header*)memory,
+        .slots        = &(((shm_pipeline_slot*)memory)[1]),
+        .mapping_size = mapping_size,
+        .fd           = fd,
+        .peer_index   = shm_pipeline__max_peers,
+        .name         = NULL
+    };
+    if (!shm_pipeline__register(result)) {
+        munmap(memory, mapping_size);
+        free(result);
+        return NULL;
+    }
+    return result;
+}
+
+static inline long shm_pipeline__futex(uint32_t* address, int operation, uint32_t value, const struct timespec* timeout) {
+    return syscall(SYS_futex, address, operation, value, timeout, NULL, 0);
+}
+
+// Vyukov's bounded MPMC queue: a slot is free for the position "p" when its sequence is "p",
+// and holds an item for the position "p" when its sequence is "p + 1".
+static bool shm_pipeline__try_push(shm_pipeline* shm_pipe, type pushed_object) {
+    shm_pipeline_header* const header = shm_pipe->header;
+    uint64_t const mask = header->capacity - 1;
+    uint64_t position = __atomic_load_n(&(header->enqueue_position), __ATOMIC_RELAXED);
+    shm_pipeline_slot* slot;
+    for (;;) {
+        slot = &(shm_pipe->slots[position & mask]);
+        int64_t const difference = (int64_t)(__atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE) - position);
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&(header->enqueue_position), &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {break;}
+        } else if (difference < 0) {return false;}
+        else {position = __atomic_load_n(&(header->enqueue_position), __ATOMIC_RELAXED);}
+    }
+    slot->type = pushed_object.type;
+    switch (pushed_object.type) {
+    case string__type_number:
+        slot->length = ((const uint64_t*)pushed_object.data)[1];
+        memcpy(slot->payload, &(((const uint32_t*)pushed_object.data)[4]), slot->length * sizeof(uint32_t));
+        break;
+    case bytes__type_number:
+        slot->length = ((const bytes*)pushed_object.data)->length;
+        memcpy(slot->payload, ((const bytes*)pushed_object.data)->data, slot->length);
+        break;
+    default:
+        slot->data = pushed_object.data;
+    }
+    __atomic_store_n(&(slot->sequence), position + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&(header->items_futex), 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(header->waiting_consumers), __ATOMIC_SEQ_CST) != 0) {shm_pipeline__futex(&(header->items_futex), FUTEX_WAKE, 1, NULL);}
+    return true;
+}
+
+static bool shm_pipeline__try_pop(shm_pipeline* shm_pipe, type* popped_object) {
+    shm_pipeline_header* const header = shm_pipe->header;
+    uint64_t const mask = header->capacity - 1;
+    uint64_t position = __atomic_load_n(&(header->dequeue_position), __ATOMIC_RELAXED);
+    shm_pipeline_slot* slot;
+    for (;;) {
+        slot = &(shm_pipe->slots[position & mask]);
+        int64_t const difference = (int64_t)(__atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE) - (position + 1));
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&(header->dequeue_position), &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {break;}
+        } else if (difference < 0) {return false;}
+        else {position = __atomic_load_n(&(header->dequeue_position), __ATOMIC_RELAXED);}
+    }
+    switch (slot->type) {
+    case string__type_number: {
+        uint32_t* const string = malloc((slot->length + 4) * sizeof(uint32_t));
+        ((uint64_t*)string)[0] = 1;
+        ((uint64_t*)string)[1] = slot->length;
+        memcpy(&(string[4]), slot->payload, slot->length * sizeof(uint32_t));
+        *popped_object = (type){.data = (uint64_t)string, .type = string__type_number};
+        break;
+    }
+    case bytes__type_number:
+        *popped_object = bytes__create_from_memory(slot->payload, slot->length);
+        break;
+    default:
+        *popped_object = (type){.data = slot->data, .type = slot->type};
+    }
+    __atomic_store_n(&(slot->sequence), position + mask + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&(header->space_futex), 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(header->waiting_producers), __ATOMIC_SEQ_CST) != 0) {shm_pipeline__futex(&(header->space_futex), FUTEX_WAKE, 1, NULL);}
+    return true;
+}
+
+// The function sleeps until the futex changes from "observed_value", the deadline passes or the poll interval ends.
+// Returns "false" if the deadline has passed.
+static bool shm_pipeline__wait(uint32_t* futex, uint32_t* waiting, uint32_t observed_value, const struct timespec* deadline) {
+    int64_t timeout_ns = shm_pipeline__poll_ms * 1000000;
+    if (deadline != NULL) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t const remaining_ns = (deadline->tv_sec - now.tv_sec) * 1000000000 + (deadline->tv_nsec - now.tv_nsec);
+        if (remaining_ns <= 0) {return false;}
+        if (remaining_ns < timeout_ns) {timeout_ns = remaining_ns;}
+    }
+    struct timespec const timeout = {.tv_sec = timeout_ns / 1000000000, .tv_nsec = timeout_ns % 1000000000};
+    __atomic_add_fetch(waiting, 1, __ATOMIC_SEQ_CST);
+    shm_pipeline__futex(futex, FUTEX_WAIT, observed_value, &timeout);
+    __atomic_sub_fetch(waiting, 1, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+static uint64_t shm_pipeline__create(char* object_name, uint64_t capacity) {
+    int const fd = shm_open(object_name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {return 0;}
+    uint64_t const mapping_size = (capacity + 1) * sizeof(shm_pipeline_slot);
+    shm_pipeline* const result = ftruncate(fd, mapping_size) == 0 ? shm_pipeline__map(fd, mapping_size) : NULL;
+    if (result == NULL) {
+        close(fd);
+        shm_unlink(object_name);
+        return 0;
+    }
+    result->name = object_name;
+    result->header->capacity = capacity;
+    for (uint64_t index = 0; index < capacity; index++) {result->slots[index].sequence = index;}
+    __atomic_store_n(&(result->header->magic), shm_pipeline__magic, __ATOMIC_RELEASE);
+    return (uint64_t)result;
+}
+
+// The function creates a pipeline in shared memory under the specified name, other processes can open it by the name.
+// The capacity is rounded up to a power of two, an item (a string or a byte buffer) can take at most 4072 bytes.
+// If the pipeline can't be created (for example, the name is already taken), then "nothing" is returned as a result.
+type pipeline__create_shared(type name, type capacity) {
+    uint64_t rounded_capacity = 2;
+    while (rounded_capacity < capacity.data) {rounded_capacity *= 2;}
+    char* const object_name = shm_pipeline__object_name(name);
+    uint64_t const result = shm_pipeline__create(object_name, rounded_capacity);
+    if (result == 0) {
+        free(object_name);
+        return (type){.data = 0, .type = nothing__type_number};
+    }
+    return (type){.data = result, .type = int__type_number};
+}
+
+// The function opens a pipeline created by "pipeline__create_shared" (for example, in a forked child process).
+// A forked child must open the pipeline by name instead of using the inherited handle, so it is seen as a separate peer.
+// If the pipeline doesn't exist or is not initialized yet, then "nothing" is returned as a result.
+type pipeline__open_shared(type name) {
+    char* const object_name = shm_pipeline__object_name(name);
+    int const fd = shm_open(object_name, O_RDWR | O_CLOEXEC, 0);
+    free(object_name);
+    struct stat object_stat;
+    if (fd == -1) {return (type){.data = 0, .type = nothing__type_number};}
+    if (fstat(fd, &object_stat) != 0 || object_stat.st_size < (off_t)(3 * sizeof(shm_pipeline_slot))) {
+        close(fd);
+        return (type){.data = 0, .type = nothing__type_number};
+    }
+    shm_pipeline* const result = shm_pipeline__map(fd, object_stat.st_size);
+    if (result == NULL) {
+        close(fd);
+        return (type){.data = 0, .type = nothing__type_number};
+    }
+    if (
+        __atomic_load_n(&(result->header->magic), __ATOMIC_ACQUIRE) != shm_pipeline__magic ||
+        (result->header->capacity + 1) * sizeof(shm_pipeline_slot) != result->mapping_size
+    ) {
+        munmap(result->header, result->mapping_size);
+        close(fd);
+        free(result);
+        return (type){.data = 0, .type = nothing__type_number};
+    }
+    return (type){.data = (uint64_t)result, .type = int__type_number};
+}
+
+// The function closes the pipeline, the process that created it also removes the name (open handles stay valid).
+void pipeline__close_shared(type pipe) {
+    shm_pipeline* const shm_pipe = (shm_pipeline*)pipe.data;
+    munmap(shm_pipe->header, shm_pipe->mapping_size);
+    close(shm_pipe->fd);
+    if (shm_pipe->name != NULL) {
+        shm_unlink(shm_pipe->name);
+        free(shm_pipe->name);
+    }
+    free(shm_pipe);
+}
+
+// The function copies the object to the pipeline, the object stays with the caller.
+// Ints, bools, nothing, strings and byte buffers can be pushed. If the pipeline is full, the function waits for free space.
+// If the object can't be pushed (unsupported type, too large or no other process has the pipeline open), "false" is returned.
+type pipeline__push_shared(type pipe, type pushed_object) {
+    shm_pipeline* const shm_pipe = (shm_pipeline*)pipe.data;
+    bool supported;
+    switch (pushed_object.type) {
+    case string__type_number:
+        supported = ((const uint64_t*)pushed_object.data)[1] * sizeof(uint32_t) <= sizeof(((shm_pipeline_slot*)NULL)->payload);
+        break;
+    case bytes__type_number:
+        supported = ((const bytes*)pushed_object.data)->length <= sizeof(((shm_pipeline_slot*)NULL)->payload);
+        break;
+    default:
+        supported = pushed_object.type == nothing__type_number || pushed_object.type == bool__type_numer || pushed_object.type == int__type_number;
+    }
+    if (!supported) {return (type){.data = false, .type = bool__type_numer};}
+    shm_pipeline_header* const header = shm_pipe->header;
+    for (bool is_waiting = false;;) {
+        uint32_t const observed_value = __atomic_load_n(&(header->space_futex), __ATOMIC_SEQ_CST);
+        if (shm_pipeline__try_push(shm_pipe, pushed_object)) {
+            if (is_waiting) {trace__event('E', NULL);}
+            return (type){.data = true, .type = bool__type_numer};
+        }
+        if (!shm_pipeline__has_peer(shm_pipe)) {
+            if (is_waiting) {trace__event('E', NULL);}
+            return (type){.data = false, .type = bool__type_numer};
+        }
+        if (!is_waiting) {
+            trace__event('B', "pipeline__push_shared wait");
+            is_waiting = true;
+        }
+        shm_pipeline__wait(&(header->space_futex), &(header->waiting_producers), observed_value, NULL);
+    }
+}
+
+// The function pops an item, waiting for it to appear if the pipeline is empty.
+// If "timeout_ms" is negative, the function waits without a time limit, otherwise when the time runs out, "nothing" is returned.
+// "nothing" is also returned when the pipeline is empty and no other process has it open (the peers have exited or died).
+type pipeline__pop_shared(type pipe, type timeout_ms) {
+    shm_pipeline* const shm_pipe = (shm_pipeline*)pipe.data;
+    shm_pipeline_header* const header = shm_pipe->header;
+    struct timespec deadline;
+    bool const has_deadline = pipeline__deadline((int64_t)timeout_ms.data, &deadline);
+    type result = (type){.data = 0, .type = nothing__type_number};
+    bool is_waiting = false;
+    for (;;) {
+        uint32_t const observed_value = __atomic_load_n(&(header->items_futex), __ATOMIC_SEQ_CST);
+        if (shm_pipeline__try_pop(shm_pipe, &result)) {break;}
+        if (!shm_pipeline__has_peer(shm_pipe)) {
+            // A peer may push its last item and exit after the pop attempt.
+            shm_pipeline__try_pop(shm_pipe, &result);
+            break;
+        }
+        if (!is_waiting) {
+            trace__event('B', "pipeline__pop_shared wait");
+            is_waiting = true;
+        }
+        if (!shm_pipeline__wait(&(header->items_futex), &(header->waiting_consumers), observed_value, has_deadline ? &deadline : NULL)) {break;}
+    }
+    if (is_waiting) {trace__event('E', NULL);}
+    return result;
+}
+
+type pipeline__items_count_shared(type pipe) {
+    const shm_pipeline_header* const header = ((const shm_pipeline*)pipe.data)->header;
+    uint64_t const dequeue_position = __atomic_load_n(&(header->dequeue_position), __ATOMIC_ACQUIRE);
+    uint64_t const enqueue_position = __atomic_load_n(&(header->enqueue_position), __ATOMIC_ACQUIRE);
+    return (type){.data = enqueue_position > dequeue_position ? enqueue_position - dequeue_position : 0, .type = int__type_number};
+}
+
+// If another process has the pipeline open, the function returns "true", otherwise "false".
+type pipeline__has_peer_shared(type pipe) {
+    return (type){.data = shm_pipeline__has_peer((const shm_pipeline*)pipe.data), .type = bool__type_numer};
+}
+
+#undef alloc__category
+#pragma endregion Shm
+
 #pragma region Env
+#define alloc__category alloc__category__other
+
 static uint64_t __argc__;
 static uint8_t** __argv__;
 static uint64_t cpu_cores_number;
@@ -618,9 +2712,146 @@ type env__execute_command(type command) {
     return (type){.data = result, .type = bool__type_numer};
 }
 
-// The function returns the number of processor cores.
+// The function returns the CPU quota of the cgroup ("cpu.max" in v2, "cpu.cfs_quota_us"/"cpu.cfs_period_us" in v1),
+// rounded up to whole CPUs, or 0 if the quota is not set.
+static uint64_t env__get_cgroup_cpu_limit() {
+    char buffer[4096];
+    char file_name[4096 + 64];
+    uint64_t result = 0;
+    if (sys__read_file("/proc/self/cgroup", buffer, sizeof(buffer)) == 0) {return 0;}
+    for (char* line = buffer; line != NULL && *line != 0;) {
+        char* const line_end = strchr(line, '\n');
+        if (line_end != NULL) {*line_end = 0;}
+        char* const controllers = strchr(line, ':');
+        char* const path = controllers == NULL ? NULL : strchr(controllers + 1, ':');
+        if (path != NULL) {
+            *path = 0;
+            char quota_text[128];
+            char period_text[128];
+            char* const group = path + 1;
+            bool has_cpu_controller = false;
+            for (const char* controller = controllers + 1; controller != NULL;) {
+                const char* const next_controller = strchr(controller, ',');
+                uint64_t const length = next_controller == NULL ? strlen(controller) : (uint64_t)(next_controller - controller);
+                if (length == 3 && strncmp(controller, "cpu", 3) == 0) {has_cpu_controller = true;}
+                controller = next_controller == NULL ? NULL : next_controller + 1;
+            }
+            if (controllers[1] == 0 && group[0] == '/') {
+                // cgroup v2, the limits of all parent groups apply too.
+                for (;;) {
+                    snprintf(file_name, sizeof(file_name), "/sys/fs/cgroup%s/cpu.max", group[1] == 0 ? "" : group);
+                    if (sys__read_file(file_name, quota_text, sizeof(quota_text)) != 0 && strncmp(quota_text, "max", 3) != 0) {
+                        char* period_start;
+                        uint64_t const quota = strtoull(quota_text, &period_start, 10);
+                        uint64_t const period = strtoull(period_start, NULL, 10);
+                        uint64_t const limit = period == 0 ? 0 : (quota + period - 1) / period;
+                        if (limit != 0 && (result == 0 || limit < result)) {result = limit;}
+                    }
+                    if (group[1] == 0) {break;}
+                    char* const last_slash = strrchr(group, '/');
+                    if (last_slash == group) {group[1] = 0;}
+                    else {*last_slash = 0;}
+                }
+            } else if (has_cpu_controller) {
+                // cgroup v1, the group is looked for in the hierarchy and in the root of the mount (inside containers).
+                const char* const mounts[] = {"/sys/fs/cgroup/cpu,cpuacct", "/sys/fs/cgroup/cpu"};
+                const char* const paths[] = {strcmp(group, "/") == 0 ? "" : group, ""};
+                for (uint64_t attempt = 0; attempt < 4; attempt++) {
+                    snprintf(file_name, sizeof(file_name), "%s%s/cpu.cfs_quota_us", mounts[attempt / 2], paths[attempt % 2]);
+                    if (sys__read_file(file_name, quota_text, sizeof(quota_text)) == 0) {continue;}
+                    snprintf(file_name, sizeof(file_name), "%s%s/cpu.cfs_period_us", mounts[attempt / 2], paths[attempt % 2]);
+                    if (sys__read_file(file_name, period_text, sizeof(period_text)) == 0) {continue;}
+                    int64_t const quota = strtoll(quota_text, NULL, 10);
+                    int64_t const period = strtoll(period_text, NULL, 10);
+                    if (quota > 0 && period > 0) {
+                        uint64_t const limit = (quota + period - 1) / period;
+                        if (result == 0 || limit < result) {result = limit;}
+                    }
+                    break;
+                }
+            }
+        }
+        line = line_end == NULL ? NULL : line_end + 1;
+    }
+    return result;
+}
+
+// The function returns the number of CPUs the program can use:
+// the CPUs of the affinity mask of the process, limited by the CPU quota of the cgroup.
+static uint64_t env__detect_cpu_cores_number() {
+    uint64_t result = get_nprocs();
+    cpu_set_t affinity;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &affinity) == 0 && CPU_COUNT(&affinity) != 0) {result = CPU_COUNT(&affinity);}
+    uint64_t const cgroup_limit = env__get_cgroup_cpu_limit();
+    if (cgroup_limit != 0 && cgroup_limit < result) {result = cgroup_limit;}
+    return result == 0 ? 1 : result;
+}
+
+// The function returns the number of processor cores available to the program.
+// The affinity mask of the process and the CPU quota of the cgroup (containers) are taken into account.
 type env__get_cpu_cores_number() {return (type){.data = cpu_cores_number, .type = int__type_number};}
 
+// The function returns the identifier of the physical core of the CPU, CPUs with the same identifier are SMT siblings.
+// If the CPU does not exist, then "nothing" is returned as a result.
+type env__get_cpu_core_id(type cpu) {
+    char file_name[96];
+    char buffer[32];
+    snprintf(file_name, sizeof(file_name), "/sys/devices/system/cpu/cpu%" PRIu64 "/topology/core_id", cpu.data);
+    if (sys__read_file(file_name, buffer, sizeof(buffer)) == 0) {return (type){.data = 0, .type = nothing__type_number};}
+    uint64_t const core_id = strtoull(buffer, NULL, 10);
+    snprintf(file_name, sizeof(file_name), "/sys/devices/system/cpu/cpu%" PRIu64 "/topology/physical_package_id", cpu.data);
+    uint64_t const package_id = sys__read_file(file_name, buffer, sizeof(buffer)) == 0 ? 0 : strtoull(buffer, NULL, 10);
+    return (type){.data = (package_id << 32) | core_id, .type = int__type_number};
+}
+
+// The function returns the SMT sibling of the CPU (a CPU of the same physical core) with the specified index.
+// The CPU itself is also in the list, if there is no sibling with such an index, then "nothing" is returned as a result.
+type env__get_cpu_smt_sibling(type cpu, type index) {
+    char file_name[96];
+    char buffer[4096];
+    cpu_set_t siblings;
+    snprintf(file_name, sizeof(file_name), "/sys/devices/system/cpu/cpu%" PRIu64 "/topology/thread_siblings_list", cpu.data);
+    if (sys__read_file(file_name, buffer, sizeof(buffer)) == 0 || !cpu_set__parse_list(buffer, &siblings)) {return (type){.data = 0, .type = nothing__type_number};}
+    uint64_t found = 0;
+    for (uint64_t sibling = 0; sibling < CPU_SETSIZE; sibling++) {
+        if (!CPU_ISSET(sibling, &siblings)) {continue;}
+        if (found == index.data) {return (type){.data = sibling, .type = int__type_number};}
+        found++;
+    }
+    return (type){.data = 0, .type = nothing__type_number};
+}
+
+// The function returns the number of the NUMA node to which the CPU belongs.
+// If the CPU or the node is unknown, then "nothing" is returned as a result.
+type env__get_cpu_numa_node(type cpu) {
+    char dir_name[96];
+    snprintf(dir_name, sizeof(dir_name), "/sys/devices/system/cpu/cpu%" PRIu64, cpu.data);
+    type result = (type){.data = 0, .type = nothing__type_number};
+    DIR* const dir = opendir(dir_name);
+    if (dir == NULL) {return result;}
+    global_lock();
+    for (;;) {
+        struct dirent* const dir_entry = readdir(dir);
+        if (dir_entry == NULL) {break;}
+        if (strncmp(dir_entry->d_name, "node", 4) == 0 && dir_entry->d_name[4] >= '0' && dir_entry->d_name[4] <= '9') {
+            result = (type){.data = strtoull(&(dir_entry->d_name[4]), NULL, 10), .type = int__type_number};
+            break;
+        }
+    }
+    global_unlock();
+    closedir(dir);
+    return result;
+}
+
+// The function returns the number of NUMA nodes of the system.
+type env__get_numa_nodes_number() {
+    char buffer[4096];
+    cpu_set_t nodes;
+    uint64_t result = 1;
+    if (sys__read_file("/sys/devices/system/node/online", buffer, sizeof(buffer)) != 0 && cpu_set__parse_list(buffer, &nodes)) {result = CPU_COUNT(&nodes);}
+    return (type){.data = result, .type = int__type_number};
+}
+
 // The function gets the user's home directory.
 type env__get_user_home_dir() {
     global_lock();
@@ -633,668 +2864,4075 @@ type env__get_user_home_dir() {
     global_unlock();
     return result;
 }
+
+#undef alloc__category
 #pragma endregion Env
 
-#pragma region Random
-// The function returns a random number.
-type int__get_random(void* th_data) {
-    thread_data* data = (thread_data*)th_data;
-    uint64_t const bits0_14 = (data->random_number_source[0] >> 16ull) & 0x7fffull;
-    uint64_t const bits15_46 = (data->random_number_source[1] >> 32ull) & 0xffffffffull;
-    uint64_t const bits47_63 = (data->random_number_source[2] >> 16ull) & 0x1ffffull;
-    data->random_number_source[0] = data->random_number_source[0] * 1103515245ull + 12345;
-    data->random_number_source[1] = data->random_number_source[1] * 6364136223846793005ull + 1;
-    data->random_number_source[2] = data->random_number_source[2] * 25214903917ull + 11;
-    return (type){.data = bits0_14 | (bits15_46 << 14) | (bits47_63 << 46), .type = int__type_number};
-}
+#pragma region Sched
+#define alloc__category alloc__category__thread
 
-// The function returns a random number suitable for cryptographic purposes.
-type int__get_cryptographic__random(void* th_data) {
-    thread_data* data = (thread_data*)th_data;
-    if (data->cryptographic_random_number_index == 64) {
-        FILE *file = fopen("/dev/urandom", "r");
-        if (__builtin_expect((file == NULL) || (fread(data->cryptographic_random_number_buffer, 8, 64, file) != 64), false)) {
-            fprintf(stderr, "Can't read the file \x22/dev/urandom\x22.\n");
-            exit(EXIT_FAILURE);
-        }
-        fclose(file);
-        data->cryptographic_random_number_index = 0;
-    }
-    uint64_t result = data->cryptographic_random_number_buffer[data->cryptographic_random_number_index];
-    data->cryptographic_random_number_index++;
-    return (type){.data = result, .type = int__type_number};
-}
-#pragma endregion Random
+#define sched__max_deques       256
+#define sched__initial_capacity 64
 
-#pragma region FS
-#define file_buffer_size 131072
+// A unit of work of the scheduler, "run" executes the task and frees it.
+struct sched_task {
+    void (*run)(struct sched_task* task, void* th_data);
+} typedef sched_task;
 
-#define fs__copy__problem__stat           (type){.data = 1,  .type = int__type_number}
-#define fs__copy__problem__read_link      (type){.data = 2,  .type = int__type_number}
-#define fs__copy__problem__create_symlink (type){.data = 3,  .type = int__type_number}
-#define fs__copy__problem__open_dir       (type){.data = 4,  .type = int__type_number}
-#define fs__copy__problem__make_dir       (type){.data = 5,  .type = int__type_number}
-#define fs__copy__problem__open_file      (type){.data = 6,  .type = int__type_number}
-#define fs__copy__problem__create_file    (type){.data = 7,  .type = int__type_number}
-#define fs__copy__problem__read_from_file (type){.data = 8,  .type = int__type_number}
-#define fs__copy__problem__write_to_file  (type){.data = 9,  .type = int__type_number}
+struct sched_array {
+    int64_t             capacity;
+    struct sched_array* retired;
+    sched_task*         tasks[];
+} typedef sched_array;
 
-#define fs__delete__problem__stat             (type){.data = 1,  .type = int__type_number}
-#define fs__delete__problem__open_dir         (type){.data = 2,  .type = int__type_number}
-#define fs__delete__problem__delete_empty_dir (type){.data = 3,  .type = int__type_number}
-#define fs__delete__problem__delete_file      (type){.data = 4,  .type = int__type_number}
+// A Chase-Lev work-stealing deque (the C11 version by Le, Pop, Cohen and Zappa Nardelli):
+// the owner thread pushes and takes tasks at the bottom, other threads steal them from the top.
+struct {
+    int64_t      top     __attribute__((aligned(64)));
+    int64_t      bottom  __attribute__((aligned(64)));
+    sched_array* array;
+    bool         in_use;
+} typedef sched_deque;
 
-static type const fs__tmp_dir_name = (type){.data = (uint64_t)(const uint32_t[]) {0, 0, 5, 0, '/', 't', 'm', 'p', '/'}, .type = string__type_number};
+static sched_deque* sched__deques[sched__max_deques];
+static uint64_t sched__deques_count = 0;
+static pthread_once_t sched__once = PTHREAD_ONCE_INIT;
+static pthread_key_t sched__deque_key;
+static __thread sched_deque* sched__current = NULL;
+static __thread uint64_t sched__victim_seed = 0;
+static uint32_t sched__epoch = 0;
+static uint32_t sched__sleepers = 0;
 
-// The function deletes the file at the specified path.
-// If the delete was successful, then the function returns "true", otherwise "false".
-type fs__delete_file(type file_name) {
-    uint8_t* const utf8_file_name = string__utf32_to_utf8(file_name);
-    struct stat file_stat;
-    bool const result =
-        (
-            stat((char*)utf8_file_name, &file_stat) == 0 ||
-            lstat((char*)utf8_file_name, &file_stat) == 0
-        ) &&
-        (file_stat.st_mode & S_IFDIR) != S_IFDIR &&
-        remove((char*)utf8_file_name) == 0;
-    free(utf8_file_name);
-    return (type){.data = result, .type = bool__type_numer};
+// The global queue keeps tasks in FIFO order: tasks of threads that have no deque and yielded coroutines.
+// The scheduler threads take them after their own tasks and before stealing.
+static pthread_mutex_t sched__global_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sched_task** sched__global_tasks = NULL;
+static uint64_t sched__global_first = 0;
+static uint64_t sched__global_count = 0;
+static uint64_t sched__global_capacity = 0;
+
+static sched_array* sched__new_array(int64_t capacity) {
+    sched_array* const result = malloc(sizeof(sched_array) + capacity * sizeof(sched_task*));
+    result->capacity = capacity;
+    result->retired = NULL;
+    return result;
 }
 
-// The function deletes the empty directory at the specified path.
-// If the delete was successful, then the function returns "true", otherwise "false".
-type fs__delete_empty_dir(type dir_name) {
-    uint8_t* const utf8_dir_name = string__utf32_to_utf8(dir_name);
-    struct stat dir_stat;
-    bool const result =
-        stat((char*)utf8_dir_name, &dir_stat) == 0 &&
-        (dir_stat.st_mode & S_IFDIR) == S_IFDIR &&
-        remove((char*)utf8_dir_name) == 0;
-    free(utf8_dir_name);
-    return (type){.data = result, .type = bool__type_numer};
+// The array can't be freed while thieves may read it, so the old arrays are kept with the new one.
+static sched_array* sched__grow(sched_deque* deque, sched_array* array, int64_t top, int64_t bottom) {
+    sched_array* const result = sched__new_array(array->capacity * 2);
+    for (int64_t index = top; index < bottom; index++) {
+        result->tasks[index & (result->capacity - 1)] = __atomic_load_n(&(array->tasks[index & (array->capacity - 1)]), __ATOMIC_RELAXED);
+    }
+    result->retired = array;
+    __atomic_store_n(&(deque->array), result, __ATOMIC_RELEASE);
+    return result;
 }
 
-// If the file exists at the specified path, the function returns "true" otherwise "false".
-type fs__file_is_exist(type file_name) {
-    uint8_t* const utf8_file_name = string__utf32_to_utf8(file_name);
-    struct stat file_stat;
-    bool const result =
-        (
-            stat((char*)utf8_file_name, &file_stat) == 0 ||
-            lstat((char*)utf8_file_name, &file_stat) == 0
-        ) &&
-        (file_stat.st_mode & S_IFDIR) != S_IFDIR;
-    free(utf8_file_name);
-    return (type){.data = result, .type = bool__type_numer};
+static void sched__push(sched_deque* deque, sched_task* task) {
+    int64_t const bottom = __atomic_load_n(&(deque->bottom), __ATOMIC_RELAXED);
+    int64_t const top = __atomic_load_n(&(deque->top), __ATOMIC_ACQUIRE);
+    sched_array* array = __atomic_load_n(&(deque->array), __ATOMIC_RELAXED);
+    if (bottom - top > array->capacity - 1) {array = sched__grow(deque, array, top, bottom);}
+    __atomic_store_n(&(array->tasks[bottom & (array->capacity - 1)]), task, __ATOMIC_RELAXED);
+    __atomic_store_n(&(deque->bottom), bottom + 1, __ATOMIC_RELEASE);
 }
 
-// If the directory exists at the specified path, the function returns "true" otherwise "false".
-type fs__dir_is_exist(type dir_name) {
-    uint8_t* const utf8_dir_name = string__utf32_to_utf8(dir_name);
-    struct stat dir_stat;
-    bool const result =
-        stat((char*)utf8_dir_name, &dir_stat) == 0 &&
-        (dir_stat.st_mode & S_IFDIR) == S_IFDIR;
-    free(utf8_dir_name);
-    return (type){.data = result, .type = bool__type_numer};
+static sched_task* sched__take(sched_deque* deque) {
+    int64_t const bottom = __atomic_load_n(&(deque->bottom), __ATOMIC_RELAXED) - 1;
+    sched_array* const array = __atomic_load_n(&(deque->array), __ATOMIC_RELAXED);
+    __atomic_store_n(&(deque->bottom), bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&(deque->top), __ATOMIC_RELAXED);
+    if (top > bottom) {
+        __atomic_store_n(&(deque->bottom), bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    sched_task* result = __atomic_load_n(&(array->tasks[bottom & (array->capacity - 1)]), __ATOMIC_RELAXED);
+    if (top == bottom) {
+        if (!__atomic_compare_exchange_n(&(deque->top), &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {result = NULL;}
+        __atomic_store_n(&(deque->bottom), bottom + 1, __ATOMIC_RELAXED);
+    }
+    return result;
 }
 
-// The function opens the file in the specified mode.
-// If the file can be opened, the function returns "true", otherwise "false".
-// Modes:
-// 25202 (rb) - opens a file for reading. The file must exist.
-// 25207 (wb) - opens a file for writing. If the file does not exist, then the function will create it, if the file already exists, then its contents will be deleted.
-// 25185 (ab) - opens a file for writing. If the file does not exist, then the function will create it, if the file already exists, then writing will be made to the end of the file.
-// 6433650 (r+b) - opens a file for reading and writing. The file must exist. The read and write position is at the beginning.
-// 6433655 (w+b) - opens a file for reading and writing. If the file does not exist, then the function will create it, if the file already exists, then its contents will be deleted.
-// 6433633 (a+b) - opens a file for reading and writing. If the file does not exist, then the function will create it, if the file already exists, the read and write position is at the end.
-bool fs__open_file(type file_name, uint32_t mode, void** out_file) {
-    uint8_t* const utf8_file_name = string__utf32_to_utf8(file_name);
-    FILE *file = fopen((char*)utf8_file_name, (char*)(&mode));
-    free(utf8_file_name);
-    *out_file = file;
-    return file != NULL;
+// Returns "NULL" if the deque is empty or another thread won the race for the task ("is_contended").
+static sched_task* sched__steal(sched_deque* deque, bool* is_contended) {
+    int64_t top = __atomic_load_n(&(deque->top), __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t const bottom = __atomic_load_n(&(deque->bottom), __ATOMIC_ACQUIRE);
+    if (top >= bottom) {return NULL;}
+    sched_array* const array = __atomic_load_n(&(deque->array), __ATOMIC_ACQUIRE);
+    sched_task* const result = __atomic_load_n(&(array->tasks[top & (array->capacity - 1)]), __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&(deque->top), &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        *is_contended = true;
+        return NULL;
+    }
+    return result;
 }
 
-// The function flushes the output buffer.
-// If the flushed was successful, then the function returns "true", otherwise "false".
-type fs__flush_file(void* file) {return (type){.data = (fflush(file) == 0), .type = bool__type_numer};}
+// A thread that exits gives its (empty) deque back for reuse.
+static void sched__release_deque(void* deque) {__atomic_store_n(&(((sched_deque*)deque)->in_use), false, __ATOMIC_RELEASE);}
 
-// The function flushes the output buffer and close the file.
-// If the closed was successful, then the function returns "true", otherwise "false".
-type fs__close_file(void* file) {return (type){.data = (fclose(file) == 0), .type = bool__type_numer};}
+// The function returns the deque of the current thread, the deque is taken on first use.
+// Returns "NULL" if all deques are taken, then the work of the thread is not split.
+static sched_deque* sched__current_deque() {
+    if (sched__current != NULL) {return sched__current;}
+    uint64_t const count = __atomic_load_n(&sched__deques_count, __ATOMIC_ACQUIRE);
+    for (uint64_t index = 0; index < count; index++) {
+        bool expected = false;
+        if (__atomic_compare_exchange_n(&(sched__deques[index]->in_use), &expected, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            sched__current = sched__deques[index];
+            break;
+        }
+    }
+    if (sched__current == NULL) {
+        global_lock();
+        if (sched__deques_count < sched__max_deques) {
+            sched_deque* const deque = malloc(sizeof(sched_deque));
+            *deque = (sched_deque){.top = 0, .bottom = 0, .array = sched__new_array(sched__initial_capacity), .in_use = true};
+            sched__deques[sched__deques_count] = deque;
+            __atomic_store_n(&sched__deques_count, sched__deques_count + 1, __ATOMIC_RELEASE);
+            sched__current = deque;
+        }
+        global_unlock();
+    }
+    if (sched__current != NULL) {pthread_setspecific(sched__deque_key, sched__current);}
+    return sched__current;
+}
 
-// The function reading data from the file into memory, which should already be allocated.
-type fs__read_from_file(void* file, type count_of_bytes, uint8_t* memory) {
-    uint64_t result = fread(memory, 1, count_of_bytes.data, file);
-    return (type){.data = result, .type = int__type_number};
+// The function takes a task from the deque of the current thread or steals one from a random other deque.
+static sched_task* sched__find_task(sched_deque* own_deque) {
+    if (own_deque != NULL) {
+        sched_task* const task = sched__take(own_deque);
+        if (task != NULL) {return task;}
+    }
+    if (__atomic_load_n(&sched__global_count, __ATOMIC_ACQUIRE) != 0) {
+        sched_task* task = NULL;
+        mutex__lock(&sched__global_mutex);
+        if (sched__global_count != 0) {
+            task = sched__global_tasks[sched__global_first];
+            sched__global_first++;
+            __atomic_store_n(&sched__global_count, sched__global_count - 1, __ATOMIC_RELAXED);
+            if (sched__global_count == 0) {sched__global_first = 0;}
+        }
+        mutex__unlock(&sched__global_mutex);
+        if (task != NULL) {return task;}
+    }
+    if (sched__victim_seed == 0) {sched__victim_seed = (uint64_t)&sched__victim_seed | 1;}
+    for (;;) {
+        uint64_t const count = __atomic_load_n(&sched__deques_count, __ATOMIC_ACQUIRE);
+        sched__victim_seed ^= sched__victim_seed << 13;
+        sched__victim_seed ^= sched__victim_seed >> 7;
+        sched__victim_seed ^= sched__victim_seed << 17;
+        uint64_t const first_victim = count == 0 ? 0 : sched__victim_seed % count;
+        bool is_contended = false;
+        for (uint64_t offset = 0; offset < count; offset++) {
+            sched_deque* const victim = sched__deques[(first_victim + offset) % count];
+            if (victim == own_deque) {continue;}
+            sched_task* const task = sched__steal(victim, &is_contended);
+            if (task != NULL) {return task;}
+        }
+        if (!is_contended) {return NULL;}
+    }
 }
 
-// The function writing data from memory to the file.
-type fs__write_to_file(void* file, type count_of_bytes, const uint8_t* memory) {
-    uint64_t result = fwrite(memory, 1, count_of_bytes.data, file);
-    return (type){.data = result, .type = int__type_number};
+static inline void sched__notify() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sched__sleepers, __ATOMIC_RELAXED) != 0) {
+        __atomic_add_fetch(&sched__epoch, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &sched__epoch, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
 }
 
-// The function gets the size of the file at the specified path.
-// If the function could not find out the size of the file, then "nothing" is returned as a result.
-type fs__get_file_size(type file_name) {
-    uint8_t* const utf8_file_name = string__utf32_to_utf8(file_name);
-    struct stat file_stat;
-    type result;
-    if (
-        stat((char*)utf8_file_name, &file_stat) == 0 &&
-        (file_stat.st_mode & S_IFDIR) != S_IFDIR
-    ) {result = (type){.data = file_stat.st_size, .type = int__type_number};}
-    else {result = (type){.data = 0, .type = nothing__type_number};}
-    free(utf8_file_name);
-    return result;
+// The function puts the task to the deque of the current thread, so idle scheduler threads can steal it.
+// Returns "false" if the current thread has no deque, then the caller must run the task itself.
+static bool sched__spawn(sched_task* task) {
+    sched_deque* const deque = sched__current_deque();
+    if (deque == NULL) {return false;}
+    sched__push(deque, task);
+    sched__notify();
+    return true;
 }
 
-// The function returns the current position in the file.
-// If the function could not find the position in the file, then "nothing" is returned as a result.
-type fs__get_position_in_file(void* file) {
-    int64_t const position = ftell(file);
-    if (position == -1) {return (type){.data = 0, .type = nothing__type_number};}
-    return (type){.data = position, .type = int__type_number};
+// The function puts the task to the end of the global queue.
+static void sched__enqueue(sched_task* task) {
+    mutex__lock(&sched__global_mutex);
+    if (sched__global_first + sched__global_count == sched__global_capacity) {
+        if (sched__global_first != 0) {
+            memmove(sched__global_tasks, &(sched__global_tasks[sched__global_first]), sched__global_count * sizeof(sched_task*));
+            sched__global_first = 0;
+        } else {
+            sched__global_capacity = sched__global_capacity == 0 ? 64 : sched__global_capacity * 2;
+            sched__global_tasks = realloc(sched__global_tasks, sched__global_capacity * sizeof(sched_task*));
+        }
+    }
+    sched__global_tasks[sched__global_first + sched__global_count] = task;
+    __atomic_store_n(&sched__global_count, sched__global_count + 1, __ATOMIC_RELEASE);
+    mutex__unlock(&sched__global_mutex);
+    sched__notify();
 }
 
-// The function sets the current position in the file.
-// If the setting was successful, then the function returns "true", otherwise "false".
-type fs__set_position_in_file(void* file, type new_position) {return (type){.data = fseek(file, new_position.data, SEEK_SET) == 0, .type = bool__type_numer};}
+// Unlike "sched__spawn", the task is always given to the scheduler threads, even if the current thread has no deque.
+static void sched__submit(sched_task* task) {
+    if (!sched__spawn(task)) {sched__enqueue(task);}
+}
 
-// The function renames the file.
-// If the renaming was successful, then the function returns "true", otherwise "false".
-type fs__file_rename(type old_file_name, type new_file_name) {
-    uint8_t* const utf8_old_file_name = string__utf32_to_utf8(old_file_name);
-    uint8_t* const utf8_new_file_name = string__utf32_to_utf8(new_file_name);
-    struct stat fs_stat;
-    bool result =
-        (
-            stat((char*)utf8_old_file_name, &fs_stat) == 0 ||
-            lstat((char*)utf8_old_file_name, &fs_stat) == 0
-        ) &&
-        (fs_stat.st_mode & S_IFDIR) != S_IFDIR &&
-        lstat((char*)utf8_new_file_name, &fs_stat) != 0 &&
-        rename((char*)utf8_old_file_name, (char*)utf8_new_file_name) == 0;
-    free(utf8_old_file_name);
-    free(utf8_new_file_name);
-    return (type){.data = result, .type = bool__type_numer};
+// A scheduler thread runs tasks and sleeps when there are none.
+static void* sched__run(void* args) {
+    thread_data* const th_data = thread_data__create();
+    trace__start_thread(th_data->id);
+    sched_deque* const own_deque = sched__current_deque();
+    for (;;) {
+        sched_task* task = sched__find_task(own_deque);
+        if (task == NULL) {
+            uint32_t const observed_epoch = __atomic_load_n(&sched__epoch, __ATOMIC_SEQ_CST);
+            __atomic_add_fetch(&sched__sleepers, 1, __ATOMIC_SEQ_CST);
+            task = sched__find_task(own_deque);
+            if (task == NULL) {syscall(SYS_futex, &sched__epoch, FUTEX_WAIT_PRIVATE, observed_epoch, NULL, NULL, 0);}
+            __atomic_sub_fetch(&sched__sleepers, 1, __ATOMIC_SEQ_CST);
+            if (task == NULL) {continue;}
+        }
+        task->run(task, th_data);
+    }
+    return NULL;
 }
 
-// The function renames the directory.
-// If the renaming was successful, then the function returns "true", otherwise "false".
-type fs__dir_rename(type old_dir_name, type new_dir_name) {
-    uint8_t* const utf8_old_dir_name = string__utf32_to_utf8(old_dir_name);
-    uint8_t* const utf8_new_dir_name = string__utf32_to_utf8(new_dir_name);
-    struct stat fs_stat;
-    bool result =
-        stat((char*)utf8_old_dir_name, &fs_stat) == 0 &&
-        (fs_stat.st_mode & S_IFDIR) == S_IFDIR &&
-        lstat((char*)utf8_new_dir_name, &fs_stat) != 0 &&
-        rename((char*)utf8_old_dir_name, (char*)utf8_new_dir_name) == 0;
-    free(utf8_old_dir_name);
-    free(utf8_new_dir_name);
-    return (type){.data = result, .type = bool__type_numer};
+// The scheduler threads are started on first use, together with the calling thread they occupy all CPU cores.
+// At least one thread is started, so tasks of coroutines run even on a single core.
+static void sched__start() {
+    pthread_key_create(&sched__deque_key, sched__release_deque);
+    uint64_t const threads_count = cpu_cores_number > 1 ? cpu_cores_number - 1 : 1;
+    for (uint64_t index = 0; index < threads_count; index++) {
+        pthread_t thread;
+        if (__builtin_expect(pthread_create(&thread, NULL, sched__run, NULL) != 0, false)) {
+            fprintf(stderr, "Failed to start new thread.\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
+    }
 }
 
-// The function prepares data for parsing the contents of a directory.
-// If the function was unable to open the directory, then "nothing" is returned as a result.
-type fs__open_dir(type dir_name) {
-    uint8_t* const utf8_dir_name = string__utf32_to_utf8(dir_name);
-    DIR* dir = opendir((char*)utf8_dir_name);
-    free(utf8_dir_name);
-    type result = (type){.data = 0, .type = nothing__type_number};
-    if (dir != NULL) {result = (type){.data = (uint64_t)dir, .type = int__type_number};}
-    return result;
+// The function runs tasks until "*is_finished" becomes non-zero, when there is nothing to run, it sleeps on the futex.
+static void sched__help_until(uint32_t* is_finished, void* th_data) {
+    sched_deque* const own_deque = sched__current_deque();
+    while (__atomic_load_n(is_finished, __ATOMIC_ACQUIRE) == 0) {
+        sched_task* const task = sched__find_task(own_deque);
+        if (task != NULL) {task->run(task, th_data);}
+        else {syscall(SYS_futex, is_finished, FUTEX_WAIT_PRIVATE, 0, &(struct timespec){.tv_sec = 0, .tv_nsec = 1000000}, NULL, 0);}
+    }
 }
 
-// The function gets information about one of the objects from the directory.
-type fs__read_dir(type dir, type* object_type) {
-    type result = (type){.data = 0, .type = nothing__type_number};
-    global_lock();
-    for (;;) {
-        struct dirent* const dir_entry = readdir((DIR*)dir.data);
-        if (dir_entry == NULL) {break;}
-        char* const object_name = dir_entry->d_name;
-        const uint64_t object_name_length = strlen(object_name);
-        if (
-            object_name[0] == '.' &&
-            (object_name_length == 1 || (object_name_length == 2 && object_name[1] == '.'))
-        ) {continue;}
-        switch (dir_entry->d_type) {
-        case DT_BLK:
-            *object_type = (type){.data = 0, .type = int__type_number};
-            break;
-        case DT_CHR:
-            *object_type = (type){.data = 1, .type = int__type_number};
-            break;
-        case DT_DIR:
-            *object_type = (type){.data = 2, .type = int__type_number};
-            break;
-        case DT_FIFO:
-            *object_type = (type){.data = 3, .type = int__type_number};
-            break;
-        case DT_LNK:
-            *object_type = (type){.data = 4, .type = int__type_number};
-            break;
-        case DT_REG:
-            *object_type = (type){.data = 5, .type = int__type_number};
-            break;
-        case DT_SOCK:
-            *object_type = (type){.data = 6, .type = int__type_number};
+// A parked coroutine ("waiter" is not "NULL") is signaled under the mutex of its waiter, a thread is woken up on the futex.
+static inline void sched__finish(uint32_t* is_finished, pipeline_waiter* waiter) {
+    if (waiter != NULL) {
+        mutex__lock(&(waiter->mutex));
+        __atomic_store_n(is_finished, 1, __ATOMIC_RELEASE);
+        waiter->signaled = true;
+        coroutine__notify(waiter->coroutine);
+        mutex__unlock(&(waiter->mutex));
+        return;
+    }
+    __atomic_store_n(is_finished, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, is_finished, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+struct {
+    void             (*body)(uint64_t begin, uint64_t end, void* context, void* th_data);
+    void*            context;
+    uint64_t         grain;
+    uint64_t         remaining;
+    uint32_t         is_finished;
+    pipeline_waiter* waiter;
+} typedef sched_range_job;
+
+struct {
+    sched_task       task;
+    sched_range_job* job;
+    uint64_t         begin;
+    uint64_t         end;
+} typedef sched_range_task;
+
+// The range is halved while it is larger than the grain, the right halves go to the deque for thieves.
+static void sched__run_range(sched_task* task, void* th_data) {
+    sched_range_task* const range_task = (sched_range_task*)task;
+    sched_range_job* const job = range_task->job;
+    uint64_t const begin = range_task->begin;
+    uint64_t end = range_task->end;
+    while (end - begin > job->grain) {
+        uint64_t const middle = begin + (end - begin) / 2;
+        sched_range_task* const right = malloc(sizeof(sched_range_task));
+        *right = (sched_range_task){.task = {.run = sched__run_range}, .job = job, .begin = middle, .end = end};
+        if (!sched__spawn(&(right->task))) {
+            free(right);
             break;
-        default:
-            *object_type = (type){.data = 255, .type = int__type_number};
         }
-        result = string__utf8_to_utf32((const uint8_t*)object_name);
-        break;
+        end = middle;
     }
-    global_unlock();
-    return result;
+    free(range_task);
+    job->body(begin, end, job->context, th_data);
+    if (__atomic_sub_fetch(&(job->remaining), end - begin, __ATOMIC_ACQ_REL) == 0) {sched__finish(&(job->is_finished), job->waiter);}
 }
 
-// The function stops parsing the contents of the directory.
-void fs__close_dir(type dir) {closedir((DIR*)dir.data);}
+// A coroutine doesn't run parts of the range on its small stack, it submits the whole range and parks until the range is done.
+__attribute__((noinline)) static void sched__run_range_parked(sched_range_task* task) {
+    sched_range_job* const job = task->job;
+    pipeline_waiter waiter;
+    waiter.signaled = false;
+    waiter.coroutine = coroutine__current;
+    mutex__init(&(waiter.mutex));
+    job->waiter = &waiter;
+    sched__submit(&(task->task));
+    while (__atomic_load_n(&(job->is_finished), __ATOMIC_ACQUIRE) == 0) {coroutine__wait_for_signal(&waiter, NULL);}
+    // The last part may still hold the mutex after setting "is_finished", so the mutex is taken once more before it is destroyed.
+    mutex__lock(&(waiter.mutex));
+    mutex__unlock(&(waiter.mutex));
+    mutex__destroy(&(waiter.mutex));
+}
 
-// The function creates a directory and if it succeeds, it returns "true".
-// If the specified directory already exists and "ignore_existed_directory" is equal to "true", then the function returns "true".
-type fs__make_dir(type dir_name, type ignore_existed_directory) {
-    uint8_t* const utf8_dir_name = string__utf32_to_utf8(dir_name);
-    bool result =
-        mkdir((char*)utf8_dir_name, S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO) == 0 ||
-        ((ignore_existed_directory.data & 1) == 1 && errno == EEXIST);
-    free(utf8_dir_name);
-    return (type){.data = result, .type = bool__type_numer};
+// The function calls "body" for parts of the range [begin, end) on all CPU cores and returns when the whole range is done.
+// If "grain" is 0, it is chosen so that every thread gets several parts.
+static void sched__parallel_for(uint64_t begin, uint64_t end, uint64_t grain, void (*body)(uint64_t, uint64_t, void*, void*), void* context, void* th_data) {
+    if (begin >= end) {return;}
+    if (grain == 0) {
+        grain = (end - begin) / (cpu_cores_number * 8);
+        if (grain == 0) {grain = 1;}
+    }
+    if (!allow_threads || end - begin <= grain) {
+        body(begin, end, context, th_data);
+        return;
+    }
+    pthread_once(&sched__once, sched__start);
+    sched_range_job job = {.body = body, .context = context, .grain = grain, .remaining = end - begin, .is_finished = 0, .waiter = NULL};
+    sched_range_task* const task = malloc(sizeof(sched_range_task));
+    *task = (sched_range_task){.task = {.run = sched__run_range}, .job = &job, .begin = begin, .end = end};
+    if (coroutine__current != NULL) {
+        sched__run_range_parked(task);
+        return;
+    }
+    trace__event('B', "parallel_for");
+    sched__run_range(&(task->task), th_data);
+    sched__help_until(&(job.is_finished), th_data);
+    trace__event('E', NULL);
 }
 
-// The function return the name of the directory used to store temporary files.
-type fs__get_tmp_dir_name() {return fs__tmp_dir_name;}
+struct {
+    type        (*function)(type, type, void*, bool);
+    type        context;
+    const type* input;
+    type*       output;
+    uint64_t    first_error;
+} typedef sched_call_job;
 
-__attribute__((cold)) static type fs__problem_solver(const char* destination, const char* source, type* problem_solver, type (problem_solver_func)(type*, type, type, uint64_t, uint32_t, void*, bool), type problem_code, void* th_data) {
-    type destination_utf32 = string__utf8_to_utf32((uint8_t*)destination);
-    type source_utf32 = string__utf8_to_utf32((uint8_t*)source);
-    type const result = problem_solver_func(problem_solver, destination_utf32, source_utf32, problem_code.data, problem_code.type, th_data, false);
-    shar__rc_free(destination_utf32, th_data, false);
-    shar__rc_free(source_utf32, th_data, false);
+// The first error is kept, the other errors are freed, after an error the remaining iterations are skipped.
+static inline void sched__store_error(sched_call_job* job, type error_obj, void* th_data) {
+    uint64_t expected = 0;
+    if (!__atomic_compare_exchange_n(&(job->first_error), &expected, error_obj.data, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {error__free(error_obj, th_data);}
+}
+
+static void sched__call_for(uint64_t begin, uint64_t end, void* context, void* th_data) {
+    sched_call_job* const job = (sched_call_job*)context;
+    for (uint64_t index = begin; index < end && __atomic_load_n(&(job->first_error), __ATOMIC_RELAXED) == 0; index++) {
+        type const result = job->function((type){.data = index, .type = int__type_number}, job->context, th_data, false);
+        if (result.type == error__type_number) {sched__store_error(job, result, th_data);}
+        else if (result.type != nothing__type_number) {shar__object_free(result, th_data);}
+    }
+}
+
+static void sched__call_map(uint64_t begin, uint64_t end, void* context, void* th_data) {
+    sched_call_job* const job = (sched_call_job*)context;
+    for (uint64_t index = begin; index < end; index++) {
+        job->output[index] = (type){.data = 0, .type = nothing__type_number};
+        if (__atomic_load_n(&(job->first_error), __ATOMIC_RELAXED) != 0) {continue;}
+        type const result = job->function(job->input[index], job->context, th_data, false);
+        if (result.type == error__type_number) {sched__store_error(job, result, th_data);}
+        else {job->output[index] = result;}
+    }
+}
+
+// The function calls "function(index, context)" for every index in [begin, end) on all CPU cores (work stealing balances uneven iterations).
+// "grain" is the smallest number of iterations in one task, 0 - chosen automatically.
+// The function returns "nothing" or the first error returned by "function" (after an error the remaining iterations are skipped).
+type worker__parallel_for(type begin, type end, type grain, type (*function)(type, type, void*, bool), type context, void* th_data) {
+    sched_call_job job = {.function = function, .context = context, .input = NULL, .output = NULL, .first_error = 0};
+    sched__parallel_for(begin.data, end.data, grain.data, sched__call_for, &job, th_data);
+    if (job.first_error != 0) {return (type){.data = job.first_error, .type = error__type_number};}
+    return (type){.data = 0, .type = nothing__type_number};
+}
+
+// The function writes "function(input[i], context)" to "output[i]" for every item of the array, in parallel on all CPU cores.
+// The function returns "nothing" or the first error returned by "function" (the outputs of failed or skipped items are "nothing").
+type worker__parallel_map(const type* input, type count, type* output, type (*function)(type, type, void*, bool), type context, void* th_data) {
+    sched_call_job job = {.function = function, .context = context, .input = input, .output = output, .first_error = 0};
+    sched__parallel_for(0, count.data, 0, sched__call_map, &job, th_data);
+    if (job.first_error != 0) {return (type){.data = job.first_error, .type = error__type_number};}
+    return (type){.data = 0, .type = nothing__type_number};
+}
+
+#undef alloc__category
+#pragma endregion Sched
+
+#pragma region Task
+#define alloc__category alloc__category__thread
+
+// The result of a task, it is shared by the task and the owner of the handle until both release it.
+struct {
+    uint64_t rc;
+    uint32_t is_done;
+    type     result;
+} typedef task_future;
+
+struct {
+    sched_task   task;
+    type         (*function)(type, void*, bool);
+    type         argument;
+    task_future* future;
+} typedef task_job;
+
+// Every finished task increments the counter, threads waiting for futures sleep on it.
+static uint32_t task__completions = 0;
+static uint32_t task__waiters = 0;
+
+// Coroutines waiting for futures park in the list, every finished task signals all of them.
+static pthread_mutex_t task__parked_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pipeline_wait_node* task__parked = NULL;
+
+static void task__notify_parked() {
+    mutex__lock(&task__parked_mutex);
+    for (pipeline_wait_node* node = task__parked; node != NULL; node = node->next) {
+        pipeline_waiter* const waiter = node->waiter;
+        mutex__lock(&(waiter->mutex));
+        waiter->signaled = true;
+        coroutine__notify(waiter->coroutine);
+        mutex__unlock(&(waiter->mutex));
+    }
+    mutex__unlock(&task__parked_mutex);
+}
+
+// A result that was not awaited is freed, an error is printed (like the items of a freed pipeline).
+static void task__release(task_future* future, void* th_data) {
+    if (__atomic_sub_fetch(&(future->rc), 1, __ATOMIC_ACQ_REL) != 0) {return;}
+    if (future->result.type != nothing__type_number) {pipeline__free_item(future->result, th_data);}
+    free(future);
+}
+
+static void task__run(sched_task* task, void* th_data) {
+    task_job* const job = (task_job*)task;
+    task_future* const future = job->future;
+    future->result = job->function(job->argument, th_data, false);
+    shar__object_free(job->argument, th_data);
+    free(job);
+    __atomic_store_n(&(future->is_done), 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&task__completions, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&task__waiters, __ATOMIC_SEQ_CST) != 0) {syscall(SYS_futex, &task__completions, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);}
+    if (__atomic_load_n(&task__parked, __ATOMIC_SEQ_CST) != NULL) {task__notify_parked();}
+    task__release(future, th_data);
+}
+
+// The function runs "function(argument)" as a task on the shared scheduler and returns a future for its result.
+// The result (or the error) is taken with "task__await", a future that is not awaited must be freed with "task__free".
+type task__spawn(type (*function)(type, void*, bool), type argument, void* th_data) {
+    task_future* const future = malloc(sizeof(task_future));
+    *future = (task_future){.rc = 2, .is_done = 0, .result = (type){.data = 0, .type = nothing__type_number}};
+    task_job* const job = malloc(sizeof(task_job));
+    *job = (task_job){.task = {.run = task__run}, .function = function, .argument = argument, .future = future};
+    shar__object_use(argument, th_data);
+    if (allow_threads) {pthread_once(&sched__once, sched__start);}
+    if (!allow_threads || !sched__spawn(&(job->task))) {task__run(&(job->task), th_data);}
+    return (type){.data = (uint64_t)future, .type = int__type_number};
+}
+
+static inline bool task__is_done(type future) {
+    return __atomic_load_n(&(((task_future*)future.data)->is_done), __ATOMIC_ACQUIRE) != 0;
+}
+
+// The function returns the index of a finished future, or -1 if none has finished ("wait_for_all" - the last index if all have finished).
+static int64_t task__check(const type* futures, uint64_t count, bool wait_for_all) {
+    for (uint64_t index = 0; index < count; index++) {
+        bool const is_done = task__is_done(futures[index]);
+        if (!wait_for_all && is_done) {return index;}
+        if (wait_for_all && !is_done) {return -1;}
+    }
+    return wait_for_all ? (int64_t)count - 1 : -1;
+}
+
+// A coroutine doesn't run tasks on its small stack, it parks until a finished task signals it.
+__attribute__((noinline)) static int64_t task__wait_parked(const type* futures, uint64_t count, bool wait_for_all) {
+    pipeline_waiter waiter;
+    waiter.signaled = false;
+    waiter.coroutine = coroutine__current;
+    mutex__init(&(waiter.mutex));
+    pipeline_wait_node node = {.waiter = &waiter, .prev = NULL, .next = NULL};
+    mutex__lock(&task__parked_mutex);
+    node.next = task__parked;
+    if (task__parked != NULL) {task__parked->prev = &node;}
+    __atomic_store_n(&task__parked, &node, __ATOMIC_SEQ_CST);
+    mutex__unlock(&task__parked_mutex);
+    int64_t result;
+    while ((result = task__check(futures, count, wait_for_all)) == -1) {coroutine__wait_for_signal(&waiter, NULL);}
+    mutex__lock(&task__parked_mutex);
+    if (node.prev == NULL) {task__parked = node.next;}
+    else {node.prev->next = node.next;}
+    if (node.next != NULL) {node.next->prev = node.prev;}
+    mutex__unlock(&task__parked_mutex);
+    mutex__destroy(&(waiter.mutex));
     return result;
 }
 
-static type fs__copy_link_utf8(const char* destination, const char* source, uint8_t** buffer, type* problem_solver, type (problem_solver_func)(type*, type, type, uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), void* th_data) {
-    type result = (type){.data = 0, .type = nothing__type_number};
-    if (*buffer == NULL) {*buffer = malloc(file_buffer_size);}
-    uint64_t readed_len;
+// While the futures are not ready, the waiting thread runs tasks of the scheduler, so awaiting inside a task doesn't block a core.
+static int64_t task__wait(const type* futures, uint64_t count, bool wait_for_all, void* th_data) {
+    if (coroutine__current != NULL && count != 0) {return task__wait_parked(futures, count, wait_for_all);}
+    sched_deque* const own_deque = allow_threads ? sched__current_deque() : NULL;
+    bool is_waiting = false;
     for (;;) {
-        readed_len = readlink(source, (char*)(*buffer), file_buffer_size);
-        if (readed_len == -1) {
-            result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__read_link, th_data, false), th_data);
-            if (result.type == error__type_number) {return result;}
-        } else {
-            (*buffer)[readed_len] = 0;
-            if (symlink((char*)(*buffer), destination) == 0) {break;}
-            result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__create_symlink, th_data, false), th_data);
-            break;
+        uint32_t const observed_completions = __atomic_load_n(&task__completions, __ATOMIC_SEQ_CST);
+        int64_t const result = task__check(futures, count, wait_for_all);
+        if (result != -1 || count == 0) {
+            if (is_waiting) {trace__event('E', NULL);}
+            return result;
+        }
+        sched_task* const task = sched__find_task(own_deque);
+        if (task != NULL) {
+            task->run(task, th_data);
+            continue;
+        }
+        if (!is_waiting) {
+            trace__event('B', "task wait");
+            is_waiting = true;
+        }
+        // New tasks of other threads don't wake the waiter, so the sleep is limited.
+        __atomic_add_fetch(&task__waiters, 1, __ATOMIC_SEQ_CST);
+        if (task__check(futures, count, wait_for_all) == -1) {
+            syscall(SYS_futex, &task__completions, FUTEX_WAIT_PRIVATE, observed_completions, &(struct timespec){.tv_sec = 0, .tv_nsec = 1000000}, NULL, 0);
         }
+        __atomic_sub_fetch(&task__waiters, 1, __ATOMIC_SEQ_CST);
     }
+}
+
+// The function waits for the task to finish and returns its result (an error returned by the task is returned as is).
+// The future is released by the call, so it can be awaited only once.
+type task__await(type future, void* th_data) {
+    task__wait(&future, 1, true, th_data);
+    task_future* const future_ptr = (task_future*)future.data;
+    type const result = future_ptr->result;
+    future_ptr->result = (type){.data = 0, .type = nothing__type_number};
+    task__release(future_ptr, th_data);
     return result;
 }
 
-static type fs__copy_file_utf8(const char* destination, const char* source, struct stat file_stat, int* pipefd, bool* allow_splice, uint8_t** buffer, type* problem_solver, type (problem_solver_func)(type*, type, type, uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), void* th_data) {
-    type result = (type){.data = 0, .type = nothing__type_number};
-    int src_fd;
-    int dest_fd;
-    src_fd = open(source, O_RDONLY);
-    if (src_fd == -1) {
-        result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__open_file, th_data, false), th_data);
-        return result;
+// The function waits until one of the futures is finished and returns its index, the futures are not released.
+// If "count" is 0, then "nothing" is returned as a result.
+type task__await_any(const type* futures, type count, void* th_data) {
+    int64_t const index = task__wait(futures, count.data, false, th_data);
+    if (index == -1) {return (type){.data = 0, .type = nothing__type_number};}
+    return (type){.data = index, .type = int__type_number};
+}
+
+// The function waits until all futures are finished, the futures are not released.
+void task__await_all(const type* futures, type count, void* th_data) {
+    task__wait(futures, count.data, true, th_data);
+}
+
+// If the task is finished, the function returns "true", otherwise "false".
+type task__is_finished(type future) {
+    return (type){.data = task__is_done(future), .type = bool__type_numer};
+}
+
+// The function releases a future that will not be awaited, the result is freed when the task finishes (an error is printed).
+void task__free(type future, void* th_data) {
+    task__release((task_future*)future.data, th_data);
+}
+
+#undef alloc__category
+#pragma endregion Task
+
+#pragma region Timer
+#define alloc__category alloc__category__thread
+
+// A timer pushes an item to a pipeline (or, for the runtime itself, calls a function) when its deadline passes.
+// All timers are served by one thread, it sleeps on a timerfd that is armed for the nearest deadline of the heap.
+#define timer__no_heap_index UINT64_MAX
+#define timer__no_slot       UINT32_MAX
+
+struct {
+    uint64_t deadline;
+    uint64_t period;
+    uint64_t heap_index;
+    uint64_t pipe;
+    type     item;
+    void     (*callback)(void* context);
+    void*    context;
+    uint32_t generation;
+    uint32_t next_free;
+} typedef timer_entry;
+
+static pthread_once_t timer__once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t timer__mutex = PTHREAD_MUTEX_INITIALIZER;
+static int timer__fd = -1;
+static thread_data* timer__th_data = NULL;
+// A handle of a timer is the slot of its entry and the generation of the slot, so a handle of a finished timer stays harmless.
+static timer_entry* timer__entries = NULL;
+static uint32_t* timer__heap = NULL;
+static uint64_t timer__entries_count = 0;
+static uint64_t timer__capacity = 0;
+static uint64_t timer__heap_count = 0;
+static uint32_t timer__first_free = timer__no_slot;
+
+static inline uint64_t timer__now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline void timer__free_item(type item, void* th_data) {
+    if (item.type == error__type_number) {error__free(item, th_data);}
+    else if (item.type != nothing__type_number) {shar__object_free(item, th_data);}
+}
+
+// The timer mutex must be locked.
+static void timer__sift_up(uint64_t index) {
+    uint32_t const slot = timer__heap[index];
+    uint64_t const deadline = timer__entries[slot].deadline;
+    while (index != 0) {
+        uint64_t const parent = (index - 1) / 2;
+        if (timer__entries[timer__heap[parent]].deadline <= deadline) {break;}
+        timer__heap[index] = timer__heap[parent];
+        timer__entries[timer__heap[index]].heap_index = index;
+        index = parent;
     }
-    dest_fd = open(destination, O_CREAT | O_EXCL | O_WRONLY, file_stat.st_mode & ~S_IFMT);
-    if (dest_fd == -1) {
-        close(src_fd);
-        result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__create_file, th_data, false), th_data);
-        return result;
+    timer__heap[index] = slot;
+    timer__entries[slot].heap_index = index;
+}
+
+// The timer mutex must be locked.
+static void timer__sift_down(uint64_t index) {
+    uint32_t const slot = timer__heap[index];
+    uint64_t const deadline = timer__entries[slot].deadline;
+    for (;;) {
+        uint64_t child = index * 2 + 1;
+        if (child >= timer__heap_count) {break;}
+        if (child + 1 < timer__heap_count && timer__entries[timer__heap[child + 1]].deadline < timer__entries[timer__heap[child]].deadline) {child++;}
+        if (deadline <= timer__entries[timer__heap[child]].deadline) {break;}
+        timer__heap[index] = timer__heap[child];
+        timer__entries[timer__heap[index]].heap_index = index;
+        index = child;
     }
-    if (allow_splice) {
-        for (;;) {
-            uint64_t const readed_bytes_len = splice(src_fd, NULL, pipefd[1], NULL, file_buffer_size, SPLICE_F_MOVE);
-            if (readed_bytes_len == 0) {break;}
-            if (__builtin_expect(readed_bytes_len == -1, false)) {
-                *allow_splice = false;
-                if (*buffer == NULL) {*buffer = malloc(file_buffer_size);}
-                break;
-            }
-            uint64_t const writed_bytes_len = splice(pipefd[0], NULL, dest_fd, NULL, file_buffer_size, SPLICE_F_MOVE);
-            if (__builtin_expect(readed_bytes_len != writed_bytes_len, false)) {
-                *allow_splice = false;
-                if (*buffer == NULL) {*buffer = malloc(file_buffer_size);}
-                break;
-            }
-        }
+    timer__heap[index] = slot;
+    timer__entries[slot].heap_index = index;
+}
+
+// The timer mutex must be locked. The slot goes back to the free list, the generation makes the old handle invalid.
+static void timer__release(uint32_t slot) {
+    timer_entry* const entry = &(timer__entries[slot]);
+    uint64_t const index = entry->heap_index;
+    entry->heap_index = timer__no_heap_index;
+    entry->generation++;
+    entry->next_free = timer__first_free;
+    timer__first_free = slot;
+    timer__heap_count--;
+    if (index == timer__heap_count) {return;}
+    timer__heap[index] = timer__heap[timer__heap_count];
+    timer__sift_up(index);
+    timer__sift_down(timer__entries[timer__heap[index]].heap_index);
+}
+
+// The timer mutex must be locked. If the heap is empty, the timerfd is disarmed.
+static void timer__arm() {
+    struct itimerspec value = {0};
+    if (timer__heap_count != 0) {
+        uint64_t const deadline = timer__entries[timer__heap[0]].deadline;
+        value.it_value = (struct timespec){.tv_sec = deadline / 1000000000, .tv_nsec = deadline % 1000000000};
     }
-    if (!allow_splice) {
-        for (;;) {
-            uint64_t const readed_bytes_len = read(src_fd, *buffer, file_buffer_size);
-            if (readed_bytes_len == 0) {break;}
-            if (readed_bytes_len == -1) {
-                close(src_fd);
-                close(dest_fd);
-                result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__read_from_file, th_data, false), th_data);
-                return result;
-            }
-            uint64_t const writed_bytes_len = write(dest_fd, *buffer, readed_bytes_len);
-            if (writed_bytes_len != readed_bytes_len) {
-                close(src_fd);
-                close(dest_fd);
-                result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__write_to_file, th_data, false), th_data);
-                return result;
+    timerfd_settime(timer__fd, TFD_TIMER_ABSTIME, &value, NULL);
+}
+
+// An item that doesn't fit into a full bounded pipeline is freed, so a slow consumer doesn't stop the other timers.
+static void timer__deliver(uint64_t pipe, type item) {
+    if (pipeline__try_push(pipe, item).data == false) {timer__free_item(item, timer__th_data);}
+}
+
+static void* timer__run(void* args) {
+    trace__start_thread(timer__th_data->id);
+    for (;;) {
+        uint64_t expirations;
+        if (read(timer__fd, &expirations, sizeof(expirations)) == -1 && errno != EINTR) {continue;}
+        mutex__lock(&timer__mutex);
+        uint64_t const now = timer__now();
+        while (timer__heap_count != 0 && timer__entries[timer__heap[0]].deadline <= now) {
+            uint32_t const slot = timer__heap[0];
+            timer_entry* const entry = &(timer__entries[slot]);
+            if (entry->callback != NULL) {
+                entry->callback(entry->context);
+                timer__release(slot);
+            } else if (entry->period == 0) {
+                timer__deliver(entry->pipe, entry->item);
+                pipeline__free(entry->pipe, timer__th_data);
+                timer__release(slot);
+            } else {
+                // Missed periods are skipped, a periodic timer doesn't deliver a burst of items after a delay.
+                shar__object_use(entry->item, timer__th_data);
+                timer__deliver(entry->pipe, entry->item);
+                do {entry->deadline += entry->period;} while (entry->deadline <= now);
+                timer__sift_down(0);
             }
         }
+        timer__arm();
+        mutex__unlock(&timer__mutex);
     }
-    close(src_fd);
-    close(dest_fd);
-    chmod(destination, file_stat.st_mode & ~S_IFMT);
-    chown(destination, file_stat.st_uid, file_stat.st_gid);
-    return result;
+    return NULL;
 }
 
-static type fs__copy_dir_utf8(const char* destination, const char* source, struct stat dir_stat, int* pipefd, bool* allow_splice, uint8_t** buffer, type* problem_solver, type (problem_solver_func)(type*, type, type, uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), void* th_data) {
-    type result = (type){.data = 0, .type = nothing__type_number};
-    if (mkdir(destination, S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO) == 0) {
-        chmod(destination, dir_stat.st_mode & ~S_IFMT);
-        chown(destination, dir_stat.st_uid, dir_stat.st_gid);
-    } else {
-        result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__make_dir, th_data, false), th_data);
-        if (result.type == error__type_number) {return result;}
+static void timer__start() {
+    timer__fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (__builtin_expect(timer__fd == -1, false)) {
+        fprintf(stderr, "Failed to create a timer file descriptor.\n");
+        exit(EXIT_FAILURE);
+    }
+    timer__th_data = thread_data__create();
+    pthread_t thread;
+    if (__builtin_expect(pthread_create(&thread, NULL, timer__run, NULL) != 0, false)) {
+        fprintf(stderr, "Failed to start new thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+}
+
+// The function adds a timer with the absolute CLOCK_MONOTONIC deadline in nanoseconds ("period" 0 - a one-shot timer).
+// The timer either calls "callback" (under the timer mutex, so it must be short) or delivers "item" to the pipeline.
+static uint64_t timer__add(uint64_t deadline, uint64_t period, uint64_t pipe, type item, void (*callback)(void*), void* context) {
+    pthread_once(&timer__once, timer__start);
+    mutex__lock(&timer__mutex);
+    uint32_t slot = timer__first_free;
+    if (slot != timer__no_slot) {
+        timer__first_free = timer__entries[slot].next_free;
+    } else {
+        if (timer__entries_count == timer__capacity) {
+            timer__capacity = timer__capacity == 0 ? 64 : timer__capacity * 2;
+            timer__entries = realloc(timer__entries, timer__capacity * sizeof(timer_entry));
+            timer__heap = realloc(timer__heap, timer__capacity * sizeof(uint32_t));
+        }
+        slot = timer__entries_count;
+        timer__entries_count++;
+        timer__entries[slot].generation = 1;
+    }
+    timer_entry* const entry = &(timer__entries[slot]);
+    entry->deadline = deadline;
+    entry->period = period;
+    entry->pipe = pipe;
+    entry->item = item;
+    entry->callback = callback;
+    entry->context = context;
+    timer__heap[timer__heap_count] = slot;
+    timer__heap_count++;
+    timer__sift_up(timer__heap_count - 1);
+    if (entry->heap_index == 0) {timer__arm();}
+    uint64_t const result = ((uint64_t)entry->generation << 32) | slot;
+    mutex__unlock(&timer__mutex);
+    return result;
+}
+
+// The function removes the timer if it is still pending. Returns "true" if the timer was removed.
+// After the call, the timer thread doesn't use the callback context of the timer.
+static bool timer__remove(uint64_t handle, void* th_data) {
+    uint32_t const slot = (uint32_t)handle;
+    bool result = false;
+    uint64_t pipe = 0;
+    type item = (type){.data = 0, .type = nothing__type_number};
+    mutex__lock(&timer__mutex);
+    if (slot < timer__entries_count && timer__entries[slot].generation == (handle >> 32) && timer__entries[slot].heap_index != timer__no_heap_index) {
+        pipe = timer__entries[slot].pipe;
+        item = timer__entries[slot].item;
+        timer__release(slot);
+        result = true;
+    }
+    mutex__unlock(&timer__mutex);
+    timer__free_item(item, th_data);
+    if (pipe != 0) {pipeline__free(pipe, th_data);}
+    return result;
+}
+
+static type timer__create(type milliseconds, type period_ms, uint64_t pipe, type item) {
+    if (__builtin_expect(!allow_threads, false)) {
+        fprintf(stderr, "At the stage of calculating constants, it is forbidden to use threads.\n");
+        exit(EXIT_FAILURE);
+    }
+    pipeline__use(pipe);
+    uint64_t const handle = timer__add(timer__now() + milliseconds.data * 1000000, period_ms.data * 1000000, pipe, item, NULL, NULL);
+    return (type){.data = handle, .type = int__type_number};
+}
+
+// The function pushes "item" to the pipeline after "milliseconds" and returns the handle of the timer.
+// The timer owns the item until it is pushed, if the pipeline is bounded and full at that moment, the item is freed.
+type timer__after(type milliseconds, uint64_t pipe, type item) {
+    return timer__create(milliseconds, (type){.data = 0, .type = int__type_number}, pipe, item);
+}
+
+// The function pushes "item" to the pipeline every "milliseconds" (at least 1) until the timer is cancelled.
+// If the pipeline is bounded and full, the push of that period is skipped.
+type timer__every(type milliseconds, uint64_t pipe, type item) {
+    if (milliseconds.data == 0) {milliseconds.data = 1;}
+    return timer__create(milliseconds, milliseconds, pipe, item);
+}
+
+// The function stops the timer and frees its item. Returns "true" if the timer was pending,
+// "false" if it has already fired (a one-shot timer) or has been cancelled.
+type timer__cancel(type timer, void* th_data) {
+    return (type){.data = timer__remove(timer.data, th_data), .type = bool__type_numer};
+}
+
+#undef alloc__category
+#pragma endregion Timer
+
+#pragma region Coroutine
+#define alloc__category alloc__category__thread
+
+// A coroutine worker runs on its own small stack, the scheduler threads ("carriers") switch between coroutines in user space.
+// "pipeline__pop_wait", "pipeline__select", "worker__sleep" and "worker__yield" park the coroutine and free the carrier,
+// other blocking calls (a push to a full pipeline, files, processes) block the carrier like an ordinary thread.
+#define coroutine__stack_size        (64 * 1024)
+#define coroutine__max_cached_stacks 1024
+
+#define coroutine__running  0
+#define coroutine__parking  1
+#define coroutine__parked   2
+#define coroutine__notified 3
+
+struct coroutine {
+    sched_task   task;
+    void*        stack_pointer;
+    void*        carrier_stack_pointer;
+    uint8_t*     stack;
+    bool         is_finished;
+    bool         is_yielding;
+    bool         timed_out;
+    uint32_t     state;
+    uint64_t     timer;
+    worker       body;
+    thread_data* th_data;
+} typedef coroutine;
+
+static pthread_mutex_t coroutine__stacks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t* coroutine__cached_stacks[coroutine__max_cached_stacks];
+static uint64_t coroutine__cached_stacks_count = 0;
+static pthread_once_t coroutine__guard_pages_once = PTHREAD_ONCE_INIT;
+static int64_t coroutine__guard_pages_left = 0;
+
+// The function saves the callee-saved registers and the FPU control words to the current stack, stores the stack pointer to "*from"
+// and continues with the state saved on the stack "to". A new stack starts in "coroutine__entry", that calls "coroutine__main".
+void coroutine__switch(void** from, void* to) __asm__("shar_coroutine_switch");
+void coroutine__entry() __asm__("shar_coroutine_entry");
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl shar_coroutine_switch\n"
+    ".hidden shar_coroutine_switch\n"
+    ".type shar_coroutine_switch, @function\n"
+    "shar_coroutine_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size shar_coroutine_switch, .-shar_coroutine_switch\n"
+    ".p2align 4\n"
+    ".globl shar_coroutine_entry\n"
+    ".hidden shar_coroutine_entry\n"
+    ".type shar_coroutine_entry, @function\n"
+    "shar_coroutine_entry:\n"
+    "    movq %r12, %rdi\n"
+    "    andq $-16, %rsp\n"
+    "    call shar_coroutine_main\n"
+    "    ud2\n"
+    ".size shar_coroutine_entry, .-shar_coroutine_entry\n"
+);
+
+// A guard page splits the mapping of a stack in two, so only a quarter of the limit of memory mappings is spent on guard pages.
+static void coroutine__init_guard_pages() {
+    char buffer[64];
+    uint64_t const max_map_count = sys__read_file("/proc/sys/vm/max_map_count", buffer, sizeof(buffer)) != 0 ? strtoull(buffer, NULL, 10) : 65530;
+    coroutine__guard_pages_left = max_map_count / 4;
+}
+
+// Every stack has a guard page below it, so an overflow is a crash and not a corruption of another stack or of the heap.
+// When the guard pages run out, no more coroutines can be started and the process is stopped.
+static void coroutine__allocate_stack(coroutine* coroutine_ptr) {
+    mutex__lock(&coroutine__stacks_mutex);
+    if (coroutine__cached_stacks_count != 0) {
+        coroutine__cached_stacks_count--;
+        coroutine_ptr->stack = coroutine__cached_stacks[coroutine__cached_stacks_count];
+        mutex__unlock(&coroutine__stacks_mutex);
+        return;
+    }
+    mutex__unlock(&coroutine__stacks_mutex);
+    pthread_once(&coroutine__guard_pages_once, coroutine__init_guard_pages);
+    if (__builtin_expect(__atomic_sub_fetch(&coroutine__guard_pages_left, 1, __ATOMIC_RELAXED) < 0, false)) {
+        fprintf(stderr, "Failed to start new coroutine: too many coroutines (the limit is a quarter of \x22vm.max_map_count\x22).\n");
+        exit(EXIT_FAILURE);
+    }
+    uint8_t* const stack = mmap(NULL, coroutine__stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (__builtin_expect(stack == MAP_FAILED || mprotect(stack, getpagesize(), PROT_NONE) != 0, false)) {
+        fprintf(stderr, "Failed to start new coroutine: can't map its stack.\n");
+        exit(EXIT_FAILURE);
+    }
+    coroutine_ptr->stack = stack;
+}
+
+static void coroutine__release_stack(coroutine* coroutine_ptr) {
+    mutex__lock(&coroutine__stacks_mutex);
+    if (coroutine__cached_stacks_count < coroutine__max_cached_stacks) {
+        coroutine__cached_stacks[coroutine__cached_stacks_count] = coroutine_ptr->stack;
+        coroutine__cached_stacks_count++;
+        mutex__unlock(&coroutine__stacks_mutex);
+        return;
+    }
+    mutex__unlock(&coroutine__stacks_mutex);
+    munmap(coroutine_ptr->stack, coroutine__stack_size);
+    __atomic_add_fetch(&coroutine__guard_pages_left, 1, __ATOMIC_RELAXED);
+}
+
+static void coroutine__time_out(void* coroutine_ptr) {
+    __atomic_store_n(&(((coroutine*)coroutine_ptr)->timed_out), true, __ATOMIC_RELEASE);
+    coroutine__notify(coroutine_ptr);
+}
+
+// When the deadline passes, "timed_out" is set and the coroutine is woken up by the timer thread.
+static inline void coroutine__set_timer(coroutine* coroutine_ptr, const struct timespec* deadline) {
+    coroutine_ptr->timer = timer__add(deadline->tv_sec * 1000000000ull + deadline->tv_nsec, 0, 0, (type){.data = 0, .type = nothing__type_number}, coroutine__time_out, coroutine_ptr);
+}
+
+// After the call, the timer thread doesn't touch the coroutine. Returns "true" if the deadline has passed.
+static inline bool coroutine__cancel_timer(coroutine* coroutine_ptr) {
+    timer__remove(coroutine_ptr->timer, coroutine_ptr->th_data);
+    return __atomic_exchange_n(&(coroutine_ptr->timed_out), false, __ATOMIC_ACQUIRE);
+}
+
+// The function returns to the carrier, the coroutine continues after "coroutine__notify" (or at once, if it has been notified).
+// Functions that park don't get inlined, so no address of a thread local variable is kept across a change of the carrier.
+__attribute__((noinline)) static void coroutine__park(coroutine* coroutine_ptr) {
+    uint32_t expected = coroutine__running;
+    if (!__atomic_compare_exchange_n(&(coroutine_ptr->state), &expected, coroutine__parking, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&(coroutine_ptr->state), coroutine__running, __ATOMIC_RELAXED);
+        return;
+    }
+    coroutine__switch(&(coroutine_ptr->stack_pointer), coroutine_ptr->carrier_stack_pointer);
+}
+
+static void coroutine__notify(coroutine* coroutine_ptr) {
+    uint32_t state = __atomic_load_n(&(coroutine_ptr->state), __ATOMIC_ACQUIRE);
+    for (;;) {
+        if (state == coroutine__notified) {return;}
+        uint32_t const new_state = state == coroutine__parked ? coroutine__running : coroutine__notified;
+        if (__atomic_compare_exchange_n(&(coroutine_ptr->state), &state, new_state, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            if (new_state == coroutine__running) {sched__submit(&(coroutine_ptr->task));}
+            return;
+        }
+    }
+}
+
+__attribute__((noinline)) static void coroutine__yield() {
+    coroutine* const coroutine_ptr = coroutine__current;
+    coroutine_ptr->is_yielding = true;
+    coroutine__switch(&(coroutine_ptr->stack_pointer), coroutine_ptr->carrier_stack_pointer);
+}
+
+// If "deadline" is "NULL", the coroutine sleeps forever.
+__attribute__((noinline)) static void coroutine__sleep_until(const struct timespec* deadline) {
+    coroutine* const coroutine_ptr = coroutine__current;
+    if (deadline == NULL) {
+        for (;;) {coroutine__park(coroutine_ptr);}
+    }
+    coroutine__set_timer(coroutine_ptr, deadline);
+    while (!__atomic_load_n(&(coroutine_ptr->timed_out), __ATOMIC_ACQUIRE)) {coroutine__park(coroutine_ptr);}
+    coroutine__cancel_timer(coroutine_ptr);
+}
+
+// The function parks the coroutine of the waiter until the waiter is signaled or the deadline passes.
+// Returns "true" if the deadline has passed.
+__attribute__((noinline)) static bool coroutine__wait_for_signal(pipeline_waiter* waiter, const struct timespec* deadline) {
+    coroutine* const coroutine_ptr = waiter->coroutine;
+    if (deadline != NULL) {coroutine__set_timer(coroutine_ptr, deadline);}
+    bool is_signaled;
+    for (;;) {
+        mutex__lock(&(waiter->mutex));
+        is_signaled = waiter->signaled;
+        waiter->signaled = false;
+        mutex__unlock(&(waiter->mutex));
+        if (is_signaled || __atomic_load_n(&(coroutine_ptr->timed_out), __ATOMIC_ACQUIRE)) {break;}
+        coroutine__park(coroutine_ptr);
+    }
+    bool const timed_out = deadline != NULL && coroutine__cancel_timer(coroutine_ptr);
+    return !is_signaled && timed_out;
+}
+
+static void coroutine__main(coroutine* coroutine_ptr) __asm__("shar_coroutine_main") __attribute__((used, noreturn));
+static void coroutine__main(coroutine* coroutine_ptr) {
+    type const result = coroutine_ptr->body.worker(coroutine_ptr->body.in, coroutine_ptr->body.out, coroutine_ptr->th_data, true);
+    worker__push_result(coroutine_ptr->body.out, result, coroutine_ptr->th_data);
+    pipeline__free(coroutine_ptr->body.in.data, coroutine_ptr->th_data);
+    pipeline__free(coroutine_ptr->body.out.data, coroutine_ptr->th_data);
+    number_of_threads--;
+    coroutine_ptr->is_finished = true;
+    coroutine__switch(&(coroutine_ptr->stack_pointer), coroutine_ptr->carrier_stack_pointer);
+    __builtin_unreachable();
+}
+
+// The task of a coroutine resumes it on the current carrier until it parks, yields or finishes.
+// The coroutine becomes "parked" only after it has left its stack, so a notification can't resume it on two carriers at once.
+static void coroutine__resume(sched_task* task, void* th_data) {
+    coroutine* const coroutine_ptr = (coroutine*)task;
+    coroutine* const previous = coroutine__current;
+    coroutine__current = coroutine_ptr;
+    coroutine__switch(&(coroutine_ptr->carrier_stack_pointer), coroutine_ptr->stack_pointer);
+    coroutine__current = previous;
+    if (coroutine_ptr->is_finished) {
+        coroutine__release_stack(coroutine_ptr);
+        free(coroutine_ptr->th_data);
+        free(coroutine_ptr);
+        return;
+    }
+    if (coroutine_ptr->is_yielding) {
+        coroutine_ptr->is_yielding = false;
+        sched__enqueue(task);
+        return;
+    }
+    uint32_t expected = coroutine__parking;
+    if (!__atomic_compare_exchange_n(&(coroutine_ptr->state), &expected, coroutine__parked, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&(coroutine_ptr->state), coroutine__running, __ATOMIC_RELAXED);
+        sched__submit(task);
+    }
+}
+
+// The function starts a worker as a coroutine on the scheduler threads, the arguments are the same as for "worker__create".
+// A coroutine takes a 64 KiB stack with a guard page, so tens of thousands of workers waiting for pipelines can exist at once
+// (the limit is a quarter of "vm.max_map_count", it can be raised with sysctl).
+void worker__create_coroutine(type (*function)(type, type, void*, bool), type in_pipe, type out_pipe) {
+    if (__builtin_expect(!allow_threads, false)) {
+        fprintf(stderr, "At the stage of calculating constants, it is forbidden to use threads.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_once(&sched__once, sched__start);
+    coroutine* const coroutine_ptr = malloc(sizeof(coroutine));
+    *coroutine_ptr = (coroutine){
+        .task                  = {.run = coroutine__resume},
+        .carrier_stack_pointer = NULL,
+        .is_finished           = false,
+        .is_yielding           = false,
+        .timed_out             = false,
+        .state                 = coroutine__running,
+        .timer                 = 0,
+        .body                  = (worker){.worker = function, .in = in_pipe, .out = out_pipe},
+        .th_data               = thread_data__create()
+    };
+    coroutine__allocate_stack(coroutine_ptr);
+    // The initial frame is taken by "coroutine__switch": FPU control words, r15, r14, r13, r12 (the coroutine), rbx, rbp, return address.
+    uint64_t* const top = (uint64_t*)(coroutine_ptr->stack + coroutine__stack_size);
+    top[-1] = 0;
+    top[-2] = (uint64_t)coroutine__entry;
+    for (uint64_t index = 3; index <= 8; index++) {top[-(int64_t)index] = 0;}
+    top[-5] = (uint64_t)coroutine_ptr;
+    top[-9] = 0x1F80 | ((uint64_t)0x037F << 32);
+    coroutine_ptr->stack_pointer = &(top[-9]);
+    pipeline__use(in_pipe.data);
+    pipeline__use(out_pipe.data);
+    number_of_threads++;
+    sched__submit(&(coroutine_ptr->task));
+}
+
+#undef alloc__category
+#pragma endregion Coroutine
+
+#pragma region Random
+// The function returns a random number.
+type int__get_random(void* th_data) {
+    thread_data* data = (thread_data*)th_data;
+    uint64_t const bits0_14 = (data->random_number_source[0] >> 16ull) & 0x7fffull;
+    uint64_t const bits15_46 = (data->random_number_source[1] >> 32ull) & 0xffffffffull;
+    uint64_t const bits47_63 = (data->random_number_source[2] >> 16ull) & 0x1ffffull;
+    data->random_number_source[0] = data->random_number_source[0] * 1103515245ull + 12345;
+    data->random_number_source[1] = data->random_number_source[1] * 6364136223846793005ull + 1;
+    data->random_number_source[2] = data->random_number_source[2] * 25214903917ull + 11;
+    return (type){.data = bits0_14 | (bits15_46 << 14) | (bits47_63 << 46), .type = int__type_number};
+}
+
+// The function returns a random number suitable for cryptographic purposes.
+type int__get_cryptographic__random(void* th_data) {
+    thread_data* data = (thread_data*)th_data;
+    if (data->cryptographic_random_number_index == 64) {
+        FILE *file = fopen("/dev/urandom", "r");
+        if (__builtin_expect((file == NULL) || (fread(data->cryptographic_random_number_buffer, 8, 64, file) != 64), false)) {
+            fprintf(stderr, "Can't read the file \x22/dev/urandom\x22.\n");
+            exit(EXIT_FAILURE);
+        }
+        fclose(file);
+        data->cryptographic_random_number_index = 0;
+    }
+    uint64_t result = data->cryptographic_random_number_buffer[data->cryptographic_random_number_index];
+    data->cryptographic_random_number_index++;
+    return (type){.data = result, .type = int__type_number};
+}
+#pragma endregion Random
+
+#pragma region FS
+#define alloc__category alloc__category__fs
+
+#define file_buffer_size 131072
+
+#define fs__copy__problem__stat           (type){.data = 1,  .type = int__type_number}
+#define fs__copy__problem__read_link      (type){.data = 2,  .type = int__type_number}
+#define fs__copy__problem__create_symlink (type){.data = 3,  .type = int__type_number}
+#define fs__copy__problem__open_dir       (type){.data = 4,  .type = int__type_number}
+#define fs__copy__problem__make_dir       (type){.data = 5,  .type = int__type_number}
+#define fs__copy__problem__open_file      (type){.data = 6,  .type = int__type_number}
+#define fs__copy__problem__create_file    (type){.data = 7,  .type = int__type_number}
+#define fs__copy__problem__read_from_file (type){.data = 8,  .type = int__type_number}
+#define fs__copy__problem__write_to_file  (type){.data = 9,  .type = int__type_number}
+#define fs__copy__problem__delete         (type){.data = 10, .type = int__type_number}
+#define fs__copy__problem__rename         (type){.data = 11, .type = int__type_number}
+
+#define fs__sync__compare_content    1
+#define fs__sync__replace_via_rename 2
+#define fs__sync__delete_extraneous  4
+
+#define fs__delete__problem__stat             (type){.data = 1,  .type = int__type_number}
+#define fs__delete__problem__open_dir         (type){.data = 2,  .type = int__type_number}
+#define fs__delete__problem__delete_empty_dir (type){.data = 3,  .type = int__type_number}
+#define fs__delete__problem__delete_file      (type){.data = 4,  .type = int__type_number}
+
+static type const fs__tmp_dir_name = (type){.data = (uint64_t)(const uint32_t[]) {0, 0, 5, 0, '/', 't', 'm', 'p', '/'}, .type = string__type_number};
+
+#define fs__native_file__direct  1
+#define fs__native_file__noatime 2
+#define fs__native_file__cloexec 4
+
+#define fs__direct_io_alignment 4096
+
+// Native files are tagged with the lowest bit of the pointer, so all file functions accept both kinds of files.
+static inline bool fs__is_native_file(const void* file) {return ((uintptr_t)file & 1) != 0;}
+
+static inline native_file* fs__get_native_file(void* file) {return (native_file*)((uintptr_t)file & ~(uintptr_t)1);}
+
+static inline int fs__get_file_descriptor(void* file) {
+    if (fs__is_native_file(file)) {return fs__get_native_file(file)->fd;}
+    return fileno(file);
+}
+
+// The function reads from the file descriptor at the offset (from the current position for streams), retrying interrupted calls.
+static int64_t native_file__read_raw(const native_file* file, uint8_t* memory, uint64_t count, uint64_t offset) {
+    for (;;) {
+        int64_t const result = file->is_stream ? read(file->fd, memory, count) : pread(file->fd, memory, count, offset);
+        if (result != -1 || errno != EINTR) {return result;}
+    }
+}
+
+// The function writes all the data to the file descriptor, returns the number of bytes written.
+static uint64_t native_file__write_raw(const native_file* file, const uint8_t* memory, uint64_t count, uint64_t offset) {
+    uint64_t written = 0;
+    while (written < count) {
+        int64_t const result = file->is_stream || file->is_append ? write(file->fd, &(memory[written]), count - written) : pwrite(file->fd, &(memory[written]), count - written, offset + written);
+        if (result == -1 && errno == EINTR) {continue;}
+        if (result <= 0) {break;}
+        written += result;
+    }
+    return written;
+}
+
+static bool native_file__flush(native_file* file) {
+    if (!file->window_is_dirty) {return true;}
+    bool const unaligned_direct_write = file->is_direct && ((file->window_offset | file->window_length) & (fs__direct_io_alignment - 1)) != 0;
+    int const fd_flags = unaligned_direct_write ? fcntl(file->fd, F_GETFL) : 0;
+    // The tail of a file usually is not aligned to a block, it is written without "O_DIRECT".
+    if (unaligned_direct_write) {fcntl(file->fd, F_SETFL, fd_flags & ~O_DIRECT);}
+    bool const result = native_file__write_raw(file, file->buffer, file->window_length, file->window_offset) == file->window_length;
+    if (unaligned_direct_write) {fcntl(file->fd, F_SETFL, fd_flags);}
+    file->window_is_dirty = false;
+    file->window_length = 0;
+    return result;
+}
+
+static uint64_t native_file__read(native_file* file, uint64_t count, uint8_t* memory) {
+    if (file->window_is_dirty && !native_file__flush(file)) {return 0;}
+    uint64_t result = 0;
+    while (result < count) {
+        if (file->position >= file->window_offset && file->position < file->window_offset + file->window_length) {
+            uint64_t const window_position = file->position - file->window_offset;
+            uint64_t length = file->window_length - window_position;
+            if (length > count - result) {length = count - result;}
+            memcpy(&(memory[result]), &(file->buffer[window_position]), length);
+            file->position += length;
+            result += length;
+            continue;
+        }
+        if (!file->is_direct && count - result >= file->buffer_size) {
+            int64_t const length = native_file__read_raw(file, &(memory[result]), count - result, file->position);
+            if (length <= 0) {break;}
+            file->position += length;
+            result += length;
+            continue;
+        }
+        file->window_offset = file->is_direct && !file->is_stream ? file->position & ~(uint64_t)(fs__direct_io_alignment - 1) : file->position;
+        int64_t const length = native_file__read_raw(file, file->buffer, file->buffer_size, file->window_offset);
+        file->window_length = length > 0 ? length : 0;
+        if (file->position >= file->window_offset + file->window_length) {break;}
+    }
+    return result;
+}
+
+static uint64_t native_file__write(native_file* file, uint64_t count, const uint8_t* memory) {
+    if (!file->window_is_dirty || file->position != file->window_offset + file->window_length) {
+        if (!native_file__flush(file)) {return 0;}
+        file->window_is_dirty = true;
+        file->window_offset = file->position;
+        file->window_length = 0;
+    }
+    uint64_t result = 0;
+    while (result < count) {
+        if (file->window_length == 0 && !file->is_direct && count - result >= file->buffer_size) {
+            uint64_t const length = native_file__write_raw(file, &(memory[result]), count - result, file->position);
+            file->position += length;
+            file->window_offset = file->position;
+            result += length;
+            break;
+        }
+        uint64_t length = file->buffer_size - file->window_length;
+        if (length > count - result) {length = count - result;}
+        memcpy(&(file->buffer[file->window_length]), &(memory[result]), length);
+        file->window_length += length;
+        file->position += length;
+        result += length;
+        if (file->window_length == file->buffer_size) {
+            if (!native_file__flush(file)) {return result - length;}
+            file->window_is_dirty = true;
+            file->window_offset = file->position;
+        }
+    }
+    return result;
+}
+
+// Paths are encoded into per-thread buffers instead of the heap, only paths longer than "PATH_MAX" are allocated
+// (the system call still gets the whole path and reports the error itself). A function must free its paths
+// before it calls anything that can convert paths too.
+#define fs__path_slots_count 2
+
+static __thread char fs__path_buffers[fs__path_slots_count][PATH_MAX];
+
+static char* fs__path_to_utf8(type path, uint64_t slot) {
+    uint64_t const path_length = ((const uint64_t*)path.data)[1];
+    const uint32_t* const chars = &(((const uint32_t*)path.data)[4]);
+    char* const buffer = fs__path_buffers[slot];
+    uint64_t buffer_index = 0;
+    for (uint64_t char_index = 0; char_index < path_length; char_index++) {
+        if (__builtin_expect(buffer_index > PATH_MAX - 5, false)) {return (char*)string__utf32_to_utf8(path);}
+        buffer_index += char__utf32_to_utf8(chars[char_index], (uint8_t*)&(buffer[buffer_index]));
+    }
+    buffer[buffer_index] = 0;
+    return buffer;
+}
+
+static inline void fs__free_path(char* path, uint64_t slot) {
+    if (__builtin_expect(path != fs__path_buffers[slot], false)) {free(path);}
+}
+
+// The function returns the type of the object (the "S_IFMT" bits of the mode), a symbolic link is followed
+// and a broken link is reported as a link, 0 - there is no object. Only the type is requested from the kernel,
+// and an object that is not a link takes one call instead of "stat" followed by "lstat".
+static uint32_t fs__get_object_type(const char* path) {
+    struct statx object_stat;
+    if (statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, STATX_TYPE, &object_stat) != 0) {return 0;}
+    if ((object_stat.stx_mode & S_IFMT) == S_IFLNK && statx(AT_FDCWD, path, 0, STATX_TYPE, &object_stat) != 0) {return S_IFLNK;}
+    return object_stat.stx_mode & S_IFMT;
+}
+
+// The object is renamed only if "new_path" doesn't exist, with one call if the file system supports it.
+static bool fs__rename_no_replace(const char* old_path, const char* new_path) {
+    if (renameat2(AT_FDCWD, old_path, AT_FDCWD, new_path, RENAME_NOREPLACE) == 0) {return true;}
+    if (errno != EINVAL && errno != ENOSYS) {return false;}
+    struct statx object_stat;
+    return statx(AT_FDCWD, new_path, AT_SYMLINK_NOFOLLOW, STATX_TYPE, &object_stat) != 0 && rename(old_path, new_path) == 0;
+}
+
+// The function deletes the file at the specified path.
+// If the delete was successful, then the function returns "true", otherwise "false".
+type fs__delete_file(type file_name) {
+    char* const utf8_file_name = fs__path_to_utf8(file_name, 0);
+    uint32_t const object_type = fs__get_object_type(utf8_file_name);
+    bool const result =
+        object_type != 0 &&
+        (object_type & S_IFDIR) != S_IFDIR &&
+        remove(utf8_file_name) == 0;
+    fs__free_path(utf8_file_name, 0);
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function deletes the empty directory at the specified path.
+// If the delete was successful, then the function returns "true", otherwise "false".
+type fs__delete_empty_dir(type dir_name) {
+    char* const utf8_dir_name = fs__path_to_utf8(dir_name, 0);
+    bool const result =
+        (fs__get_object_type(utf8_dir_name) & S_IFDIR) == S_IFDIR &&
+        remove(utf8_dir_name) == 0;
+    fs__free_path(utf8_dir_name, 0);
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// If the file exists at the specified path, the function returns "true" otherwise "false".
+type fs__file_is_exist(type file_name) {
+    char* const utf8_file_name = fs__path_to_utf8(file_name, 0);
+    uint32_t const object_type = fs__get_object_type(utf8_file_name);
+    bool const result = object_type != 0 && (object_type & S_IFDIR) != S_IFDIR;
+    fs__free_path(utf8_file_name, 0);
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// If the directory exists at the specified path, the function returns "true" otherwise "false".
+type fs__dir_is_exist(type dir_name) {
+    char* const utf8_dir_name = fs__path_to_utf8(dir_name, 0);
+    bool const result = (fs__get_object_type(utf8_dir_name) & S_IFDIR) == S_IFDIR;
+    fs__free_path(utf8_dir_name, 0);
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function opens the file in the specified mode.
+// If the file can be opened, the function returns "true", otherwise "false".
+// Modes:
+// 25202 (rb) - opens a file for reading. The file must exist.
+// 25207 (wb) - opens a file for writing. If the file does not exist, then the function will create it, if the file already exists, then its contents will be deleted.
+// 25185 (ab) - opens a file for writing. If the file does not exist, then the function will create it, if the file already exists, then writing will be made to the end of the file.
+// 6433650 (r+b) - opens a file for reading and writing. The file must exist. The read and write position is at the beginning.
+// 6433655 (w+b) - opens a file for reading and writing. If the file does not exist, then the function will create it, if the file already exists, then its contents will be deleted.
+// 6433633 (a+b) - opens a file for reading and writing. If the file does not exist, then the function will create it, if the file already exists, the read and write position is at the end.
+bool fs__open_file(type file_name, uint32_t mode, void** out_file) {
+    char* const utf8_file_name = fs__path_to_utf8(file_name, 0);
+    FILE *file = fopen(utf8_file_name, (char*)(&mode));
+    fs__free_path(utf8_file_name, 0);
+    *out_file = file;
+    return file != NULL;
+}
+
+// The function opens the file without the C library streams, working directly with the file descriptor.
+// The modes are the same as in the "fs__open_file" function. The result works with all file functions.
+// "buffer_size" is the size of the file buffer, 0 - the default size.
+// Flags:
+// 1 - O_DIRECT, data is transferred without the page cache (the buffer is aligned to 4096 bytes).
+// 2 - O_NOATIME, the access time of the file is not updated (ignored if the user is not the owner of the file).
+// 4 - O_CLOEXEC, the file is not inherited by executed programs.
+bool fs__open_native_file(type file_name, uint32_t mode, type flags, type buffer_size, void** out_file) {
+    const uint8_t* const mode_chars = (const uint8_t*)&mode;
+    bool const update = mode_chars[1] == '+' || mode_chars[2] == '+';
+    int open_flags;
+    switch (mode_chars[0]) {
+    case 'r':
+        open_flags = update ? O_RDWR : O_RDONLY;
+        break;
+    case 'w':
+        open_flags = (update ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+        break;
+    case 'a':
+        open_flags = (update ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+        break;
+    default:
+        *out_file = NULL;
+        return false;
+    }
+    if ((flags.data & fs__native_file__direct) != 0) {open_flags |= O_DIRECT;}
+    if ((flags.data & fs__native_file__cloexec) != 0) {open_flags |= O_CLOEXEC;}
+    char* const utf8_file_name = fs__path_to_utf8(file_name, 0);
+    int fd = open(utf8_file_name, open_flags | ((flags.data & fs__native_file__noatime) != 0 ? O_NOATIME : 0), 0666);
+    if (fd == -1 && errno == EPERM && (flags.data & fs__native_file__noatime) != 0) {fd = open(utf8_file_name, open_flags, 0666);}
+    fs__free_path(utf8_file_name, 0);
+    struct stat file_stat;
+    if (fd == -1 || fstat(fd, &file_stat) != 0) {
+        if (fd != -1) {close(fd);}
+        *out_file = NULL;
+        return false;
+    }
+    uint64_t file_buffer = buffer_size.data == 0 ? file_buffer_size : buffer_size.data;
+    if ((open_flags & O_DIRECT) != 0) {file_buffer = (file_buffer + fs__direct_io_alignment - 1) & ~(uint64_t)(fs__direct_io_alignment - 1);}
+    native_file* const file = malloc(sizeof(native_file));
+    *file = (native_file) {
+        .fd              = fd,
+        .is_stream       = S_ISFIFO(file_stat.st_mode) || S_ISSOCK(file_stat.st_mode) || S_ISCHR(file_stat.st_mode),
+        .is_direct       = (open_flags & O_DIRECT) != 0,
+        .is_append       = (open_flags & O_APPEND) != 0,
+        .window_is_dirty = false,
+        .buffer          = aligned_malloc(fs__direct_io_alignment, file_buffer),
+        .buffer_size     = file_buffer,
+        .position        = (open_flags & O_APPEND) != 0 ? file_stat.st_size : 0,
+        .window_offset   = 0,
+        .window_length   = 0
+    };
+    *out_file = (void*)((uintptr_t)file | 1);
+    return true;
+}
+
+// The function flushes the output buffer.
+// If the flushed was successful, then the function returns "true", otherwise "false".
+type fs__flush_file(void* file) {
+    if (fs__is_native_file(file)) {return (type){.data = native_file__flush(fs__get_native_file(file)), .type = bool__type_numer};}
+    return (type){.data = (fflush(file) == 0), .type = bool__type_numer};
+}
+
+// The function flushes the output buffer and close the file.
+// If the closed was successful, then the function returns "true", otherwise "false".
+type fs__close_file(void* file) {
+    if (fs__is_native_file(file)) {
+        native_file* const native = fs__get_native_file(file);
+        bool const result = native_file__flush(native) & (close(native->fd) == 0);
+        free(native->buffer);
+        free(native);
+        return (type){.data = result, .type = bool__type_numer};
+    }
+    return (type){.data = (fclose(file) == 0), .type = bool__type_numer};
+}
+
+// The function reading data from the file into memory, which should already be allocated.
+type fs__read_from_file(void* file, type count_of_bytes, uint8_t* memory) {
+    if (fs__is_native_file(file)) {return (type){.data = native_file__read(fs__get_native_file(file), count_of_bytes.data, memory), .type = int__type_number};}
+    uint64_t result = fread(memory, 1, count_of_bytes.data, file);
+    return (type){.data = result, .type = int__type_number};
+}
+
+// The function writing data from memory to the file.
+type fs__write_to_file(void* file, type count_of_bytes, const uint8_t* memory) {
+    if (fs__is_native_file(file)) {return (type){.data = native_file__write(fs__get_native_file(file), count_of_bytes.data, memory), .type = int__type_number};}
+    uint64_t result = fwrite(memory, 1, count_of_bytes.data, file);
+    return (type){.data = result, .type = int__type_number};
+}
+
+// The function reads up to "count_of_bytes" bytes from the file into a new byte buffer.
+// The length of the buffer is the number of bytes actually read.
+type fs__read_bytes(void* file, type count_of_bytes) {
+    bytes* result = bytes__new(count_of_bytes.data);
+    uint64_t const length = fs__read_from_file(file, count_of_bytes, result->data).data;
+    if (length < count_of_bytes.data) {
+        result = realloc(result, sizeof(bytes) + length);
+        result->data = (uint8_t*)&(result[1]);
+        result->length = length;
+    }
+    return (type){.data = (uint64_t)result, .type = bytes__type_number};
+}
+
+// The function writes the byte buffer to the file, the number of written bytes is returned as a result.
+type fs__write_bytes(void* file, type bytes_obj) {
+    const bytes* const object = (const bytes*)bytes_obj.data;
+    return fs__write_to_file(file, (type){.data = object->length, .type = int__type_number}, object->data);
+}
+
+// The function gets the size of the file at the specified path.
+// If the function could not find out the size of the file, then "nothing" is returned as a result.
+type fs__get_file_size(type file_name) {
+    char* const utf8_file_name = fs__path_to_utf8(file_name, 0);
+    struct statx file_stat;
+    type result;
+    if (
+        statx(AT_FDCWD, utf8_file_name, 0, STATX_TYPE | STATX_SIZE, &file_stat) == 0 &&
+        (file_stat.stx_mode & S_IFDIR) != S_IFDIR
+    ) {result = (type){.data = file_stat.stx_size, .type = int__type_number};}
+    else {result = (type){.data = 0, .type = nothing__type_number};}
+    fs__free_path(utf8_file_name, 0);
+    return result;
+}
+
+// The function returns the current position in the file.
+// If the function could not find the position in the file, then "nothing" is returned as a result.
+type fs__get_position_in_file(void* file) {
+    if (fs__is_native_file(file)) {return (type){.data = fs__get_native_file(file)->position, .type = int__type_number};}
+    int64_t const position = ftell(file);
+    if (position == -1) {return (type){.data = 0, .type = nothing__type_number};}
+    return (type){.data = position, .type = int__type_number};
+}
+
+// The function sets the current position in the file.
+// If the setting was successful, then the function returns "true", otherwise "false".
+type fs__set_position_in_file(void* file, type new_position) {
+    if (fs__is_native_file(file)) {
+        native_file* const native = fs__get_native_file(file);
+        if (native->is_stream || !native_file__flush(native)) {return (type){.data = false, .type = bool__type_numer};}
+        native->position = new_position.data;
+        return (type){.data = true, .type = bool__type_numer};
+    }
+    return (type){.data = fseek(file, new_position.data, SEEK_SET) == 0, .type = bool__type_numer};
+}
+
+// The function transfers data between the file and the buffers at the offset, without using or moving the file position.
+// Interrupted and partial transfers are continued, returns the number of bytes transferred.
+static uint64_t fs__transfer_at(int fd, struct iovec* buffers, uint64_t count_of_buffers, uint64_t offset, bool is_write) {
+    uint64_t result = 0;
+    while (count_of_buffers != 0) {
+        int const count = count_of_buffers < IOV_MAX ? count_of_buffers : IOV_MAX;
+        int64_t length = is_write ? pwritev(fd, buffers, count, offset + result) : preadv(fd, buffers, count, offset + result);
+        if (length == -1 && errno == EINTR) {continue;}
+        if (length <= 0) {break;}
+        result += length;
+        while (count_of_buffers != 0 && (uint64_t)length >= buffers->iov_len) {
+            length -= buffers->iov_len;
+            buffers++;
+            count_of_buffers--;
+        }
+        if (count_of_buffers != 0) {
+            buffers->iov_base = (uint8_t*)buffers->iov_base + length;
+            buffers->iov_len -= length;
+        }
+    }
+    return result;
+}
+
+static uint64_t fs__transfer_vector_at(void* file, type offset, type count_of_buffers, uint8_t* const* buffers, const type* sizes, bool is_write) {
+    struct iovec stack_vector[64];
+    struct iovec* const vector = count_of_buffers.data <= 64 ? stack_vector : malloc(count_of_buffers.data * sizeof(struct iovec));
+    for (uint64_t index = 0; index < count_of_buffers.data; index++) {vector[index] = (struct iovec){.iov_base = buffers[index], .iov_len = sizes[index].data};}
+    uint64_t const result = fs__transfer_at(fs__get_file_descriptor(file), vector, count_of_buffers.data, offset.data, is_write);
+    if (vector != stack_vector) {free(vector);}
+    return result;
+}
+
+// The function reads data from the specified offset of the file into memory, which should already be allocated.
+// The position in the file is not used and does not change, so several workers can read one file at the same time.
+// The buffer of the file is not used: data written by "fs__write_to_file" becomes visible after the buffer is flushed.
+// For files opened with O_DIRECT, the offset, the size and the memory must be aligned to 4096 bytes.
+type fs__read_at(void* file, type offset, type count_of_bytes, uint8_t* memory) {
+    struct iovec buffer = {.iov_base = memory, .iov_len = count_of_bytes.data};
+    return (type){.data = fs__transfer_at(fs__get_file_descriptor(file), &buffer, 1, offset.data, false), .type = int__type_number};
+}
+
+// The function writes data from memory to the specified offset of the file.
+// The position in the file is not used and does not change, so several workers can write one file at the same time.
+type fs__write_at(void* file, type offset, type count_of_bytes, const uint8_t* memory) {
+    struct iovec buffer = {.iov_base = (uint8_t*)memory, .iov_len = count_of_bytes.data};
+    return (type){.data = fs__transfer_at(fs__get_file_descriptor(file), &buffer, 1, offset.data, true), .type = int__type_number};
+}
+
+// The function reads data from the specified offset of the file into several buffers (filled one after another) with one system call.
+// The position in the file is not used and does not change. Returns the number of bytes read.
+type fs__readv(void* file, type offset, type count_of_buffers, uint8_t* const* buffers, const type* sizes) {
+    return (type){.data = fs__transfer_vector_at(file, offset, count_of_buffers, buffers, sizes, false), .type = int__type_number};
+}
+
+// The function writes data from several buffers (one after another) to the specified offset of the file with one system call.
+// The position in the file is not used and does not change. Returns the number of bytes written.
+type fs__writev(void* file, type offset, type count_of_buffers, const uint8_t* const* buffers, const type* sizes) {
+    return (type){.data = fs__transfer_vector_at(file, offset, count_of_buffers, (uint8_t* const*)buffers, sizes, true), .type = int__type_number};
+}
+
+#define fs__lines_default_chunk_size 4194304
+// In the ordered mode, at most so many chunks per CPU core are decoded ahead of the next chunk to push.
+#define fs__lines_chunks_ahead_per_core 2
+
+struct {
+    type*    lines;
+    uint64_t count;
+    bool     is_ready;
+} typedef fs_lines_chunk;
+
+struct {
+    int             fd;
+    uint64_t        file_size;
+    uint64_t        chunk_size;
+    uint64_t        out_pipe;
+    fs_lines_chunk* chunks;
+    uint64_t        next_chunk;
+    uint64_t        claimed_chunks;
+    uint64_t        chunks_ahead;
+    uint64_t        chunks_count;
+    bool            is_pushing;
+    pthread_mutex_t mutex;
+    pthread_cond_t  has_room;
+    uint64_t        lines_count;
+    uint64_t        first_error;
+    uint64_t        error_chunk;
+} typedef fs_lines_job;
+
+// The function returns the offset of the first line that starts at or after "offset" (the file size if there is none).
+// Both neighbouring chunks compute the same boundary, so every line belongs to exactly one chunk.
+static uint64_t fs__line_boundary(const fs_lines_job* job, uint64_t offset) {
+    if (offset == 0) {return 0;}
+    uint8_t buffer[4096];
+    for (uint64_t position = offset - 1; position < job->file_size;) {
+        uint64_t const count = job->file_size - position < sizeof(buffer) ? job->file_size - position : sizeof(buffer);
+        struct iovec vector = {.iov_base = buffer, .iov_len = count};
+        uint64_t const length = fs__transfer_at(job->fd, &vector, 1, position, false);
+        if (length == 0) {break;}
+        const uint8_t* const new_line = memchr(buffer, '\n', length);
+        if (new_line != NULL) {return position + (new_line - buffer) + 1;}
+        position += length;
+    }
+    return job->file_size;
+}
+
+// The error of the first chunk in the file order is kept, so the result doesn't depend on the timing of the threads.
+static void fs__store_lines_error(fs_lines_job* job, uint64_t chunk_index, type error_obj, void* th_data) {
+    mutex__lock(&(job->mutex));
+    if (chunk_index < job->error_chunk) {
+        type const replaced = {.data = job->first_error, .type = error__type_number};
+        job->first_error = error_obj.data;
+        __atomic_store_n(&(job->error_chunk), chunk_index, __ATOMIC_RELAXED);
+        error_obj = replaced;
+    }
+    mutex__unlock(&(job->mutex));
+    if (error_obj.data != 0) {error__free(error_obj, th_data);}
+}
+
+static void fs__free_lines(type* lines, uint64_t count, void* th_data) {
+    for (uint64_t index = 0; index < count; index++) {shar__object_free(lines[index], th_data);}
+    free(lines);
+}
+
+// The chunks are pushed in the file order by whichever thread finds the next chunk ready, the other threads don't wait.
+// The chunks after a failed chunk are not pushed.
+static void fs__push_ready_chunks(fs_lines_job* job, void* th_data) {
+    mutex__lock(&(job->mutex));
+    if (job->is_pushing) {
+        mutex__unlock(&(job->mutex));
+        return;
+    }
+    job->is_pushing = true;
+    while (job->next_chunk < job->chunks_count && job->chunks[job->next_chunk].is_ready) {
+        fs_lines_chunk const chunk = job->chunks[job->next_chunk];
+        bool const is_after_error = job->next_chunk > job->error_chunk;
+        job->next_chunk++;
+        pthread_cond_broadcast(&(job->has_room));
+        mutex__unlock(&(job->mutex));
+        if (is_after_error) {fs__free_lines(chunk.lines, chunk.count, th_data);}
+        else {
+            pipeline__push_many(job->out_pipe, chunk.lines, (type){.data = chunk.count, .type = int__type_number});
+            free(chunk.lines);
+        }
+        mutex__lock(&(job->mutex));
+    }
+    job->is_pushing = false;
+    mutex__unlock(&(job->mutex));
+}
+
+// In the ordered mode the chunks are taken in the file order, a thread that is too far ahead of the pushed chunks waits.
+// The chunk to push next is always taken by a thread that doesn't wait, so the waits end.
+static uint64_t fs__claim_lines_chunk(fs_lines_job* job, uint64_t index) {
+    if (job->chunks == NULL) {return index;}
+    uint64_t const chunk_index = __atomic_fetch_add(&(job->claimed_chunks), 1, __ATOMIC_RELAXED);
+    mutex__lock(&(job->mutex));
+    while (chunk_index >= job->next_chunk + job->chunks_ahead) {pthread_cond_wait(&(job->has_room), &(job->mutex));}
+    mutex__unlock(&(job->mutex));
+    return chunk_index;
+}
+
+static void fs__read_lines_chunk(fs_lines_job* job, uint64_t chunk_index, void* th_data) {
+    type* lines = NULL;
+    uint64_t lines_count = 0;
+    uint64_t const begin = fs__line_boundary(job, chunk_index * job->chunk_size);
+    uint64_t const end = fs__line_boundary(job, (chunk_index + 1) * job->chunk_size);
+    if (begin < end && chunk_index < __atomic_load_n(&(job->error_chunk), __ATOMIC_RELAXED)) {
+        uint8_t* const buffer = malloc(end - begin);
+        struct iovec vector = {.iov_base = buffer, .iov_len = end - begin};
+        errno = 0;
+        if (fs__transfer_at(job->fd, &vector, 1, begin, false) != end - begin) {
+            fs__store_lines_error(job, chunk_index, error__create_utf8_message((type){.data = error__id_fail, .type = int__type_number}, (type){.data = errno, .type = int__type_number}, (const uint8_t*)"Failed to read the file"), th_data);
+        } else {
+            uint64_t max_lines_count = 1;
+            for (const uint8_t* position = buffer; (position = memchr(position, '\n', &(buffer[end - begin]) - position)) != NULL; position++) {max_lines_count++;}
+            lines = malloc(max_lines_count * sizeof(type));
+            for (uint64_t line_begin = 0; line_begin < end - begin;) {
+                const uint8_t* const new_line = memchr(&(buffer[line_begin]), '\n', end - begin - line_begin);
+                uint64_t const next = new_line != NULL ? (uint64_t)(new_line - buffer) + 1 : end - begin;
+                uint64_t line_end = new_line != NULL ? next - 1 : next;
+                if (line_end > line_begin && buffer[line_end - 1] == '\r') {line_end--;}
+                type const line = string__utf8_to_utf32_n(&(buffer[line_begin]), line_end - line_begin);
+                if (__builtin_expect(line.type == nothing__type_number, false)) {
+                    // The lines decoded before the invalid one are not pushed, the chunk is pushed whole or not at all.
+                    fs__store_lines_error(job, chunk_index, error__create_utf8_message((type){.data = error__id_fail, .type = int__type_number}, (type){.data = begin + line_begin, .type = int__type_number}, (const uint8_t*)"Invalid UTF-8 in the file"), th_data);
+                    fs__free_lines(lines, lines_count, th_data);
+                    lines = NULL;
+                    lines_count = 0;
+                    break;
+                }
+                lines[lines_count] = line;
+                lines_count++;
+                line_begin = next;
+            }
+            __atomic_add_fetch(&(job->lines_count), lines_count, __ATOMIC_RELAXED);
+        }
+        free(buffer);
+    }
+    if (job->chunks == NULL) {
+        pipeline__push_many(job->out_pipe, lines, (type){.data = lines_count, .type = int__type_number});
+        free(lines);
+        return;
+    }
+    mutex__lock(&(job->mutex));
+    job->chunks[chunk_index] = (fs_lines_chunk){.lines = lines, .count = lines_count, .is_ready = true};
+    mutex__unlock(&(job->mutex));
+    fs__push_ready_chunks(job, th_data);
+}
+
+static void fs__read_lines_range(uint64_t begin, uint64_t end, void* context, void* th_data) {
+    fs_lines_job* const job = (fs_lines_job*)context;
+    for (uint64_t index = begin; index < end; index++) {fs__read_lines_chunk(job, fs__claim_lines_chunk(job, index), th_data);}
+}
+
+// The function splits the file into chunks of about "chunk_size" bytes (0 - 4 MiB) at line boundaries, decodes the chunks
+// on all CPU cores and pushes every line (without "\n" or "\r\n") to "out_pipe" as a string, each chunk with one push.
+// If "is_ordered" is "true", the lines are pushed in the file order, otherwise chunks are pushed as soon as they are decoded.
+// The file is read at offsets, the position in the file is not used. The pipeline should be read by a worker
+// while the function runs, because the decoding threads wait when a bounded pipeline is full.
+// The function returns the number of pushed lines or the first error in the file order (invalid UTF-8 - with the offset of the line as data).
+// The lines of the chunk with the error are not pushed, in the ordered mode the lines after it are not pushed either,
+// so the output is exactly the lines of the chunks before the error.
+type fs__read_lines_parallel(void* file, uint64_t out_pipe, type chunk_size, type is_ordered, void* th_data) {
+    int const fd = fs__get_file_descriptor(file);
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {return error__create_utf8_message((type){.data = error__id_fail, .type = int__type_number}, (type){.data = errno, .type = int__type_number}, (const uint8_t*)"Failed to read the file");}
+    fs_lines_job job = {
+        .fd           = fd,
+        .file_size    = file_stat.st_size,
+        .chunk_size   = chunk_size.data != 0 ? chunk_size.data : fs__lines_default_chunk_size,
+        .out_pipe     = out_pipe,
+        .chunks         = NULL,
+        .next_chunk     = 0,
+        .claimed_chunks = 0,
+        .chunks_ahead   = (allow_threads ? cpu_cores_number : 1) * fs__lines_chunks_ahead_per_core,
+        .chunks_count   = 0,
+        .is_pushing     = false,
+        .lines_count    = 0,
+        .first_error    = 0,
+        .error_chunk    = UINT64_MAX
+    };
+    job.chunks_count = (job.file_size + job.chunk_size - 1) / job.chunk_size;
+    if (is_ordered.data) {
+        job.chunks = malloc((job.chunks_count + 1) * sizeof(fs_lines_chunk));
+        memset(job.chunks, 0, (job.chunks_count + 1) * sizeof(fs_lines_chunk));
+    }
+    mutex__init(&(job.mutex));
+    cond__init(&(job.has_room));
+    sched__parallel_for(0, job.chunks_count, 1, fs__read_lines_range, &job, th_data);
+    pthread_cond_destroy(&(job.has_room));
+    mutex__destroy(&(job.mutex));
+    free(job.chunks);
+    if (job.first_error != 0) {return (type){.data = job.first_error, .type = error__type_number};}
+    return (type){.data = job.lines_count, .type = int__type_number};
+}
+
+#define fs__text_map_threshold 1048576
+#define fs__text_buffer_size   65536
+
+// The function reads the whole file and decodes it from UTF-8 with one allocation of the string.
+// Large files are mapped instead of read, files of unknown size (pipes, "/proc") are read to the end.
+// If the file can't be read or is not valid UTF-8, then "nothing" is returned as a result.
+type fs__read_text(type file_name) {
+    char* const utf8_file_name = fs__path_to_utf8(file_name, 0);
+    int const fd = open(utf8_file_name, O_RDONLY | O_CLOEXEC);
+    fs__free_path(utf8_file_name, 0);
+    type result = (type){.data = 0, .type = nothing__type_number};
+    if (fd == -1) {return result;}
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || S_ISDIR(file_stat.st_mode)) {
+        close(fd);
+        return result;
+    }
+    if (S_ISREG(file_stat.st_mode) && file_stat.st_size >= fs__text_map_threshold) {
+        uint8_t* const data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+            result = string__utf8_to_utf32_n(data, file_stat.st_size);
+            munmap(data, file_stat.st_size);
+            close(fd);
+            return result;
+        }
+    }
+    uint64_t capacity = S_ISREG(file_stat.st_mode) && file_stat.st_size != 0 ? file_stat.st_size + 1 : fs__text_buffer_size;
+    uint8_t* buffer = malloc(capacity);
+    uint64_t length = 0;
+    for (;;) {
+        if (length == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+        int64_t const count = read(fd, &(buffer[length]), capacity - length);
+        if (count == -1 && errno == EINTR) {continue;}
+        if (count == -1) {
+            length = UINT64_MAX;
+            break;
+        }
+        if (count == 0) {break;}
+        length += count;
+    }
+    close(fd);
+    if (length != UINT64_MAX) {result = string__utf8_to_utf32_n(buffer, length);}
+    free(buffer);
+    return result;
+}
+
+static bool fs__write_all(int fd, const uint8_t* data, uint64_t length) {
+    while (length != 0) {
+        int64_t const count = write(fd, data, length);
+        if (count == -1 && errno == EINTR) {continue;}
+        if (count <= 0) {return false;}
+        data += count;
+        length -= count;
+    }
+    return true;
+}
+
+// The string is encoded directly into the write buffer, a small string is written from the stack.
+static bool fs__write_string(int fd, type string) {
+    uint64_t const string_length = ((const uint64_t*)string.data)[1];
+    const uint32_t* const chars = &(((const uint32_t*)string.data)[4]);
+    uint8_t stack_buffer[1024];
+    uint64_t const buffer_size = string_length * 4 <= sizeof(stack_buffer) ? sizeof(stack_buffer) : fs__text_buffer_size;
+    uint8_t* const buffer = buffer_size == sizeof(stack_buffer) ? stack_buffer : malloc(buffer_size);
+    uint64_t buffer_index = 0;
+    bool result = true;
+    for (uint64_t char_index = 0; char_index < string_length && result; char_index++) {
+        buffer_index += char__utf32_to_utf8(chars[char_index], &(buffer[buffer_index]));
+        if (buffer_index > buffer_size - 4) {
+            result = fs__write_all(fd, buffer, buffer_index);
+            buffer_index = 0;
+        }
+    }
+    if (result && buffer_index != 0) {result = fs__write_all(fd, buffer, buffer_index);}
+    if (buffer != stack_buffer) {free(buffer);}
+    return result;
+}
+
+static uint64_t fs__temp_name_counter = 0;
+
+// The function writes the string to the file as UTF-8, replacing its contents.
+// If "is_atomic" is "true", the text is written to a new file in the same directory, which is synced and renamed over
+// the old one, so readers see either the old or the new contents (the permissions of the old file are kept).
+// If the writing was successful, then the function returns "true", otherwise "false".
+type fs__write_text(type file_name, type string, type is_atomic) {
+    char* const utf8_file_name = fs__path_to_utf8(file_name, 0);
+    bool result = false;
+    if (!is_atomic.data) {
+        int const fd = open(utf8_file_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd != -1) {
+            result = fs__write_string(fd, string);
+            result = close(fd) == 0 && result;
+        }
+        fs__free_path(utf8_file_name, 0);
+        return (type){.data = result, .type = bool__type_numer};
+    }
+    uint64_t const file_name_length = strlen(utf8_file_name);
+    char* const temp_name = malloc(file_name_length + 48);
+    int fd;
+    do {
+        snprintf(temp_name, file_name_length + 48, "%s.%d.%" PRIu64 ".tmp", utf8_file_name, getpid(), __atomic_add_fetch(&fs__temp_name_counter, 1, __ATOMIC_RELAXED));
+        fd = open(temp_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    } while (fd == -1 && errno == EEXIST);
+    if (fd != -1) {
+        struct stat file_stat;
+        if (stat(utf8_file_name, &file_stat) == 0) {fchmod(fd, file_stat.st_mode & 07777);}
+        result = fs__write_string(fd, string) && fdatasync(fd) == 0;
+        result = close(fd) == 0 && result;
+        result = result && rename(temp_name, utf8_file_name) == 0;
+        if (!result) {unlink(temp_name);}
+    }
+    free(temp_name);
+    fs__free_path(utf8_file_name, 0);
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function tells the kernel how the file will be accessed ("posix_fadvise").
+// "length" equal to 0 means "to the end of the file".
+// Advices: 0 - normal, 1 - sequential, 2 - random, 3 - will need, 4 - don't need, 5 - no reuse.
+// If the advice was accepted, then the function returns "true", otherwise "false".
+type fs__advise_file(void* file, type offset, type length, type advice) {
+    static const int advices[] = {POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM, POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED, POSIX_FADV_NOREUSE};
+    if (advice.data >= sizeof(advices) / sizeof(advices[0])) {return (type){.data = false, .type = bool__type_numer};}
+    bool const result = posix_fadvise(fs__get_file_descriptor(file), offset.data, length.data, advices[advice.data]) == 0;
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function allocates disk space for the specified range of the file ("fallocate"), the file size grows if necessary.
+// If the space was allocated, then the function returns "true", otherwise "false".
+type fs__preallocate_file(void* file, type offset, type length) {
+    bool const result = fallocate(fs__get_file_descriptor(file), 0, offset.data, length.data) == 0;
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function flushes the buffer and waits until the data of the file is written to the disk ("fdatasync").
+// If the data was written, then the function returns "true", otherwise "false".
+type fs__sync_file_data(void* file) {
+    bool const flushed = fs__flush_file(file).data;
+    bool const result = flushed && fdatasync(fs__get_file_descriptor(file)) == 0;
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function renames the file.
+// If the renaming was successful, then the function returns "true", otherwise "false".
+type fs__file_rename(type old_file_name, type new_file_name) {
+    char* const utf8_old_file_name = fs__path_to_utf8(old_file_name, 0);
+    char* const utf8_new_file_name = fs__path_to_utf8(new_file_name, 1);
+    uint32_t const object_type = fs__get_object_type(utf8_old_file_name);
+    bool result =
+        object_type != 0 &&
+        (object_type & S_IFDIR) != S_IFDIR &&
+        fs__rename_no_replace(utf8_old_file_name, utf8_new_file_name);
+    fs__free_path(utf8_old_file_name, 0);
+    fs__free_path(utf8_new_file_name, 1);
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function renames the directory.
+// If the renaming was successful, then the function returns "true", otherwise "false".
+type fs__dir_rename(type old_dir_name, type new_dir_name) {
+    char* const utf8_old_dir_name = fs__path_to_utf8(old_dir_name, 0);
+    char* const utf8_new_dir_name = fs__path_to_utf8(new_dir_name, 1);
+    bool result =
+        (fs__get_object_type(utf8_old_dir_name) & S_IFDIR) == S_IFDIR &&
+        fs__rename_no_replace(utf8_old_dir_name, utf8_new_dir_name);
+    fs__free_path(utf8_old_dir_name, 0);
+    fs__free_path(utf8_new_dir_name, 1);
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function prepares data for parsing the contents of a directory.
+// If the function was unable to open the directory, then "nothing" is returned as a result.
+type fs__open_dir(type dir_name) {
+    char* const utf8_dir_name = fs__path_to_utf8(dir_name, 0);
+    DIR* dir = opendir(utf8_dir_name);
+    fs__free_path(utf8_dir_name, 0);
+    type result = (type){.data = 0, .type = nothing__type_number};
+    if (dir != NULL) {result = (type){.data = (uint64_t)dir, .type = int__type_number};}
+    return result;
+}
+
+// The function gets information about one of the objects from the directory.
+type fs__read_dir(type dir, type* object_type) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    global_lock();
+    for (;;) {
+        struct dirent* const dir_entry = readdir((DIR*)dir.data);
+        if (dir_entry == NULL) {break;}
+        char* const object_name = dir_entry->d_name;
+        const uint64_t object_name_length = strlen(object_name);
+        if (
+            object_name[0] == '.' &&
+            (object_name_length == 1 || (object_name_length == 2 && object_name[1] == '.'))
+        ) {continue;}
+        switch (dir_entry->d_type) {
+        case DT_BLK:
+            *object_type = (type){.data = 0, .type = int__type_number};
+            break;
+        case DT_CHR:
+            *object_type = (type){.data = 1, .type = int__type_number};
+            break;
+        case DT_DIR:
+            *object_type = (type){.data = 2, .type = int__type_number};
+            break;
+        case DT_FIFO:
+            *object_type = (type){.data = 3, .type = int__type_number};
+            break;
+        case DT_LNK:
+            *object_type = (type){.data = 4, .type = int__type_number};
+            break;
+        case DT_REG:
+            *object_type = (type){.data = 5, .type = int__type_number};
+            break;
+        case DT_SOCK:
+            *object_type = (type){.data = 6, .type = int__type_number};
+            break;
+        default:
+            *object_type = (type){.data = 255, .type = int__type_number};
+        }
+        result = string__utf8_to_utf32((const uint8_t*)object_name);
+        break;
+    }
+    global_unlock();
+    return result;
+}
+
+// The function stops parsing the contents of the directory.
+void fs__close_dir(type dir) {closedir((DIR*)dir.data);}
+
+// The function creates a directory and if it succeeds, it returns "true".
+// If the specified directory already exists and "ignore_existed_directory" is equal to "true", then the function returns "true".
+type fs__make_dir(type dir_name, type ignore_existed_directory) {
+    char* const utf8_dir_name = fs__path_to_utf8(dir_name, 0);
+    bool result =
+        mkdir(utf8_dir_name, S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO) == 0 ||
+        ((ignore_existed_directory.data & 1) == 1 && errno == EEXIST);
+    fs__free_path(utf8_dir_name, 0);
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function return the name of the directory used to store temporary files.
+type fs__get_tmp_dir_name() {return fs__tmp_dir_name;}
+
+static int fs__compare_names(const void* name1, const void* name2) {return strcmp(*(const char* const*)name1, *(const char* const*)name2);}
+
+__attribute__((cold)) static type fs__problem_solver(const char* destination, const char* source, type* problem_solver, type (problem_solver_func)(type*, type, type, uint64_t, uint32_t, void*, bool), type problem_code, void* th_data) {
+    type destination_utf32 = string__utf8_to_utf32((uint8_t*)destination);
+    type source_utf32 = string__utf8_to_utf32((uint8_t*)source);
+    type const result = problem_solver_func(problem_solver, destination_utf32, source_utf32, problem_code.data, problem_code.type, th_data, false);
+    shar__rc_free(destination_utf32, th_data, false);
+    shar__rc_free(source_utf32, th_data, false);
+    return result;
+}
+
+static type fs__copy_link_utf8(const char* destination, const char* source, uint8_t** buffer, type* problem_solver, type (problem_solver_func)(type*, type, type, uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), void* th_data) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    if (*buffer == NULL) {*buffer = malloc(file_buffer_size);}
+    uint64_t readed_len;
+    for (;;) {
+        readed_len = readlink(source, (char*)(*buffer), file_buffer_size);
+        if (readed_len == -1) {
+            result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__read_link, th_data, false), th_data);
+            if (result.type == error__type_number) {return result;}
+        } else {
+            (*buffer)[readed_len] = 0;
+            if (symlink((char*)(*buffer), destination) == 0) {break;}
+            result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__create_symlink, th_data, false), th_data);
+            break;
+        }
+    }
+    return result;
+}
+
+static type fs__copy_file_utf8(const char* destination, const char* source, struct stat file_stat, int dest_open_flags, int* pipefd, bool* allow_splice, uint8_t** buffer, type* problem_solver, type (problem_solver_func)(type*, type, type, uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), void* th_data) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    int src_fd;
+    int dest_fd;
+    src_fd = open(source, O_RDONLY);
+    if (src_fd == -1) {
+        result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__open_file, th_data, false), th_data);
+        return result;
+    }
+    dest_fd = open(destination, dest_open_flags, file_stat.st_mode & ~S_IFMT);
+    if (dest_fd == -1) {
+        close(src_fd);
+        result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__create_file, th_data, false), th_data);
+        return result;
+    }
+    if (*allow_splice) {
+        for (;;) {
+            uint64_t const readed_bytes_len = splice(src_fd, NULL, pipefd[1], NULL, file_buffer_size, SPLICE_F_MOVE);
+            if (readed_bytes_len == 0) {break;}
+            if (__builtin_expect(readed_bytes_len == -1, false)) {
+                *allow_splice = false;
+                if (*buffer == NULL) {*buffer = malloc(file_buffer_size);}
+                break;
+            }
+            uint64_t const writed_bytes_len = splice(pipefd[0], NULL, dest_fd, NULL, file_buffer_size, SPLICE_F_MOVE);
+            if (__builtin_expect(readed_bytes_len != writed_bytes_len, false)) {
+                *allow_splice = false;
+                if (*buffer == NULL) {*buffer = malloc(file_buffer_size);}
+                break;
+            }
+        }
+    }
+    if (!*allow_splice) {
+        for (;;) {
+            uint64_t const readed_bytes_len = read(src_fd, *buffer, file_buffer_size);
+            if (readed_bytes_len == 0) {break;}
+            if (readed_bytes_len == -1) {
+                close(src_fd);
+                close(dest_fd);
+                result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__read_from_file, th_data, false), th_data);
+                return result;
+            }
+            uint64_t const writed_bytes_len = write(dest_fd, *buffer, readed_bytes_len);
+            if (writed_bytes_len != readed_bytes_len) {
+                close(src_fd);
+                close(dest_fd);
+                result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__write_to_file, th_data, false), th_data);
+                return result;
+            }
+        }
+    }
+    close(src_fd);
+    close(dest_fd);
+    chmod(destination, file_stat.st_mode & ~S_IFMT);
+    chown(destination, file_stat.st_uid, file_stat.st_gid);
+    return result;
+}
+
+static type fs__copy_dir_utf8(const char* destination, const char* source, struct stat dir_stat, int* pipefd, bool* allow_splice, uint8_t** buffer, type* problem_solver, type (problem_solver_func)(type*, type, type, uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), void* th_data) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    if (mkdir(destination, S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO) == 0) {
+        chmod(destination, dir_stat.st_mode & ~S_IFMT);
+        chown(destination, dir_stat.st_uid, dir_stat.st_gid);
+    } else {
+        result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__make_dir, th_data, false), th_data);
+        if (result.type == error__type_number) {return result;}
+    }
+    uint64_t dirs_count = 0;
+    char** dest_dirs_list = NULL;
+    char** src_dirs_list = NULL;
+    {
+        DIR* dir;
+        for (;;) {
+            dir = opendir(source);
+            if (dir != NULL) {break;}
+            result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__open_dir, th_data, false), th_data);
+            if (result.type == error__type_number) {return result;}
+        }
+        trace__event('B', "fs__copy dir");
+        uint64_t const dest_length = strlen(destination);
+        uint64_t const src_length = strlen(source);
+        for (;;) {
+            global_lock();
+            struct dirent* const dir_entry = readdir(dir);
+            if (dir_entry == NULL) {
+                global_unlock();
+                break;
+            }
+            char* const object_name = dir_entry->d_name;
+            uint64_t const object_name_length = strlen(object_name);
+            typeof(dir_entry->d_type) object_type = dir_entry->d_type;
+            global_unlock();
+            if (
+                object_name[0] == '.' &&
+                (object_name_length == 1 || (object_name_length == 2 && object_name[1] == '.'))
+            ) {continue;}
+            char* dest_full_name = malloc(dest_length + object_name_length + 2);
+            strcpy(dest_full_name, destination);
+            dest_full_name[dest_length] = '/';
+            dest_full_name[dest_length + 1] = 0;
+            strcat(dest_full_name, object_name);
+            char* src_full_name = malloc(src_length + object_name_length + 2);
+            strcpy(src_full_name, source);
+            src_full_name[src_length] = '/';
+            src_full_name[src_length + 1] = 0;
+            strcat(src_full_name, object_name);
+            switch (object_type) {
+            case DT_DIR:{
+                dest_dirs_list = realloc(dest_dirs_list, (dirs_count + 1) * sizeof(char*));
+                src_dirs_list = realloc(src_dirs_list, (dirs_count + 1) * sizeof(char*));
+                dest_dirs_list[dirs_count] = dest_full_name;
+                src_dirs_list[dirs_count] = src_full_name;
+                dirs_count++;
+                break;}
+            case DT_LNK:{
+                result = fs__copy_link_utf8(dest_full_name, src_full_name, buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
+                free(dest_full_name);
+                free(src_full_name);
+                if (result.type == error__type_number) {goto endloop;}
+                break;}
+            default:{
+                struct stat file_stat;
+                lstat(src_full_name, &file_stat);
+                trace__event('B', "fs__copy file");
+                result = fs__copy_file_utf8(dest_full_name, src_full_name, file_stat, O_CREAT | O_EXCL | O_WRONLY, pipefd, allow_splice, buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
+                trace__event('E', NULL);
+                free(dest_full_name);
+                free(src_full_name);
+                if (result.type == error__type_number) {goto endloop;}}
+            }
+        }
+        endloop:
+        closedir(dir);
+        trace__event('E', NULL);
+    }
+    for (; dirs_count != 0; dirs_count--) {
+        if (result.type == nothing__type_number) {
+            struct stat dir_stat;
+            lstat(src_dirs_list[dirs_count - 1], &dir_stat);
+            result = fs__copy_dir_utf8(dest_dirs_list[dirs_count - 1], src_dirs_list[dirs_count - 1], dir_stat, pipefd, allow_splice, buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
+        }
+        free(dest_dirs_list[dirs_count - 1]);
+        free(src_dirs_list[dirs_count - 1]);
+    }
+    if (dest_dirs_list != NULL) {
+        free(dest_dirs_list);
+        free(src_dirs_list);
+    }
+    return result;
+}
+
+// The function copies a file system object.
+// If a problem occurs during copying, then control is transferred to the problem solver, if the solver solved the problem, the function continues its work.
+type fs__copy(type destination, type source, type* problem_solver, type (problem_solver_func)(type*, type, type, /*type -> uint64_t, uint32_t (because of a clang bug)*/ uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), void* th_data) {
+    bool allow_splice = true;
+    uint8_t* buffer = NULL;
+    struct stat fso_stat;
+    int pipefd[2];
+    if (__builtin_expect(pipe(pipefd) != 0, false)) {
+        fprintf(stderr, "Failed to create a one-way communication channel (pipe).\n");
+        exit(EXIT_FAILURE);
+    }
+    type result = (type){.data = 0, .type = nothing__type_number};
+    trace__event('B', "fs__copy");
+    char* source_utf8 = (char*)string__utf32_to_utf8(source);
+    for (;;) {
+        if (stat(source_utf8, &fso_stat) == 0 || lstat(source_utf8, &fso_stat) == 0) {break;}
+        result = problem_solver_func(problem_solver, destination, source, int_to_cptype(fs__copy__problem__stat, th_data, false).data, int__type_number, th_data, false);
+        if (result.type == error__type_number) {
+            free(source_utf8);
+            close(pipefd[0]);
+            close(pipefd[1]);
+            trace__event('E', NULL);
+            return result;
+        }
+    }
+    char* const destination_utf8 = (char*)string__utf32_to_utf8(destination);
+    if ((fso_stat.st_mode & S_IFDIR) == S_IFDIR) {
+        result = fs__copy_dir_utf8(destination_utf8, source_utf8, fso_stat, pipefd, &allow_splice, &buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
+    } else if ((fso_stat.st_mode & S_IFLNK) == S_IFLNK) {
+        result = fs__copy_link_utf8(destination_utf8, source_utf8, &buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
+    } else {
+        trace__event('B', "fs__copy file");
+        result = fs__copy_file_utf8(destination_utf8, source_utf8, fso_stat, O_CREAT | O_EXCL | O_WRONLY, pipefd, &allow_splice, &buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
+        trace__event('E', NULL);
+    }
+    free(destination_utf8);
+    free(source_utf8);
+    if (buffer != NULL) {free(buffer);}
+    close(pipefd[0]);
+    close(pipefd[1]);
+    trace__event('E', NULL);
+    return result;
+}
+
+// The state shared by all steps of one synchronization.
+struct {
+    uint64_t options;
+    int*     pipefd;
+    bool*    allow_splice;
+    uint8_t** buffer;
+    uint8_t* compare_buffer;
+    uint64_t temp_files_count;
+    type*    problem_solver;
+    type     (*problem_solver_func)(type*, type, type, uint64_t, uint32_t, void*, bool);
+    type     (*int_to_cptype)(type, void*, bool);
+    void*    th_data;
+} typedef fs__sync_context;
+
+static char* fs__join_path(const char* dir_name, const char* object_name) {
+    uint64_t const dir_name_length = strlen(dir_name);
+    uint64_t const object_name_length = strlen(object_name);
+    char* const result = malloc(dir_name_length + object_name_length + 2);
+    memcpy(result, dir_name, dir_name_length);
+    result[dir_name_length] = '/';
+    memcpy(&(result[dir_name_length + 1]), object_name, object_name_length + 1);
+    return result;
+}
+
+// The function returns the names of the objects of the directory (without "." and ".."), sorted with "strcmp".
+// If the directory can't be opened, then "NULL" is returned as a result.
+static char** fs__read_dir_names_utf8(const char* dir_name, uint64_t* names_count) {
+    DIR* const dir = opendir(dir_name);
+    if (dir == NULL) {return NULL;}
+    char** names = malloc(sizeof(char*));
+    uint64_t count = 0;
+    for (;;) {
+        global_lock();
+        struct dirent* const dir_entry = readdir(dir);
+        if (dir_entry == NULL) {
+            global_unlock();
+            break;
+        }
+        char* const object_name = dir_entry->d_name;
+        uint64_t const object_name_length = strlen(object_name);
+        if (
+            object_name[0] == '.' &&
+            (object_name_length == 1 || (object_name_length == 2 && object_name[1] == '.'))
+        ) {
+            global_unlock();
+            continue;
+        }
+        names = realloc(names, (count + 1) * sizeof(char*));
+        names[count] = malloc(object_name_length + 1);
+        memcpy(names[count], object_name, object_name_length + 1);
+        count++;
+        global_unlock();
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char*), fs__compare_names);
+    *names_count = count;
+    return names;
+}
+
+static void fs__free_names(char** names, uint64_t names_count) {
+    for (uint64_t index = 0; index < names_count; index++) {free(names[index]);}
+    free(names);
+}
+
+// The function deletes a file system object (recursively), a problem is reported with the "delete" code.
+static type fs__sync_remove_utf8(const char* destination, const char* source, fs__sync_context* context) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    struct stat fso_stat;
+    if (lstat(destination, &fso_stat) == 0 && S_ISDIR(fso_stat.st_mode)) {
+        uint64_t names_count = 0;
+        char** const names = fs__read_dir_names_utf8(destination, &names_count);
+        if (names != NULL) {
+            for (uint64_t index = 0; index < names_count && result.type != error__type_number; index++) {
+                char* const full_name = fs__join_path(destination, names[index]);
+                result = fs__sync_remove_utf8(full_name, source, context);
+                free(full_name);
+            }
+            fs__free_names(names, names_count);
+            if (result.type == error__type_number) {return result;}
+        }
+    }
+    if (remove(destination) != 0 && errno != ENOENT) {
+        result = fs__problem_solver(destination, source, context->problem_solver, context->problem_solver_func, context->int_to_cptype(fs__copy__problem__delete, context->th_data, false), context->th_data);
+    }
+    return result;
+}
+
+// If the contents of the files are equal, the function returns "true", otherwise "false".
+static bool fs__files_are_equal_utf8(const char* file_name1, const char* file_name2, fs__sync_context* context) {
+    int const fd1 = open(file_name1, O_RDONLY | O_CLOEXEC);
+    if (fd1 == -1) {return false;}
+    int const fd2 = open(file_name2, O_RDONLY | O_CLOEXEC);
+    if (fd2 == -1) {
+        close(fd1);
+        return false;
+    }
+    posix_fadvise(fd1, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd2, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (context->compare_buffer == NULL) {context->compare_buffer = malloc(2 * file_buffer_size);}
+    uint8_t* const buffer1 = context->compare_buffer;
+    uint8_t* const buffer2 = &(context->compare_buffer[file_buffer_size]);
+    bool result = true;
+    for (uint64_t offset = 0; result;) {
+        int64_t const length1 = pread(fd1, buffer1, file_buffer_size, offset);
+        if (length1 == 0) {break;}
+        int64_t const length2 = length1 > 0 ? pread(fd2, buffer2, length1, offset) : -1;
+        result = length1 > 0 && length1 == length2 && memcmp(buffer1, buffer2, length1) == 0;
+        offset += length1;
+    }
+    close(fd1);
+    close(fd2);
+    return result;
+}
+
+static type fs__sync_file_utf8(const char* destination, const char* source, struct stat src_stat, bool dest_exists, struct stat dest_stat, fs__sync_context* context) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    if (dest_exists && S_ISREG(dest_stat.st_mode) && S_ISREG(src_stat.st_mode) && dest_stat.st_size == src_stat.st_size) {
+        if (dest_stat.st_mtim.tv_sec == src_stat.st_mtim.tv_sec && dest_stat.st_mtim.tv_nsec == src_stat.st_mtim.tv_nsec) {return result;}
+        if ((context->options & fs__sync__compare_content) != 0 && fs__files_are_equal_utf8(destination, source, context)) {
+            struct timespec const times[2] = {src_stat.st_atim, src_stat.st_mtim};
+            utimensat(AT_FDCWD, destination, times, AT_SYMLINK_NOFOLLOW);
+            return result;
+        }
+    }
+    bool const via_rename = (context->options & fs__sync__replace_via_rename) != 0;
+    // An object of another type is deleted, a regular file is truncated (in place) or replaced (via rename).
+    if (dest_exists && !S_ISREG(dest_stat.st_mode)) {
+        result = fs__sync_remove_utf8(destination, source, context);
+        if (result.type == error__type_number) {return result;}
+    }
+    char* temp_name = NULL;
+    if (via_rename) {
+        uint64_t const destination_length = strlen(destination);
+        temp_name = malloc(destination_length + 64);
+        snprintf(temp_name, destination_length + 64, "%s.shar-sync-%d-%" PRIu64, destination, (int)getpid(), context->temp_files_count++);
+    }
+    const char* const target = via_rename ? temp_name : destination;
+    int const open_flags = via_rename ? O_CREAT | O_EXCL | O_WRONLY : O_CREAT | O_TRUNC | O_WRONLY;
+    result = fs__copy_file_utf8(target, source, src_stat, open_flags, context->pipefd, context->allow_splice, context->buffer, context->problem_solver, context->problem_solver_func, context->int_to_cptype, context->th_data);
+    if (result.type == nothing__type_number) {
+        struct timespec const times[2] = {src_stat.st_atim, src_stat.st_mtim};
+        utimensat(AT_FDCWD, target, times, AT_SYMLINK_NOFOLLOW);
+        if (via_rename && rename(temp_name, destination) != 0) {
+            unlink(temp_name);
+            result = fs__problem_solver(destination, source, context->problem_solver, context->problem_solver_func, context->int_to_cptype(fs__copy__problem__rename, context->th_data, false), context->th_data);
+        }
+    } else if (via_rename) {unlink(temp_name);}
+    if (temp_name != NULL) {free(temp_name);}
+    return result;
+}
+
+static type fs__sync_link_utf8(const char* destination, const char* source, bool dest_exists, struct stat dest_stat, fs__sync_context* context) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    if (dest_exists) {
+        if (S_ISLNK(dest_stat.st_mode)) {
+            char src_target[4096];
+            char dest_target[4096];
+            int64_t const src_length = readlink(source, src_target, sizeof(src_target));
+            int64_t const dest_length = readlink(destination, dest_target, sizeof(dest_target));
+            if (src_length != -1 && src_length == dest_length && memcmp(src_target, dest_target, src_length) == 0) {return result;}
+        }
+        result = fs__sync_remove_utf8(destination, source, context);
+        if (result.type == error__type_number) {return result;}
+    }
+    return fs__copy_link_utf8(destination, source, context->buffer, context->problem_solver, context->problem_solver_func, context->int_to_cptype, context->th_data);
+}
+
+static type fs__sync_object_utf8(const char* destination, const char* source, struct stat src_stat, fs__sync_context* context);
+
+static type fs__sync_dir_utf8(const char* destination, const char* source, struct stat src_stat, bool dest_exists, struct stat dest_stat, fs__sync_context* context) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    if (dest_exists && !S_ISDIR(dest_stat.st_mode)) {
+        result = fs__sync_remove_utf8(destination, source, context);
+        if (result.type == error__type_number) {return result;}
+        dest_exists = false;
+    }
+    if (!dest_exists) {
+        if (mkdir(destination, S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO) == 0) {
+            chmod(destination, src_stat.st_mode & ~S_IFMT);
+            chown(destination, src_stat.st_uid, src_stat.st_gid);
+        } else {
+            result = fs__problem_solver(destination, source, context->problem_solver, context->problem_solver_func, context->int_to_cptype(fs__copy__problem__make_dir, context->th_data, false), context->th_data);
+            if (result.type == error__type_number) {return result;}
+        }
+    } else if ((dest_stat.st_mode & ~S_IFMT) != (src_stat.st_mode & ~S_IFMT)) {chmod(destination, src_stat.st_mode & ~S_IFMT);}
+    uint64_t src_names_count = 0;
+    char** src_names;
+    for (;;) {
+        src_names = fs__read_dir_names_utf8(source, &src_names_count);
+        if (src_names != NULL) {break;}
+        result = fs__problem_solver(destination, source, context->problem_solver, context->problem_solver_func, context->int_to_cptype(fs__copy__problem__open_dir, context->th_data, false), context->th_data);
+        if (result.type == error__type_number) {return result;}
+    }
+    trace__event('B', "fs__sync dir");
+    for (uint64_t index = 0; index < src_names_count && result.type != error__type_number; index++) {
+        char* const src_full_name = fs__join_path(source, src_names[index]);
+        char* const dest_full_name = fs__join_path(destination, src_names[index]);
+        struct stat child_stat;
+        if (lstat(src_full_name, &child_stat) == 0) {result = fs__sync_object_utf8(dest_full_name, src_full_name, child_stat, context);}
+        else {result = fs__problem_solver(dest_full_name, src_full_name, context->problem_solver, context->problem_solver_func, context->int_to_cptype(fs__copy__problem__stat, context->th_data, false), context->th_data);}
+        free(src_full_name);
+        free(dest_full_name);
+    }
+    if (result.type != error__type_number && (context->options & fs__sync__delete_extraneous) != 0) {
+        uint64_t dest_names_count = 0;
+        char** const dest_names = fs__read_dir_names_utf8(destination, &dest_names_count);
+        if (dest_names != NULL) {
+            for (uint64_t index = 0; index < dest_names_count && result.type != error__type_number; index++) {
+                if (bsearch(&(dest_names[index]), src_names, src_names_count, sizeof(char*), fs__compare_names) != NULL) {continue;}
+                char* const dest_full_name = fs__join_path(destination, dest_names[index]);
+                result = fs__sync_remove_utf8(dest_full_name, source, context);
+                free(dest_full_name);
+            }
+            fs__free_names(dest_names, dest_names_count);
+        }
+    }
+    trace__event('E', NULL);
+    fs__free_names(src_names, src_names_count);
+    return result;
+}
+
+static type fs__sync_object_utf8(const char* destination, const char* source, struct stat src_stat, fs__sync_context* context) {
+    struct stat dest_stat;
+    bool const dest_exists = lstat(destination, &dest_stat) == 0;
+    if (S_ISDIR(src_stat.st_mode)) {return fs__sync_dir_utf8(destination, source, src_stat, dest_exists, dest_stat, context);}
+    if (S_ISLNK(src_stat.st_mode)) {return fs__sync_link_utf8(destination, source, dest_exists, dest_stat, context);}
+    return fs__sync_file_utf8(destination, source, src_stat, dest_exists, dest_stat, context);
+}
+
+// The function makes the destination a copy of the source, copying only what has changed (like "rsync").
+// Files with the same size and modification time are skipped, the modification time is copied with the data.
+// Unlike "fs__copy", the destination may already exist.
+// Options (can be combined):
+// 1 - files with the same size but a different modification time are compared by content and are not copied if equal.
+// 2 - a changed file is copied to a temporary file next to it and then renamed, so readers never see a partial file.
+// 4 - objects of the destination that are not in the source are deleted.
+// If a problem occurs during synchronization, then control is transferred to the problem solver (the same as in "fs__copy"),
+// if the solver solved the problem, the function continues its work.
+type fs__sync(type destination, type source, type options, type* problem_solver, type (problem_solver_func)(type*, type, type, /*type -> uint64_t, uint32_t (because of a clang bug)*/ uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), void* th_data) {
+    bool allow_splice = true;
+    uint8_t* buffer = NULL;
+    int pipefd[2];
+    if (__builtin_expect(pipe(pipefd) != 0, false)) {
+        fprintf(stderr, "Failed to create a one-way communication channel (pipe).\n");
+        exit(EXIT_FAILURE);
+    }
+    fs__sync_context context = {
+        .options             = options.data,
+        .pipefd              = pipefd,
+        .allow_splice        = &allow_splice,
+        .buffer              = &buffer,
+        .compare_buffer      = NULL,
+        .temp_files_count    = 0,
+        .problem_solver      = problem_solver,
+        .problem_solver_func = problem_solver_func,
+        .int_to_cptype       = int_to_cptype,
+        .th_data             = th_data
+    };
+    type result = (type){.data = 0, .type = nothing__type_number};
+    trace__event('B', "fs__sync");
+    char* const source_utf8 = (char*)string__utf32_to_utf8(source);
+    char* const destination_utf8 = (char*)string__utf32_to_utf8(destination);
+    struct stat fso_stat;
+    for (;;) {
+        if (lstat(source_utf8, &fso_stat) == 0) {
+            result = fs__sync_object_utf8(destination_utf8, source_utf8, fso_stat, &context);
+            break;
+        }
+        result = problem_solver_func(problem_solver, destination, source, int_to_cptype(fs__copy__problem__stat, th_data, false).data, int__type_number, th_data, false);
+        if (result.type == error__type_number) {break;}
+    }
+    free(destination_utf8);
+    free(source_utf8);
+    if (buffer != NULL) {free(buffer);}
+    if (context.compare_buffer != NULL) {free(context.compare_buffer);}
+    close(pipefd[0]);
+    close(pipefd[1]);
+    trace__event('E', NULL);
+    return result;
+}
+
+__attribute__((cold)) static type fs__delete_problem_solver(const char* object, type* problem_solver, type (problem_solver_func)(type*, type, uint64_t, uint32_t, void*, bool), type problem_code, void* th_data) {
+    type object_utf32 = string__utf8_to_utf32((uint8_t*)object);
+    type const result = problem_solver_func(problem_solver, object_utf32, problem_code.data, problem_code.type, th_data, false);
+    shar__rc_free(object_utf32, th_data, false);
+    return result;
+}
+
+static type fs__delete_file_utf8(const char* file_name, type* problem_solver, type (problem_solver_func)(type*, type, uint64_t, uint32_t, void*, bool), type (int_to_dptype)(type, void*, bool), void* th_data) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    if (remove(file_name) != 0) {
+        result = fs__delete_problem_solver(file_name, problem_solver, problem_solver_func, int_to_dptype(fs__delete__problem__delete_file, th_data, false), th_data);
+    }
+    return result;
+}
+
+static type fs__delete_dir_utf8(const char* dir_name, type* problem_solver, type (problem_solver_func)(type*, type, uint64_t, uint32_t, void*, bool), type (int_to_dptype)(type, void*, bool), void* th_data) {
+    type result = (type){.data = 0, .type = nothing__type_number};
+    uint64_t sub_dirs_count = 0;
+    char** sub_dirs_list = NULL;
+    {
+        DIR* dir = opendir(dir_name);
+        if (dir == NULL) {
+            result = fs__delete_problem_solver(dir_name, problem_solver, problem_solver_func, int_to_dptype(fs__delete__problem__open_dir, th_data, false), th_data);
+            return result;
+        }
+        trace__event('B', "fs__delete dir");
+        uint64_t const dir_name_length = strlen(dir_name);
+        for (;;) {
+            global_lock();
+            struct dirent* const dir_entry = readdir(dir);
+            if (dir_entry == NULL) {
+                global_unlock();
+                break;
+            }
+            char* const object_name = dir_entry->d_name;
+            uint64_t const object_name_length = strlen(object_name);
+            typeof(dir_entry->d_type) object_type = dir_entry->d_type;
+            global_unlock();
+            if (
+                object_name[0] == '.' &&
+                (object_name_length == 1 || (object_name_length == 2 && object_name[1] == '.'))
+            ) {continue;}
+            char* obj_full_name = malloc(dir_name_length + object_name_length + 2);
+            strcpy(obj_full_name, dir_name);
+            obj_full_name[dir_name_length] = '/';
+            obj_full_name[dir_name_length + 1] = 0;
+            strcat(obj_full_name, object_name);
+            if (object_type == DT_DIR) {
+                sub_dirs_list = realloc(sub_dirs_list, (sub_dirs_count + 1) * sizeof(char*));
+                sub_dirs_list[sub_dirs_count] = obj_full_name;
+                sub_dirs_count++;
+            } else {
+                result = fs__delete_file_utf8(obj_full_name, problem_solver, problem_solver_func, int_to_dptype, th_data);
+                free(obj_full_name);
+                if (result.type == error__type_number) {break;}
+            }
+        }
+        closedir(dir);
+        trace__event('E', NULL);
+    }
+    for (; sub_dirs_count != 0; sub_dirs_count--) {
+        if (result.type == nothing__type_number) {
+            result = fs__delete_dir_utf8(sub_dirs_list[sub_dirs_count - 1], problem_solver, problem_solver_func, int_to_dptype, th_data);
+        }
+        free(sub_dirs_list[sub_dirs_count - 1]);
+    }
+    if (sub_dirs_list != NULL) {free(sub_dirs_list);}
+    if (remove(dir_name) != 0) {
+        result = fs__delete_problem_solver(dir_name, problem_solver, problem_solver_func, int_to_dptype(fs__delete__problem__delete_empty_dir, th_data, false), th_data);
+    }
+    return result;
+}
+
+// The function delete a file system object.
+// If a problem occurs during deleting, then control is transferred to the problem solver, if the solver solved the problem, the function continues its work.
+type fs__delete(type object, type* problem_solver, type (problem_solver_func)(type*, type, /*type -> uint64_t, uint32_t (because of a clang bug)*/ uint64_t, uint32_t, void*, bool), type (int_to_dptype)(type, void*, bool), void* th_data) {
+    struct stat fso_stat;
+    type result = (type){.data = 0, .type = nothing__type_number};
+    char* object_utf8 = (char*)string__utf32_to_utf8(object);
+    if (lstat(object_utf8, &fso_stat) != 0) {
+        result = problem_solver_func(problem_solver, object, int_to_dptype(fs__delete__problem__stat, th_data, false).data, int__type_number, th_data, false);
+        free(object_utf8);
+        return result;
+    }
+    trace__event('B', "fs__delete");
+    if ((fso_stat.st_mode & S_IFDIR) == S_IFDIR) {
+        result = fs__delete_dir_utf8(object_utf8, problem_solver, problem_solver_func, int_to_dptype, th_data);
+    } else {
+        result = fs__delete_file_utf8(object_utf8, problem_solver, problem_solver_func, int_to_dptype, th_data);
+    }
+    trace__event('E', NULL);
+    free(object_utf8);
+    return result;
+}
+
+// The function move a file system object.
+// The function at the beginning tries to move the object without copying, if it doesn't work, it copies, and then the original object is deleted.
+type fs__move(type destination, type source, type* copy_problem_solver, type (copy_problem_solver_func)(type*, type, type, /*type -> uint64_t, uint32_t (because of a clang bug)*/ uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), type* delete_problem_solver, type (delete_problem_solver_func)(type*, type, /*type -> uint64_t, uint32_t (because of a clang bug)*/ uint64_t, uint32_t, void*, bool), type (int_to_dptype)(type, void*, bool), void* th_data) {
+    bool rename_ok = true;
+    {
+        char* source_utf8 = (char*)string__utf32_to_utf8(source);
+        char* const destination_utf8 = (char*)string__utf32_to_utf8(destination);
+        struct stat fso_stat;
+        rename_ok =
+            lstat(source_utf8, &fso_stat) == 0 &&
+            lstat(destination_utf8, &fso_stat) != 0 &&
+            rename(source_utf8, destination_utf8) == 0;
+        free(source_utf8);
+        free(destination_utf8);
+    }
+    type result = (type){.data = 0, .type = nothing__type_number};
+    if (!rename_ok){
+        result = fs__copy(destination, source, copy_problem_solver, copy_problem_solver_func, int_to_cptype, th_data);
+        if (result.type == nothing__type_number){
+            result = fs__delete(source, delete_problem_solver, delete_problem_solver_func, int_to_dptype, th_data);
+        }
+    }
+    return result;
+}
+
+type fs__read_symlink(type link) {
+    char* const link_utf8 = fs__path_to_utf8(link, 0);
+    uint8_t stack_buffer[256];
+    uint8_t* heap_buffer = NULL;
+    uint8_t* buffer = stack_buffer;
+    uint64_t buffer_size = 256;
+    type result = (type){.data = 0, .type = nothing__type_number};
+    for (;;) {
+        uint64_t const readed_bytes_len = readlink(link_utf8, (char*)(buffer), buffer_size);
+        if (readed_bytes_len == -1) {break;}
+        if (readed_bytes_len < buffer_size) {
+            buffer[readed_bytes_len] = 0;
+            result = string__utf8_to_utf32(buffer);
+            break;
+        }
+        buffer_size *= 2;
+        heap_buffer = realloc(heap_buffer, buffer_size);
+        buffer = heap_buffer;
+    }
+    fs__free_path(link_utf8, 0);
+    if (heap_buffer != NULL) {free(heap_buffer);}
+    return result;
+}
+
+type fs__create_symlink(type link_path, type src_object) {
+    char* const link_path_utf8 = fs__path_to_utf8(link_path, 0);
+    char* const src_object_utf8 = fs__path_to_utf8(src_object, 1);
+    type result = (type){.data = 1 + symlink(src_object_utf8, link_path_utf8), .type = bool__type_numer};
+    fs__free_path(link_path_utf8, 0);
+    fs__free_path(src_object_utf8, 1);
+    return result;
+}
+
+// The function copies attributes from one file system object to another.
+// The objects must be of the same type (file, directory, etc.).
+// The function returns "true" if successful, otherwise "false".
+type fs__copy_attributes(type destination, type source) {
+    type result = (type) {.data = 0, .type = bool__type_numer};
+    char* const destination_utf8 = fs__path_to_utf8(destination, 0);
+    char* const source_utf8 = fs__path_to_utf8(source, 1);
+    struct stat dest_stat;
+    struct stat src_stat;
+    if (
+        (stat(destination_utf8, &dest_stat) == 0) &&
+        (stat(source_utf8, &src_stat) == 0) &&
+        ((dest_stat.st_mode & S_IFMT) == (src_stat.st_mode & S_IFMT)) &&
+        ((chmod(destination_utf8, src_stat.st_mode & ~S_IFMT) | chown(destination_utf8, src_stat.st_uid, src_stat.st_gid)) == 0)
+    ) {result = (type) {.data = 1, .type = bool__type_numer};}
+    fs__free_path(destination_utf8, 0);
+    fs__free_path(source_utf8, 1);
+    return result;
+}
+
+#undef alloc__category
+#pragma endregion FS
+
+#pragma region Net
+#define alloc__category alloc__category__net
+
+#define net__kind_listener 0
+#define net__kind_stream   1
+#define net__kind_datagram 2
+#define net__kind_pipe_in  3
+#define net__kind_pipe_out 4
+#define net__kind_watch    5
+
+#define net__batch_size         64
+#define net__receive_batch_size 16
+#define net__receive_size       65536
+#define net__in_capacity        64
+#define net__stall_retry_ms     1
+
+// A change of a watched tree waiting for the end of the debounce interval (code 0 - the change has cancelled itself).
+struct {
+    char*    path;
+    uint64_t hash;
+    char     code;
+} typedef fs_watch_event;
+
+// The state of "fs__watch", the paths of the watched directories are indexed by watch descriptors.
+struct {
+    char*              root;
+    int                root_wd;
+    uint32_t           mask;
+    uint32_t           events;
+    bool               is_recursive;
+    char**             paths;
+    uint64_t           paths_capacity;
+    fs_watch_event*    pending;
+    uint64_t           pending_count;
+    uint64_t           pending_capacity;
+    uint32_t*          pending_index;
+    uint64_t           pending_index_capacity;
+    uint64_t           first_event_time;
+    uint64_t           last_event_time;
+    struct net_socket* next_pending;
+} typedef fs_watch;
+
+// A socket served by the event loop thread. Only the loop changes it after registration,
+// the "in_pipe" and "out_pipe" fields are constant, so any thread can read them.
+struct net_socket {
+    int                fd;
+    int                out_event_fd;
+    uint8_t            kind;
+    bool               is_connecting;
+    bool               is_read_closed;
+    bool               is_closing;
+    bool               is_finished;
+    bool               is_released;
+    bool               out_is_paused;
+    bool               in_is_paused;
+    uint64_t           in_pipe;
+    uint64_t           out_pipe;
+    type               pending[net__batch_size];
+    uint64_t           pending_count;
+    uint64_t           pending_offset;
+    type*              stalled;
+    uint64_t           stalled_count;
+    uint64_t           stalled_capacity;
+    fs_watch*          watch;
+    struct net_socket* next;
+    struct net_socket* next_stalled;
+} typedef net_socket;
+
+static pthread_once_t net__loop_once = PTHREAD_ONCE_INIT;
+static int net__epoll_fd = -1;
+static int net__control_fd = -1;
+static net_socket* net__close_requests = NULL;
+static net_socket* net__released_sockets = NULL;
+static net_socket* net__stalled_sockets = NULL;
+
+// Children of freed processes that were still running, the loop reaps them, so they don't stay zombies.
+#define net__reap_interval_ns 100000000
+static pthread_mutex_t net__orphans_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pid_t* net__orphans = NULL;
+static uint64_t net__orphans_count = 0;
+static uint64_t net__orphans_capacity = 0;
+static uint64_t net__next_reap_time = 0;
+static uint8_t* net__receive_buffer = NULL;
+static thread_data* net__th_data = NULL;
+
+__attribute__((cold)) static type net__error(const char* action, int error_number) {
+    char message[256];
+    char error_description[128];
+    snprintf(message, sizeof(message), "%s: %s", action, strerror_r(error_number, error_description, sizeof(error_description)));
+    return error__create_utf8_message((type){.data = error__id_fail, .type = int__type_number}, (type){.data = error_number, .type = int__type_number}, (const uint8_t*)message);
+}
+
+// The watches with pending events, the loop wakes up when the first of them must be flushed.
+static net_socket* net__pending_watches = NULL;
+
+static void fs__watch_unlink_pending(net_socket* socket_ptr) {
+    net_socket** link = &net__pending_watches;
+    while (*link != socket_ptr) {link = &((*link)->watch->next_pending);}
+    *link = socket_ptr->watch->next_pending;
+}
+
+static void fs__watch_free(net_socket* socket_ptr) {
+    fs_watch* const watch = socket_ptr->watch;
+    if (watch->pending_count != 0) {fs__watch_unlink_pending(socket_ptr);}
+    for (uint64_t index = 0; index < watch->pending_count; index++) {free(watch->pending[index].path);}
+    for (uint64_t index = 0; index < watch->paths_capacity; index++) {free(watch->paths[index]);}
+    free(watch->pending);
+    free(watch->pending_index);
+    free(watch->paths);
+    free(watch->root);
+    free(watch);
+    socket_ptr->watch = NULL;
+}
+
+static inline void net__watch(net_socket* socket_ptr, int fd, uint32_t events, uint64_t tag, int operation) {
+    struct epoll_event event = {.events = events, .data.u64 = (uint64_t)socket_ptr | tag};
+    epoll_ctl(net__epoll_fd, operation, fd, &event);
+}
+
+// While the in pipeline is full, the descriptor is watched only once ("EPOLLONESHOT"), so a hang-up doesn't wake the loop again and again.
+static void net__watch_fd(net_socket* socket_ptr) {
+    bool const watch_in = !socket_ptr->is_read_closed && socket_ptr->kind != net__kind_pipe_out && !socket_ptr->in_is_paused;
+    uint32_t const events = (watch_in ? EPOLLIN : 0) | (socket_ptr->out_is_paused ? EPOLLOUT : 0) | (socket_ptr->in_is_paused ? EPOLLONESHOT : 0);
+    net__watch(socket_ptr, socket_ptr->fd, events, 0, EPOLL_CTL_MOD);
+}
+
+static void net__pause_in(net_socket* socket_ptr, bool paused) {
+    socket_ptr->in_is_paused = paused;
+    if (!socket_ptr->is_finished && !socket_ptr->is_connecting) {net__watch_fd(socket_ptr);}
+}
+
+static void net__unlink_stalled(net_socket* socket_ptr) {
+    net_socket** link = &net__stalled_sockets;
+    while (*link != socket_ptr) {link = &((*link)->next_stalled);}
+    *link = socket_ptr->next_stalled;
+}
+
+// The loop never waits for a full in pipeline: an item that doesn't fit is kept with the socket,
+// and the socket is not read until the kept items are delivered (see "net__retry_stalled").
+static void net__deliver(net_socket* socket_ptr, type item) {
+    if (socket_ptr->stalled_count == 0 && pipeline__try_push(socket_ptr->in_pipe, item).data) {return;}
+    if (socket_ptr->is_finished) {
+        pipeline__push_over(socket_ptr->in_pipe, item);
+        return;
     }
-    uint64_t dirs_count = 0;
-    char** dest_dirs_list = NULL;
-    char** src_dirs_list = NULL;
-    {
-        DIR* dir;
-        for (;;) {
-            dir = opendir(source);
-            if (dir != NULL) {break;}
-            result = fs__problem_solver(destination, source, problem_solver, problem_solver_func, int_to_cptype(fs__copy__problem__open_dir, th_data, false), th_data);
-            if (result.type == error__type_number) {return result;}
+    if (socket_ptr->stalled_count == socket_ptr->stalled_capacity) {
+        socket_ptr->stalled_capacity = socket_ptr->stalled_capacity == 0 ? net__receive_batch_size : socket_ptr->stalled_capacity * 2;
+        socket_ptr->stalled = realloc(socket_ptr->stalled, socket_ptr->stalled_capacity * sizeof(type));
+    }
+    socket_ptr->stalled[socket_ptr->stalled_count] = item;
+    socket_ptr->stalled_count++;
+    if (socket_ptr->stalled_count == 1) {
+        socket_ptr->next_stalled = net__stalled_sockets;
+        net__stalled_sockets = socket_ptr;
+        net__pause_in(socket_ptr, true);
+    }
+}
+
+// The kept items are pushed in order, a socket whose items are all delivered is read again.
+static void net__retry_stalled() {
+    net_socket** link = &net__stalled_sockets;
+    while (*link != NULL) {
+        net_socket* const socket_ptr = *link;
+        uint64_t delivered = 0;
+        while (delivered < socket_ptr->stalled_count && pipeline__try_push(socket_ptr->in_pipe, socket_ptr->stalled[delivered]).data) {delivered++;}
+        socket_ptr->stalled_count -= delivered;
+        memmove(socket_ptr->stalled, &(socket_ptr->stalled[delivered]), socket_ptr->stalled_count * sizeof(type));
+        if (socket_ptr->stalled_count != 0) {
+            link = &(socket_ptr->next_stalled);
+            continue;
         }
-        uint64_t const dest_length = strlen(destination);
-        uint64_t const src_length = strlen(source);
-        for (;;) {
-            global_lock();
-            struct dirent* const dir_entry = readdir(dir);
-            if (dir_entry == NULL) {
-                global_unlock();
-                break;
+        *link = socket_ptr->next_stalled;
+        net__pause_in(socket_ptr, false);
+    }
+}
+
+// The socket stops producing events, the structure is freed when the owner has closed it.
+// The kept items go to the in pipeline even if it is full, the socket adds nothing after them.
+static void net__finish(net_socket* socket_ptr) {
+    if (socket_ptr->is_finished) {return;}
+    socket_ptr->is_finished = true;
+    if (socket_ptr->stalled_count != 0) {
+        net__unlink_stalled(socket_ptr);
+        for (uint64_t index = 0; index < socket_ptr->stalled_count; index++) {pipeline__push_over(socket_ptr->in_pipe, socket_ptr->stalled[index]);}
+        socket_ptr->stalled_count = 0;
+    }
+    free(socket_ptr->stalled);
+    socket_ptr->stalled = NULL;
+    socket_ptr->stalled_capacity = 0;
+    epoll_ctl(net__epoll_fd, EPOLL_CTL_DEL, socket_ptr->fd, NULL);
+    if (socket_ptr->out_event_fd != -1) {epoll_ctl(net__epoll_fd, EPOLL_CTL_DEL, socket_ptr->out_event_fd, NULL);}
+    close(socket_ptr->fd);
+    for (uint64_t index = 0; index < socket_ptr->pending_count; index++) {shar__object_free(socket_ptr->pending[index], net__th_data);}
+    socket_ptr->pending_count = 0;
+    if (socket_ptr->watch != NULL) {fs__watch_free(socket_ptr);}
+    if (socket_ptr->is_released) {
+        socket_ptr->next = net__released_sockets;
+        net__released_sockets = socket_ptr;
+    }
+}
+
+__attribute__((cold)) static void net__fail(net_socket* socket_ptr, const char* action, int error_number) {
+    net__deliver(socket_ptr, net__error(action, error_number));
+    net__finish(socket_ptr);
+}
+
+// While the written data is stuck in the socket buffer, the out pipeline is not watched and the loop waits for "EPOLLOUT".
+static void net__pause_out(net_socket* socket_ptr, bool paused) {
+    if (socket_ptr->out_is_paused == paused) {return;}
+    socket_ptr->out_is_paused = paused;
+    net__watch(socket_ptr, socket_ptr->out_event_fd, paused ? 0 : EPOLLIN, 1, EPOLL_CTL_MOD);
+    net__watch_fd(socket_ptr);
+}
+
+// Strings are sent as UTF-8, "false" shuts down the sending side of a stream, other objects are ignored.
+static void net__take_out_items(net_socket* socket_ptr) {
+    while (socket_ptr->pending_count < net__batch_size) {
+        type item = pipeline__pop(socket_ptr->out_pipe);
+        if (item.type == nothing__type_number) {break;}
+        if (item.type == string__type_number) {
+            type const converted = bytes__from_string(item);
+            shar__object_free(item, net__th_data);
+            item = converted;
+        }
+        if (item.type == bytes__type_number || (item.type == bool__type_numer && !item.data)) {
+            socket_ptr->pending[socket_ptr->pending_count] = item;
+            socket_ptr->pending_count++;
+        } else {shar__object_free(item, net__th_data);}
+    }
+}
+
+static inline void net__drop_pending(net_socket* socket_ptr, uint64_t count) {
+    for (uint64_t index = 0; index < count; index++) {shar__object_free(socket_ptr->pending[index], net__th_data);}
+    socket_ptr->pending_count -= count;
+    memmove(socket_ptr->pending, &(socket_ptr->pending[count]), socket_ptr->pending_count * sizeof(type));
+}
+
+// The function writes the pending items with one "sendmsg", returns "false" if the socket can't take more data now.
+static bool net__write_stream(net_socket* socket_ptr) {
+    if (socket_ptr->pending[0].type == bool__type_numer) {
+        // A pipe has only one direction, so it is closed.
+        if (socket_ptr->kind == net__kind_pipe_out) {
+            net__finish(socket_ptr);
+            return true;
+        }
+        shutdown(socket_ptr->fd, SHUT_WR);
+        net__drop_pending(socket_ptr, 1);
+        return true;
+    }
+    struct iovec vectors[net__batch_size];
+    uint64_t vectors_count = 0;
+    for (; vectors_count < socket_ptr->pending_count && socket_ptr->pending[vectors_count].type == bytes__type_number; vectors_count++) {
+        const bytes* const data = (const bytes*)socket_ptr->pending[vectors_count].data;
+        uint64_t const offset = vectors_count == 0 ? socket_ptr->pending_offset : 0;
+        vectors[vectors_count] = (struct iovec){.iov_base = &(data->data[offset]), .iov_len = data->length - offset};
+    }
+    struct msghdr const message = {.msg_iov = vectors, .msg_iovlen = vectors_count};
+    int64_t written = socket_ptr->kind == net__kind_pipe_out ? writev(socket_ptr->fd, vectors, vectors_count) : sendmsg(socket_ptr->fd, &message, MSG_NOSIGNAL);
+    if (written == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {return false;}
+        if (errno != EINTR) {net__fail(socket_ptr, "Failed to write to the socket", errno);}
+        return true;
+    }
+    uint64_t written_items = 0;
+    for (; written_items < vectors_count && (uint64_t)written >= vectors[written_items].iov_len; written_items++) {written -= vectors[written_items].iov_len;}
+    socket_ptr->pending_offset = written_items < vectors_count ? (written_items == 0 ? socket_ptr->pending_offset : 0) + written : 0;
+    net__drop_pending(socket_ptr, written_items);
+    return written_items == vectors_count;
+}
+
+// The function sends the pending datagrams with one "sendmmsg", returns "false" if the socket can't take more data now.
+static bool net__write_datagrams(net_socket* socket_ptr) {
+    struct mmsghdr messages[net__batch_size];
+    struct iovec vectors[net__batch_size];
+    for (uint64_t index = 0; index < socket_ptr->pending_count; index++) {
+        const bytes* const data = (const bytes*)socket_ptr->pending[index].data;
+        vectors[index] = (struct iovec){.iov_base = data->data, .iov_len = data->length};
+        messages[index] = (struct mmsghdr){.msg_hdr = {.msg_iov = &(vectors[index]), .msg_iovlen = 1}};
+    }
+    int const sent = sendmmsg(socket_ptr->fd, messages, socket_ptr->pending_count, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {return false;}
+        // A datagram that can't be sent is dropped, the socket stays usable.
+        if (errno != EINTR) {
+            net__deliver(socket_ptr, net__error("Failed to send a datagram", errno));
+            net__drop_pending(socket_ptr, 1);
+        }
+        return true;
+    }
+    net__drop_pending(socket_ptr, sent);
+    return true;
+}
+
+static void net__send(net_socket* socket_ptr) {
+    // Listeners, read pipes and watches have nothing to send, a closed one is finished at once.
+    if (socket_ptr->out_pipe == 0) {
+        if (socket_ptr->is_closing) {net__finish(socket_ptr);}
+        return;
+    }
+    for (;;) {
+        net__take_out_items(socket_ptr);
+        if (socket_ptr->pending_count == 0) {
+            net__pause_out(socket_ptr, false);
+            if (socket_ptr->is_closing) {net__finish(socket_ptr);}
+            return;
+        }
+        if (socket_ptr->kind == net__kind_datagram) {
+            // "false" has no meaning for datagrams.
+            while (socket_ptr->pending_count != 0 && socket_ptr->pending[0].type != bytes__type_number) {net__drop_pending(socket_ptr, 1);}
+            if (socket_ptr->pending_count == 0) {continue;}
+        }
+        bool const all_written = socket_ptr->kind == net__kind_datagram ? net__write_datagrams(socket_ptr) : net__write_stream(socket_ptr);
+        if (socket_ptr->is_finished) {return;}
+        if (!all_written) {
+            net__pause_out(socket_ptr, true);
+            return;
+        }
+    }
+}
+
+static net_socket* net__new_socket(int fd, uint8_t kind, uint64_t in_pipe) {
+    net_socket* const result = malloc(sizeof(net_socket));
+    *result = (net_socket) {
+        .fd             = fd,
+        .out_event_fd   = -1,
+        .kind           = kind,
+        .is_connecting  = false,
+        .is_read_closed = false,
+        .is_closing     = false,
+        .is_finished    = false,
+        .is_released    = false,
+        .out_is_paused    = false,
+        .in_is_paused     = false,
+        .in_pipe          = in_pipe != 0 ? in_pipe : (uint64_t)pipeline__new(kind == net__kind_stream || kind == net__kind_datagram ? net__in_capacity : 0),
+        .out_pipe         = kind != net__kind_listener && kind != net__kind_pipe_in && kind != net__kind_watch ? (uint64_t)pipeline__new(0) : 0,
+        .pending_count    = 0,
+        .pending_offset   = 0,
+        .stalled          = NULL,
+        .stalled_count    = 0,
+        .stalled_capacity = 0,
+        .watch            = NULL,
+        .next             = NULL,
+        .next_stalled     = NULL
+    };
+    if (in_pipe != 0) {pipeline__use(in_pipe);}
+    if (result->out_pipe != 0) {result->out_event_fd = pipeline__get_event_fd(result->out_pipe).data;}
+    return result;
+}
+
+static void net__register(net_socket* socket_ptr) {
+    if (socket_ptr->is_connecting) {
+        net__watch(socket_ptr, socket_ptr->fd, EPOLLOUT, 0, EPOLL_CTL_ADD);
+        return;
+    }
+    if (socket_ptr->out_event_fd != -1) {net__watch(socket_ptr, socket_ptr->out_event_fd, EPOLLIN, 1, EPOLL_CTL_ADD);}
+    net__watch(socket_ptr, socket_ptr->fd, socket_ptr->kind != net__kind_pipe_out ? EPOLLIN : 0, 0, EPOLL_CTL_ADD);
+}
+
+static void net__accept(net_socket* socket_ptr) {
+    while (!socket_ptr->in_is_paused) {
+        int const fd = accept4(socket_ptr->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {continue;}
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {net__deliver(socket_ptr, net__error("Failed to accept a connection", errno));}
+            return;
+        }
+        int const enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        net_socket* const accepted = net__new_socket(fd, net__kind_stream, 0);
+        net__register(accepted);
+        net__deliver(socket_ptr, (type){.data = (uint64_t)accepted, .type = int__type_number});
+    }
+}
+
+// The received data is pushed to the in pipeline as byte buffers, the end of the stream is pushed as "false".
+// After the end of the stream the socket can still send data (the peer has only shut down its sending side).
+static void net__receive_stream(net_socket* socket_ptr) {
+    while (!socket_ptr->in_is_paused) {
+        int64_t const received = read(socket_ptr->fd, net__receive_buffer, net__receive_size);
+        if (received > 0) {
+            net__deliver(socket_ptr, bytes__create_from_memory(net__receive_buffer, received));
+            if (received < net__receive_size) {return;}
+        } else if (received == 0) {
+            net__deliver(socket_ptr, (type){.data = false, .type = bool__type_numer});
+            socket_ptr->is_read_closed = true;
+            if (socket_ptr->kind == net__kind_pipe_in) {net__finish(socket_ptr);}
+            else {net__watch_fd(socket_ptr);}
+            return;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {return;}
+        else if (errno != EINTR) {
+            net__fail(socket_ptr, "Failed to read from the socket", errno);
+            return;
+        }
+    }
+}
+
+static void net__receive_datagrams(net_socket* socket_ptr) {
+    struct mmsghdr messages[net__receive_batch_size];
+    struct iovec vectors[net__receive_batch_size];
+    for (uint64_t index = 0; index < net__receive_batch_size; index++) {
+        vectors[index] = (struct iovec){.iov_base = &(net__receive_buffer[index * net__receive_size]), .iov_len = net__receive_size};
+        messages[index] = (struct mmsghdr){.msg_hdr = {.msg_iov = &(vectors[index]), .msg_iovlen = 1}};
+    }
+    while (!socket_ptr->in_is_paused) {
+        int const received = recvmmsg(socket_ptr->fd, messages, net__receive_batch_size, MSG_DONTWAIT, NULL);
+        if (received == -1) {
+            if (errno == EINTR) {continue;}
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {net__deliver(socket_ptr, net__error("Failed to receive a datagram", errno));}
+            return;
+        }
+        for (int index = 0; index < received; index++) {net__deliver(socket_ptr, bytes__create_from_memory(vectors[index].iov_base, messages[index].msg_len));}
+        if (received < net__receive_batch_size) {return;}
+    }
+}
+
+// Watches of the file system are served by the loop too. Their events are pushed after a short quiet interval,
+// so a burst of changes of one file (for example, a file written in many calls) becomes one event.
+#define fs__watch__created  1
+#define fs__watch__modified 2
+#define fs__watch__deleted  4
+#define fs__watch__renamed  8
+
+#define fs__watch__debounce_ns    20000000
+#define fs__watch__max_latency_ns 200000000
+
+static inline uint64_t fs__watch_hash(const char* path) {
+    uint64_t hash = 14695981039346656037ull;
+    for (; *path != 0; path++) {hash = (hash ^ (uint8_t)*path) * 1099511628211ull;}
+    return hash;
+}
+
+static inline char* fs__watch_copy(const char* path) {
+    uint64_t const length = strlen(path);
+    char* const result = malloc(length + 1);
+    memcpy(result, path, length + 1);
+    return result;
+}
+
+static inline bool fs__watch_is_under(const char* path, const char* prefix, uint64_t prefix_length) {
+    return strncmp(path, prefix, prefix_length) == 0 && (path[prefix_length] == 0 || path[prefix_length] == '/');
+}
+
+// The function returns the slot of the pending change of the path or the empty slot for it.
+static uint64_t fs__watch_find_slot(const fs_watch* watch, const char* path, uint64_t hash) {
+    uint64_t slot = hash & (watch->pending_index_capacity - 1);
+    for (; watch->pending_index[slot] != 0; slot = (slot + 1) & (watch->pending_index_capacity - 1)) {
+        const fs_watch_event* const event = &(watch->pending[watch->pending_index[slot] - 1]);
+        if (event->hash == hash && strcmp(event->path, path) == 0) {break;}
+    }
+    return slot;
+}
+
+static void fs__watch_grow_index(fs_watch* watch) {
+    free(watch->pending_index);
+    watch->pending_index_capacity = watch->pending_index_capacity == 0 ? 64 : watch->pending_index_capacity * 2;
+    watch->pending_index = malloc(watch->pending_index_capacity * sizeof(uint32_t));
+    memset(watch->pending_index, 0, watch->pending_index_capacity * sizeof(uint32_t));
+    for (uint64_t index = 0; index < watch->pending_count; index++) {
+        watch->pending_index[fs__watch_find_slot(watch, watch->pending[index].path, watch->pending[index].hash)] = index + 1;
+    }
+}
+
+// The change is merged with the pending change of the same path: a created and then deleted file disappears,
+// a deleted and then created file is modified, a created and then modified file is created. The function takes the path.
+static void fs__watch_add_event(net_socket* socket_ptr, char code, char* path) {
+    fs_watch* const watch = socket_ptr->watch;
+    uint64_t const now = timer__now();
+    if (watch->pending_count == 0) {
+        watch->first_event_time = now;
+        watch->next_pending = net__pending_watches;
+        net__pending_watches = socket_ptr;
+    }
+    watch->last_event_time = now;
+    if ((watch->pending_count + 1) * 2 > watch->pending_index_capacity) {fs__watch_grow_index(watch);}
+    uint64_t const hash = fs__watch_hash(path);
+    uint64_t const slot = fs__watch_find_slot(watch, path, hash);
+    if (watch->pending_index[slot] != 0) {
+        fs_watch_event* const event = &(watch->pending[watch->pending_index[slot] - 1]);
+        switch (code) {
+        case 'D': event->code = event->code == 'C' ? 0 : 'D'; break;
+        case 'C': event->code = event->code == 'D' || event->code == 'M' ? 'M' : 'C'; break;
+        case 'M': event->code = event->code == 'C' ? 'C' : 'M'; break;
+        default: event->code = code;
+        }
+        free(path);
+        return;
+    }
+    if (watch->pending_count == watch->pending_capacity) {
+        watch->pending_capacity = watch->pending_capacity == 0 ? 64 : watch->pending_capacity * 2;
+        watch->pending = realloc(watch->pending, watch->pending_capacity * sizeof(fs_watch_event));
+    }
+    watch->pending[watch->pending_count] = (fs_watch_event){.path = path, .hash = hash, .code = code};
+    watch->pending_count++;
+    watch->pending_index[slot] = watch->pending_count;
+}
+
+// The event is pushed as a string: the code, a space and the path ("R" - the old and the new path separated by a tab).
+static void fs__watch_push(net_socket* socket_ptr, char code, const char* path) {
+    uint64_t const path_length = strlen(path);
+    char* const text = malloc(path_length + 3);
+    text[0] = code;
+    text[1] = ' ';
+    memcpy(&(text[2]), path, path_length + 1);
+    net__deliver(socket_ptr, string__utf8_to_utf32_n((const uint8_t*)text, path_length + 2));
+    free(text);
+}
+
+static void fs__watch_flush(net_socket* socket_ptr) {
+    fs_watch* const watch = socket_ptr->watch;
+    if (watch->pending_count == 0) {return;}
+    fs__watch_unlink_pending(socket_ptr);
+    for (uint64_t index = 0; index < watch->pending_count; index++) {
+        fs_watch_event* const event = &(watch->pending[index]);
+        uint32_t const kind = event->code == 'C' ? fs__watch__created : event->code == 'M' ? fs__watch__modified : event->code == 'D' ? fs__watch__deleted : event->code == 'R' ? fs__watch__renamed : 0;
+        if ((watch->events & kind) != 0) {fs__watch_push(socket_ptr, event->code, event->path);}
+        free(event->path);
+    }
+    watch->pending_count = 0;
+    memset(watch->pending_index, 0, watch->pending_index_capacity * sizeof(uint32_t));
+}
+
+// The function flushes the watches that have been quiet long enough and returns the timeout of "epoll_wait" for the rest.
+static int net__flush_watches() {
+    int timeout = -1;
+    uint64_t const now = timer__now();
+    for (net_socket* socket_ptr = net__pending_watches; socket_ptr != NULL;) {
+        fs_watch* const watch = socket_ptr->watch;
+        net_socket* const next = watch->next_pending;
+        uint64_t deadline = watch->last_event_time + fs__watch__debounce_ns;
+        if (deadline > watch->first_event_time + fs__watch__max_latency_ns) {deadline = watch->first_event_time + fs__watch__max_latency_ns;}
+        if (deadline <= now) {fs__watch_flush(socket_ptr);}
+        else {
+            int const remaining = (deadline - now + 999999) / 1000000;
+            if (timeout == -1 || remaining < timeout) {timeout = remaining;}
+        }
+        socket_ptr = next;
+    }
+    return timeout;
+}
+
+static void fs__watch_set_path(fs_watch* watch, int wd, char* path) {
+    if ((uint64_t)wd >= watch->paths_capacity) {
+        uint64_t const capacity = (uint64_t)wd * 2 + 16;
+        watch->paths = realloc(watch->paths, capacity * sizeof(char*));
+        memset(&(watch->paths[watch->paths_capacity]), 0, (capacity - watch->paths_capacity) * sizeof(char*));
+        watch->paths_capacity = capacity;
+    }
+    free(watch->paths[wd]);
+    watch->paths[wd] = path;
+}
+
+static void fs__watch_add_tree(net_socket* socket_ptr, const char* dir_name, bool report);
+
+// The subdirectories are watched too, for a directory that has appeared its objects are reported as created,
+// because they could be created before the directory was watched.
+static void fs__watch_add_children(net_socket* socket_ptr, const char* dir_name, bool report) {
+    uint64_t names_count;
+    char** const names = fs__read_dir_names_utf8(dir_name, &names_count);
+    if (names == NULL) {return;}
+    for (uint64_t index = 0; index < names_count; index++) {
+        char* const full_name = fs__join_path(dir_name, names[index]);
+        struct stat file_stat;
+        if (lstat(full_name, &file_stat) == 0) {
+            if (report) {fs__watch_add_event(socket_ptr, 'C', fs__watch_copy(full_name));}
+            if (S_ISDIR(file_stat.st_mode)) {fs__watch_add_tree(socket_ptr, full_name, report);}
+        }
+        free(full_name);
+    }
+    fs__free_names(names, names_count);
+}
+
+static void fs__watch_add_tree(net_socket* socket_ptr, const char* dir_name, bool report) {
+    int const wd = inotify_add_watch(socket_ptr->fd, dir_name, socket_ptr->watch->mask | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (wd == -1) {
+        // The directory is already deleted or replaced. Before registration the tree is walked by the calling thread ("report" is "false"),
+        // which can wait for room in the pipeline.
+        if (errno != ENOENT && errno != ENOTDIR) {
+            type const error_obj = net__error("Failed to watch a directory", errno);
+            if (report) {net__deliver(socket_ptr, error_obj);}
+            else {pipeline__push(socket_ptr->in_pipe, error_obj);}
+        }
+        return;
+    }
+    fs__watch_set_path(socket_ptr->watch, wd, fs__watch_copy(dir_name));
+    fs__watch_add_children(socket_ptr, dir_name, report);
+}
+
+// The object is moved out of the watched tree, the watches of a moved directory are removed. The function takes the path.
+static void fs__watch_moved_out(net_socket* socket_ptr, char* path, bool is_dir) {
+    fs_watch* const watch = socket_ptr->watch;
+    if (is_dir) {
+        uint64_t const path_length = strlen(path);
+        for (uint64_t wd = 0; wd < watch->paths_capacity; wd++) {
+            if (watch->paths[wd] == NULL || !fs__watch_is_under(watch->paths[wd], path, path_length)) {continue;}
+            inotify_rm_watch(socket_ptr->fd, wd);
+            free(watch->paths[wd]);
+            watch->paths[wd] = NULL;
+        }
+    }
+    fs__watch_add_event(socket_ptr, 'D', path);
+}
+
+// The object is renamed inside the watched tree, the paths of the watched directories are updated. The function takes the paths.
+static void fs__watch_renamed(net_socket* socket_ptr, char* old_path, char* new_path, bool is_dir) {
+    fs_watch* const watch = socket_ptr->watch;
+    uint64_t const old_length = strlen(old_path);
+    uint64_t const new_length = strlen(new_path);
+    if (is_dir) {
+        for (uint64_t wd = 0; wd < watch->paths_capacity; wd++) {
+            char* const path = watch->paths[wd];
+            if (path == NULL || !fs__watch_is_under(path, old_path, old_length)) {continue;}
+            uint64_t const rest_length = strlen(path) - old_length;
+            char* const updated = malloc(new_length + rest_length + 1);
+            memcpy(updated, new_path, new_length);
+            memcpy(&(updated[new_length]), &(path[old_length]), rest_length + 1);
+            fs__watch_set_path(watch, wd, updated);
+        }
+    }
+    // A file that is created and renamed before the events are pushed is reported only as created with the new name.
+    if (watch->pending_index != NULL) {
+        uint32_t const position = watch->pending_index[fs__watch_find_slot(watch, old_path, fs__watch_hash(old_path))];
+        if (position != 0 && watch->pending[position - 1].code == 'C') {
+            watch->pending[position - 1].code = 0;
+            fs__watch_add_event(socket_ptr, 'C', new_path);
+            free(old_path);
+            return;
+        }
+    }
+    char* const text = malloc(old_length + new_length + 2);
+    memcpy(text, old_path, old_length);
+    text[old_length] = '\t';
+    memcpy(&(text[old_length + 1]), new_path, new_length + 1);
+    fs__watch_add_event(socket_ptr, 'R', text);
+    free(old_path);
+    free(new_path);
+}
+
+// A move is reported by two events with the same cookie, an unpaired half is a move into or out of the watched tree.
+static void fs__watch_receive(net_socket* socket_ptr) {
+    fs_watch* const watch = socket_ptr->watch;
+    char* moved_path = NULL;
+    uint32_t moved_cookie = 0;
+    bool moved_is_dir = false;
+    while (!socket_ptr->in_is_paused) {
+        int64_t const received = read(socket_ptr->fd, net__receive_buffer, net__receive_size);
+        if (received == -1) {
+            if (errno == EINTR) {continue;}
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {net__deliver(socket_ptr, net__error("Failed to read the watch events", errno));}
+            break;
+        }
+        for (int64_t offset = 0; offset < received;) {
+            const struct inotify_event* const event = (const struct inotify_event*)&(net__receive_buffer[offset]);
+            offset += sizeof(struct inotify_event) + event->len;
+            // The kernel has dropped events, the consumer must rescan the tree.
+            if ((event->mask & IN_Q_OVERFLOW) != 0) {
+                if (moved_path != NULL) {
+                    fs__watch_moved_out(socket_ptr, moved_path, moved_is_dir);
+                    moved_path = NULL;
+                }
+                fs__watch_flush(socket_ptr);
+                fs__watch_push(socket_ptr, 'O', watch->root);
+                continue;
             }
-            char* const object_name = dir_entry->d_name;
-            uint64_t const object_name_length = strlen(object_name);
-            typeof(dir_entry->d_type) object_type = dir_entry->d_type;
-            global_unlock();
-            if (
-                object_name[0] == '.' &&
-                (object_name_length == 1 || (object_name_length == 2 && object_name[1] == '.'))
-            ) {continue;}
-            char* dest_full_name = malloc(dest_length + object_name_length + 2);
-            strcpy(dest_full_name, destination);
-            dest_full_name[dest_length] = '/';
-            dest_full_name[dest_length + 1] = 0;
-            strcat(dest_full_name, object_name);
-            char* src_full_name = malloc(src_length + object_name_length + 2);
-            strcpy(src_full_name, source);
-            src_full_name[src_length] = '/';
-            src_full_name[src_length + 1] = 0;
-            strcat(src_full_name, object_name);
-            switch (object_type) {
-            case DT_DIR:{
-                dest_dirs_list = realloc(dest_dirs_list, (dirs_count + 1) * sizeof(char*));
-                src_dirs_list = realloc(src_dirs_list, (dirs_count + 1) * sizeof(char*));
-                dest_dirs_list[dirs_count] = dest_full_name;
-                src_dirs_list[dirs_count] = src_full_name;
-                dirs_count++;
-                break;}
-            case DT_LNK:{
-                result = fs__copy_link_utf8(dest_full_name, src_full_name, buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
-                free(dest_full_name);
-                free(src_full_name);
-                if (result.type == error__type_number) {goto endloop;}
-                break;}
-            default:{
-                struct stat file_stat;
-                lstat(src_full_name, &file_stat);
-                result = fs__copy_file_utf8(dest_full_name, src_full_name, file_stat, pipefd, allow_splice, buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
-                free(dest_full_name);
-                free(src_full_name);
-                if (result.type == error__type_number) {goto endloop;}}
+            if (event->wd < 0 || (uint64_t)event->wd >= watch->paths_capacity || watch->paths[event->wd] == NULL) {continue;}
+            if ((event->mask & IN_IGNORED) != 0) {
+                free(watch->paths[event->wd]);
+                watch->paths[event->wd] = NULL;
+                continue;
             }
+            bool const is_dir = (event->mask & IN_ISDIR) != 0;
+            char* const path = event->len != 0 ? fs__join_path(watch->paths[event->wd], event->name) : fs__watch_copy(watch->paths[event->wd]);
+            if (moved_path != NULL) {
+                if ((event->mask & IN_MOVED_TO) != 0 && event->cookie == moved_cookie) {
+                    fs__watch_renamed(socket_ptr, moved_path, path, is_dir);
+                    moved_path = NULL;
+                    continue;
+                }
+                fs__watch_moved_out(socket_ptr, moved_path, moved_is_dir);
+                moved_path = NULL;
+            }
+            if ((event->mask & IN_MOVED_FROM) != 0) {
+                moved_path = path;
+                moved_cookie = event->cookie;
+                moved_is_dir = is_dir;
+            } else if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+                if (is_dir && watch->is_recursive) {
+                    fs__watch_add_event(socket_ptr, 'C', fs__watch_copy(path));
+                    fs__watch_add_tree(socket_ptr, path, true);
+                    free(path);
+                } else {fs__watch_add_event(socket_ptr, 'C', path);}
+            } else if ((event->mask & IN_DELETE) != 0 || ((event->mask & IN_DELETE_SELF) != 0 && event->wd == watch->root_wd)) {
+                fs__watch_add_event(socket_ptr, 'D', path);
+            } else if ((event->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB)) != 0) {
+                fs__watch_add_event(socket_ptr, 'M', path);
+            } else {free(path);}
         }
-        endloop:
-        closedir(dir);
+        if (received < net__receive_size - (int64_t)(sizeof(struct inotify_event) + NAME_MAX + 1)) {break;}
     }
-    for (; dirs_count != 0; dirs_count--) {
-        if (result.type == nothing__type_number) {
-            struct stat dir_stat;
-            lstat(src_dirs_list[dirs_count - 1], &dir_stat);
-            result = fs__copy_dir_utf8(dest_dirs_list[dirs_count - 1], src_dirs_list[dirs_count - 1], dir_stat, pipefd, allow_splice, buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
+    if (moved_path != NULL) {fs__watch_moved_out(socket_ptr, moved_path, moved_is_dir);}
+}
+
+static void net__handle_socket_event(net_socket* socket_ptr, uint32_t events) {
+    if (socket_ptr->is_connecting) {
+        int error_number = 0;
+        socklen_t error_number_length = sizeof(error_number);
+        getsockopt(socket_ptr->fd, SOL_SOCKET, SO_ERROR, &error_number, &error_number_length);
+        if (error_number != 0) {
+            net__fail(socket_ptr, "Failed to connect", error_number);
+            return;
         }
-        free(dest_dirs_list[dirs_count - 1]);
-        free(src_dirs_list[dirs_count - 1]);
+        socket_ptr->is_connecting = false;
+        net__watch(socket_ptr, socket_ptr->fd, EPOLLIN, 0, EPOLL_CTL_MOD);
+        net__watch(socket_ptr, socket_ptr->out_event_fd, EPOLLIN, 1, EPOLL_CTL_ADD);
+        return;
     }
-    if (dest_dirs_list != NULL) {
-        free(dest_dirs_list);
-        free(src_dirs_list);
+    switch (socket_ptr->kind) {
+    case net__kind_listener:
+        net__accept(socket_ptr);
+        return;
+    case net__kind_watch:
+        fs__watch_receive(socket_ptr);
+        return;
+    case net__kind_datagram:
+        if ((events & (EPOLLIN | EPOLLERR)) != 0) {net__receive_datagrams(socket_ptr);}
+        break;
+    case net__kind_pipe_out:
+        // The reading side of the pipe is closed.
+        if ((events & (EPOLLERR | EPOLLHUP)) != 0) {
+            net__deliver(socket_ptr, (type){.data = false, .type = bool__type_numer});
+            net__finish(socket_ptr);
+            return;
+        }
+        break;
+    default:
+        if (!socket_ptr->is_read_closed && (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0) {net__receive_stream(socket_ptr);}
+        // Both directions are shut down, nothing more can be received or sent.
+        if (socket_ptr->is_read_closed && (events & (EPOLLERR | EPOLLHUP)) != 0) {
+            net__finish(socket_ptr);
+            return;
+        }
+    }
+    if ((events & EPOLLOUT) != 0 && !socket_ptr->is_finished) {net__send(socket_ptr);}
+    // A paused descriptor is watched once, it is armed again unless it has hung up.
+    if (socket_ptr->in_is_paused && !socket_ptr->is_finished && (events & (EPOLLERR | EPOLLHUP)) == 0) {net__watch_fd(socket_ptr);}
+}
+
+static void net__handle_close_requests() {
+    eventfd_t value;
+    eventfd_read(net__control_fd, &value);
+    net_socket* socket_ptr = __atomic_exchange_n(&net__close_requests, NULL, __ATOMIC_ACQUIRE);
+    while (socket_ptr != NULL) {
+        net_socket* const next = socket_ptr->next;
+        // The flag is set first, so a socket finished right here is queued for freeing by "net__finish".
+        bool const is_finished = socket_ptr->is_finished;
+        socket_ptr->is_released = true;
+        if (is_finished) {
+            socket_ptr->next = net__released_sockets;
+            net__released_sockets = socket_ptr;
+        } else {
+            socket_ptr->is_closing = true;
+            if (socket_ptr->is_connecting) {net__finish(socket_ptr);}
+            else if (!socket_ptr->out_is_paused) {net__send(socket_ptr);}
+        }
+        socket_ptr = next;
+    }
+}
+
+static void net__add_orphan(pid_t pid) {
+    mutex__lock(&net__orphans_mutex);
+    if (net__orphans_count == net__orphans_capacity) {
+        net__orphans_capacity = net__orphans_capacity == 0 ? 16 : net__orphans_capacity * 2;
+        net__orphans = realloc(net__orphans, net__orphans_capacity * sizeof(pid_t));
+    }
+    net__orphans[net__orphans_count] = pid;
+    __atomic_store_n(&net__orphans_count, net__orphans_count + 1, __ATOMIC_RELAXED);
+    mutex__unlock(&net__orphans_mutex);
+    // The loop may sleep without a timeout, so it is woken up to start polling the orphans.
+    eventfd_write(net__control_fd, 1);
+}
+
+// The orphans are polled every "net__reap_interval_ns", the function returns the timeout of "epoll_wait" limited by the next poll.
+static int net__reap_orphans(int timeout) {
+    if (__atomic_load_n(&net__orphans_count, __ATOMIC_RELAXED) == 0) {return timeout;}
+    uint64_t const now = timer__now();
+    if (now >= net__next_reap_time) {
+        mutex__lock(&net__orphans_mutex);
+        for (uint64_t index = 0; index < net__orphans_count;) {
+            if (waitpid(net__orphans[index], NULL, WNOHANG) == 0) {
+                index++;
+                continue;
+            }
+            net__orphans_count--;
+            net__orphans[index] = net__orphans[net__orphans_count];
+        }
+        mutex__unlock(&net__orphans_mutex);
+        net__next_reap_time = now + net__reap_interval_ns;
+    }
+    int const remaining = (net__next_reap_time - now + 999999) / 1000000;
+    return timeout == -1 || remaining < timeout ? remaining : timeout;
+}
+
+// The event loop thread, it is started with the first socket and serves all sockets of the process.
+static void* net__loop(void* args) {
+    struct epoll_event events[net__batch_size];
+    // Writing to a pipe whose reader has exited must fail with "EPIPE" instead of killing the process.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    trace__start_thread(net__th_data->id);
+    for (;;) {
+        net__retry_stalled();
+        int timeout = net__flush_watches();
+        if (net__stalled_sockets != NULL && (timeout == -1 || timeout > net__stall_retry_ms)) {timeout = net__stall_retry_ms;}
+        timeout = net__reap_orphans(timeout);
+        int const events_count = epoll_wait(net__epoll_fd, events, net__batch_size, timeout);
+        for (int index = 0; index < events_count; index++) {
+            uint64_t const tag = events[index].data.u64;
+            if (tag == 0) {
+                net__handle_close_requests();
+                continue;
+            }
+            net_socket* const socket_ptr = (net_socket*)(tag & ~(uint64_t)1);
+            if (socket_ptr->is_finished) {continue;}
+            if ((tag & 1) != 0) {net__send(socket_ptr);}
+            else {net__handle_socket_event(socket_ptr, events[index].events);}
+        }
+        while (net__released_sockets != NULL) {
+            net_socket* const socket_ptr = net__released_sockets;
+            net__released_sockets = socket_ptr->next;
+            pipeline__free(socket_ptr->in_pipe, net__th_data);
+            if (socket_ptr->out_pipe != 0) {pipeline__free(socket_ptr->out_pipe, net__th_data);}
+            free(socket_ptr);
+        }
+    }
+    return NULL;
+}
+
+static void net__start_loop() {
+    net__epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    net__control_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (__builtin_expect(net__epoll_fd == -1 || net__control_fd == -1, false)) {
+        fprintf(stderr, "Failed to create the network event loop.\n");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = 0};
+    epoll_ctl(net__epoll_fd, EPOLL_CTL_ADD, net__control_fd, &event);
+    net__receive_buffer = malloc(net__receive_batch_size * net__receive_size);
+    net__th_data = thread_data__create();
+    pthread_t thread;
+    if (__builtin_expect(pthread_create(&thread, NULL, net__loop, NULL) != 0, false)) {
+        fprintf(stderr, "Failed to start new thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+}
+
+// The function serves a pipe descriptor in the event loop: "net__kind_pipe_in" is read, "net__kind_pipe_out" is written.
+static net_socket* net__open_pipe(int fd, uint8_t kind) {
+    pthread_once(&net__loop_once, net__start_loop);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    net_socket* const socket_ptr = net__new_socket(fd, kind, 0);
+    net__register(socket_ptr);
+    return socket_ptr;
+}
+
+// The function creates a non-blocking socket, binds it to "local" and connects it to "remote" (each can be "NULL").
+static type net__open(int family, int socket_type, const struct sockaddr* local, socklen_t local_length, const struct sockaddr* remote, socklen_t remote_length, uint8_t kind, uint64_t accepted_pipe) {
+    pthread_once(&net__loop_once, net__start_loop);
+    int const fd = socket(family, socket_type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {return net__error("Failed to create a socket", errno);}
+    int const enable = 1;
+    if (kind == net__kind_listener && family != AF_UNIX) {setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));}
+    if (kind == net__kind_stream && family != AF_UNIX) {setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));}
+    if (kind == net__kind_datagram) {
+        // Datagrams that don't fit into the receive buffer are lost, so bursts get a bigger buffer (limited by "rmem_max").
+        int const receive_buffer_size = 4 * 1024 * 1024;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_size, sizeof(receive_buffer_size));
+    }
+    if (local != NULL && bind(fd, local, local_length) != 0) {
+        int const error_number = errno;
+        close(fd);
+        return net__error("Failed to bind the socket", error_number);
+    }
+    if (kind == net__kind_listener && listen(fd, SOMAXCONN) != 0) {
+        int const error_number = errno;
+        close(fd);
+        return net__error("Failed to listen on the socket", error_number);
+    }
+    bool is_connecting = false;
+    if (remote != NULL && connect(fd, remote, remote_length) != 0) {
+        if (errno != EINPROGRESS) {
+            int const error_number = errno;
+            close(fd);
+            return net__error("Failed to connect", error_number);
+        }
+        is_connecting = true;
+    }
+    net_socket* const socket_ptr = net__new_socket(fd, kind, accepted_pipe);
+    socket_ptr->is_connecting = is_connecting;
+    net__register(socket_ptr);
+    return (type){.data = (uint64_t)socket_ptr, .type = int__type_number};
+}
+
+// The function resolves the host ("nothing" - any local address) and the port, it blocks the calling thread, not the event loop.
+static type net__resolve(type host, type port, int socket_type, struct sockaddr_storage* address, socklen_t* address_length) {
+    char port_text[24];
+    snprintf(port_text, sizeof(port_text), "%" PRIu64, port.data);
+    char* const host_utf8 = host.type == string__type_number ? (char*)string__utf32_to_utf8(host) : NULL;
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = socket_type, .ai_flags = AI_NUMERICSERV | (host_utf8 == NULL ? AI_PASSIVE : 0)};
+    struct addrinfo* addresses = NULL;
+    int const status = getaddrinfo(host_utf8, port_text, &hints, &addresses);
+    if (host_utf8 != NULL) {free(host_utf8);}
+    if (status != 0) {
+        char message[256];
+        snprintf(message, sizeof(message), "Failed to resolve the address: %s", gai_strerror(status));
+        return error__create_utf8_message((type){.data = error__id_fail, .type = int__type_number}, (type){.data = 0, .type = nothing__type_number}, (const uint8_t*)message);
     }
-    return result;
+    memcpy(address, addresses->ai_addr, addresses->ai_addrlen);
+    *address_length = addresses->ai_addrlen;
+    freeaddrinfo(addresses);
+    return (type){.data = 0, .type = nothing__type_number};
 }
 
-// The function copies a file system object.
-// If a problem occurs during copying, then control is transferred to the problem solver, if the solver solved the problem, the function continues its work.
-type fs__copy(type destination, type source, type* problem_solver, type (problem_solver_func)(type*, type, type, /*type -> uint64_t, uint32_t (because of a clang bug)*/ uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), void* th_data) {
-    bool allow_splice = true;
-    uint8_t* buffer = NULL;
-    struct stat fso_stat;
-    int pipefd[2];
-    if (__builtin_expect(pipe(pipefd) != 0, false)) {
-        fprintf(stderr, "Failed to create a one-way communication channel (pipe).\n");
-        exit(EXIT_FAILURE);
+static type net__unix_address(type path, struct sockaddr_un* address) {
+    char* const path_utf8 = (char*)string__utf32_to_utf8(path);
+    uint64_t const path_length = strlen(path_utf8);
+    *address = (struct sockaddr_un){.sun_family = AF_UNIX};
+    if (path_length >= sizeof(address->sun_path)) {
+        free(path_utf8);
+        return net__error("Invalid socket path", ENAMETOOLONG);
     }
-    type result = (type){.data = 0, .type = nothing__type_number};
-    char* source_utf8 = (char*)string__utf32_to_utf8(source);
-    for (;;) {
-        if (stat(source_utf8, &fso_stat) == 0 || lstat(source_utf8, &fso_stat) == 0) {break;}
-        result = problem_solver_func(problem_solver, destination, source, int_to_cptype(fs__copy__problem__stat, th_data, false).data, int__type_number, th_data, false);
-        if (result.type == error__type_number) {
-            free(source_utf8);
-            close(pipefd[0]);
-            close(pipefd[1]);
-            return result;
-        }
+    memcpy(address->sun_path, path_utf8, path_length + 1);
+    free(path_utf8);
+    return (type){.data = 0, .type = nothing__type_number};
+}
+
+// The function starts listening for TCP connections, each accepted connection is pushed to "accepted_pipe" as a socket.
+// If "host" is "nothing", the socket listens on all local addresses, port 0 selects a free port.
+// While "accepted_pipe" is full, the new connections wait in the backlog of the socket.
+type net__listen_tcp(type host, type port, uint64_t accepted_pipe) {
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    type const status = net__resolve(host, port, SOCK_STREAM, &address, &address_length);
+    if (status.type == error__type_number) {return status;}
+    return net__open(address.ss_family, SOCK_STREAM, (struct sockaddr*)&address, address_length, NULL, 0, net__kind_listener, accepted_pipe);
+}
+
+// The function starts connecting to the TCP server and returns the socket immediately.
+// If the connection fails, the error is pushed to the in pipeline of the socket.
+type net__connect_tcp(type host, type port) {
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    type const status = net__resolve(host, port, SOCK_STREAM, &address, &address_length);
+    if (status.type == error__type_number) {return status;}
+    return net__open(address.ss_family, SOCK_STREAM, NULL, 0, (struct sockaddr*)&address, address_length, net__kind_stream, 0);
+}
+
+type net__listen_unix(type path, uint64_t accepted_pipe) {
+    struct sockaddr_un address;
+    type const status = net__unix_address(path, &address);
+    if (status.type == error__type_number) {return status;}
+    return net__open(AF_UNIX, SOCK_STREAM, (struct sockaddr*)&address, sizeof(address), NULL, 0, net__kind_listener, accepted_pipe);
+}
+
+type net__connect_unix(type path) {
+    struct sockaddr_un address;
+    type const status = net__unix_address(path, &address);
+    if (status.type == error__type_number) {return status;}
+    return net__open(AF_UNIX, SOCK_STREAM, NULL, 0, (struct sockaddr*)&address, sizeof(address), net__kind_stream, 0);
+}
+
+// The function opens a UDP socket bound to the local address, every received datagram is a byte buffer in the in pipeline.
+// If "remote_host" is not "nothing", the byte buffers pushed to the out pipeline are sent to the remote address as datagrams.
+type net__open_udp(type local_host, type local_port, type remote_host, type remote_port) {
+    struct sockaddr_storage local_address;
+    struct sockaddr_storage remote_address;
+    socklen_t local_address_length;
+    socklen_t remote_address_length = 0;
+    bool const has_remote = remote_host.type == string__type_number;
+    if (has_remote) {
+        type const status = net__resolve(remote_host, remote_port, SOCK_DGRAM, &remote_address, &remote_address_length);
+        if (status.type == error__type_number) {return status;}
     }
-    char* const destination_utf8 = (char*)string__utf32_to_utf8(destination);
-    if ((fso_stat.st_mode & S_IFDIR) == S_IFDIR) {
-        result = fs__copy_dir_utf8(destination_utf8, source_utf8, fso_stat, pipefd, &allow_splice, &buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
-    } else if ((fso_stat.st_mode & S_IFLNK) == S_IFLNK) {
-        result = fs__copy_link_utf8(destination_utf8, source_utf8, &buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
+    if (local_host.type == nothing__type_number && has_remote) {
+        // Bind to the wildcard address of the family of the remote address.
+        local_address = (struct sockaddr_storage){.ss_family = remote_address.ss_family};
+        local_address_length = remote_address_length;
+        if (local_address.ss_family == AF_INET) {((struct sockaddr_in*)&local_address)->sin_port = htons(local_port.data);}
+        else {((struct sockaddr_in6*)&local_address)->sin6_port = htons(local_port.data);}
     } else {
-        result = fs__copy_file_utf8(destination_utf8, source_utf8, fso_stat, pipefd, &allow_splice, &buffer, problem_solver, problem_solver_func, int_to_cptype, th_data);
+        type const status = net__resolve(local_host, local_port, SOCK_DGRAM, &local_address, &local_address_length);
+        if (status.type == error__type_number) {return status;}
     }
-    free(destination_utf8);
-    free(source_utf8);
-    if (buffer != NULL) {free(buffer);}
-    close(pipefd[0]);
-    close(pipefd[1]);
+    return net__open(local_address.ss_family, SOCK_DGRAM, (struct sockaddr*)&local_address, local_address_length, has_remote ? (struct sockaddr*)&remote_address : NULL, remote_address_length, net__kind_datagram, 0);
+}
+
+// The function watches the file or the directory ("recursive" - with all subdirectories, including new ones),
+// the changes are pushed to "out_pipe" as strings: "C path" - created, "M path" - modified, "D path" - deleted,
+// "R old_path<tab>new_path" - renamed inside the watched tree. "events" selects the kinds of the changes
+// (1 - created, 2 - modified, 4 - deleted, 8 - renamed, 0 - all). The changes are coalesced and pushed after
+// a short quiet interval. "O path" means that the kernel has dropped events and the tree must be rescanned
+// (this can also happen while "out_pipe" is full, because the watch is not read then).
+// The watch is stopped with "net__close".
+type fs__watch(type path, type recursive, type events, uint64_t out_pipe) {
+    pthread_once(&net__loop_once, net__start_loop);
+    int const fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) {return net__error("Failed to watch a directory", errno);}
+    uint32_t const selected_events = events.data == 0 ? fs__watch__created | fs__watch__modified | fs__watch__deleted | fs__watch__renamed : events.data;
+    // Creations, deletions and moves are always needed to follow the tree.
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_EXCL_UNLINK;
+    if ((selected_events & fs__watch__modified) != 0) {mask |= IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB;}
+    char* const root = (char*)string__utf32_to_utf8(path);
+    uint64_t root_length = strlen(root);
+    while (root_length > 1 && root[root_length - 1] == '/') {root_length--;}
+    root[root_length] = 0;
+    int const root_wd = inotify_add_watch(fd, root, mask);
+    if (root_wd == -1) {
+        int const error_number = errno;
+        close(fd);
+        free(root);
+        return net__error("Failed to watch a directory", error_number);
+    }
+    fs_watch* const watch = malloc(sizeof(fs_watch));
+    *watch = (fs_watch) {
+        .root                   = root,
+        .root_wd                = root_wd,
+        .mask                   = mask,
+        .events                 = selected_events,
+        .is_recursive           = recursive.data != 0,
+        .paths                  = NULL,
+        .paths_capacity         = 0,
+        .pending                = NULL,
+        .pending_count          = 0,
+        .pending_capacity       = 0,
+        .pending_index          = NULL,
+        .pending_index_capacity = 0,
+        .first_event_time       = 0,
+        .last_event_time        = 0,
+        .next_pending           = NULL
+    };
+    fs__watch_set_path(watch, root_wd, fs__watch_copy(root));
+    net_socket* const socket_ptr = net__new_socket(fd, net__kind_watch, out_pipe);
+    socket_ptr->watch = watch;
+    // The socket is not registered yet, so the tree can be walked in the calling thread.
+    if (watch->is_recursive) {fs__watch_add_children(socket_ptr, root, false);}
+    net__register(socket_ptr);
+    return (type){.data = (uint64_t)socket_ptr, .type = int__type_number};
+}
+
+// The function returns the pipeline with the received data (for a listener - with the accepted sockets).
+// The pipeline of a TCP or UDP socket holds at most 64 buffers, while it is full, the socket is not read.
+// The pipeline must be freed by the caller.
+uint64_t net__get_in_pipe(type socket_obj) {
+    uint64_t const result = ((const net_socket*)socket_obj.data)->in_pipe;
+    pipeline__use(result);
     return result;
 }
 
-__attribute__((cold)) static type fs__delete_problem_solver(const char* object, type* problem_solver, type (problem_solver_func)(type*, type, uint64_t, uint32_t, void*, bool), type problem_code, void* th_data) {
-    type object_utf32 = string__utf8_to_utf32((uint8_t*)object);
-    type const result = problem_solver_func(problem_solver, object_utf32, problem_code.data, problem_code.type, th_data, false);
-    shar__rc_free(object_utf32, th_data, false);
+// The function returns the pipeline for the data to send: byte buffers and strings (as UTF-8), "false" shuts down the sending side.
+// The pipeline must be freed by the caller.
+uint64_t net__get_out_pipe(type socket_obj) {
+    uint64_t const result = ((const net_socket*)socket_obj.data)->out_pipe;
+    pipeline__use(result);
     return result;
 }
 
-static type fs__delete_file_utf8(const char* file_name, type* problem_solver, type (problem_solver_func)(type*, type, uint64_t, uint32_t, void*, bool), type (int_to_dptype)(type, void*, bool), void* th_data) {
-    type result = (type){.data = 0, .type = nothing__type_number};
-    if (remove(file_name) != 0) {
-        result = fs__delete_problem_solver(file_name, problem_solver, problem_solver_func, int_to_dptype(fs__delete__problem__delete_file, th_data, false), th_data);
+// The function returns the local port of the socket, for example, after listening on port 0.
+type net__get_local_port(type socket_obj) {
+    struct sockaddr_storage address;
+    socklen_t address_length = sizeof(address);
+    if (getsockname(((const net_socket*)socket_obj.data)->fd, (struct sockaddr*)&address, &address_length) != 0) {return (type){.data = 0, .type = nothing__type_number};}
+    if (address.ss_family == AF_INET) {return (type){.data = ntohs(((struct sockaddr_in*)&address)->sin_port), .type = int__type_number};}
+    if (address.ss_family == AF_INET6) {return (type){.data = ntohs(((struct sockaddr_in6*)&address)->sin6_port), .type = int__type_number};}
+    return (type){.data = 0, .type = nothing__type_number};
+}
+
+// The function closes the socket after the data already pushed to the out pipeline is written, the socket can't be used after the call.
+void net__close(type socket_obj) {
+    net_socket* const socket_ptr = (net_socket*)socket_obj.data;
+    socket_ptr->next = __atomic_load_n(&net__close_requests, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&net__close_requests, &(socket_ptr->next), socket_ptr, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+    eventfd_write(net__control_fd, 1);
+}
+
+#undef alloc__category
+#pragma endregion Net
+
+#pragma region Process
+#define alloc__category alloc__category__other
+
+extern char** environ;
+
+// A process started by "env__spawn", its standard streams are served by the network event loop.
+struct {
+    pid_t       pid;
+    int         exit_code;
+    bool        has_exited;
+    net_socket* stdin_socket;
+    net_socket* stdout_socket;
+    net_socket* stderr_socket;
+} typedef process;
+
+static char** process__to_utf8_array(const type* strings, uint64_t count) {
+    char** const result = malloc((count + 1) * sizeof(char*));
+    for (uint64_t index = 0; index < count; index++) {result[index] = (char*)string__utf32_to_utf8(strings[index]);}
+    result[count] = NULL;
+    return result;
+}
+
+static void process__free_utf8_array(char** strings) {
+    for (char** string = strings; *string != NULL; string++) {free(*string);}
+    free(strings);
+}
+
+// Shells report a process killed by a signal as 128 + the signal number, the same is done here.
+static inline int process__exit_code(int status) {return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);}
+
+// The function starts the program without a shell, the program is searched in "PATH" if its name has no slash.
+// If "environment" is "NULL", the environment of the current process is inherited. If "working_dir" is "nothing", the current one is used.
+static int process__spawn(pid_t* pid, char* const* arguments, char* const* environment, const char* working_dir, const int* std_fds) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (std_fds != NULL) {
+        for (int fd = 0; fd < 3; fd++) {posix_spawn_file_actions_adddup2(&actions, std_fds[fd], fd);}
     }
+    if (working_dir != NULL) {posix_spawn_file_actions_addchdir_np(&actions, working_dir);}
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attributes, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &signals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_USEVFORK);
+    int const result = posix_spawnp(pid, arguments[0], &actions, &attributes, arguments, environment != NULL ? environment : environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
     return result;
 }
 
-static type fs__delete_dir_utf8(const char* dir_name, type* problem_solver, type (problem_solver_func)(type*, type, uint64_t, uint32_t, void*, bool), type (int_to_dptype)(type, void*, bool), void* th_data) {
-    type result = (type){.data = 0, .type = nothing__type_number};
-    uint64_t sub_dirs_count = 0;
-    char** sub_dirs_list = NULL;
-    {
-        DIR* dir = opendir(dir_name);
-        if (dir == NULL) {
-            result = fs__delete_problem_solver(dir_name, problem_solver, problem_solver_func, int_to_dptype(fs__delete__problem__open_dir, th_data, false), th_data);
-            return result;
-        }
-        uint64_t const dir_name_length = strlen(dir_name);
-        for (;;) {
-            global_lock();
-            struct dirent* const dir_entry = readdir(dir);
-            if (dir_entry == NULL) {
-                global_unlock();
-                break;
-            }
-            char* const object_name = dir_entry->d_name;
-            uint64_t const object_name_length = strlen(object_name);
-            typeof(dir_entry->d_type) object_type = dir_entry->d_type;
-            global_unlock();
-            if (
-                object_name[0] == '.' &&
-                (object_name_length == 1 || (object_name_length == 2 && object_name[1] == '.'))
-            ) {continue;}
-            char* obj_full_name = malloc(dir_name_length + object_name_length + 2);
-            strcpy(obj_full_name, dir_name);
-            obj_full_name[dir_name_length] = '/';
-            obj_full_name[dir_name_length + 1] = 0;
-            strcat(obj_full_name, object_name);
-            if (object_type == DT_DIR) {
-                sub_dirs_list = realloc(sub_dirs_list, (sub_dirs_count + 1) * sizeof(char*));
-                sub_dirs_list[sub_dirs_count] = obj_full_name;
-                sub_dirs_count++;
-            } else {
-                result = fs__delete_file_utf8(obj_full_name, problem_solver, problem_solver_func, int_to_dptype, th_data);
-                free(obj_full_name);
-                if (result.type == error__type_number) {break;}
+// The function starts the program with the arguments ("arguments[0]" is the program) without a shell.
+// The standard streams of the program are pipelines: see "env__process_get_stdin_pipe" and the functions after it.
+// If "environment" is "NULL", the environment is inherited, if "working_dir" is "nothing", the current directory is used.
+// If the program can't be started, then an error is returned as a result.
+type env__spawn(const type* arguments, type arguments_count, const type* environment, type environment_count, type working_dir) {
+    if (arguments_count.data == 0) {return net__error("Failed to start the program", EINVAL);}
+    int pipes[3][2];
+    for (int index = 0; index < 3; index++) {
+        if (pipe2(pipes[index], O_CLOEXEC) != 0) {
+            int const error_number = errno;
+            for (int opened = 0; opened < index; opened++) {
+                close(pipes[opened][0]);
+                close(pipes[opened][1]);
             }
+            return net__error("Failed to create a pipe", error_number);
         }
-        closedir(dir);
     }
-    for (; sub_dirs_count != 0; sub_dirs_count--) {
-        if (result.type == nothing__type_number) {
-            result = fs__delete_dir_utf8(sub_dirs_list[sub_dirs_count - 1], problem_solver, problem_solver_func, int_to_dptype, th_data);
-        }
-        free(sub_dirs_list[sub_dirs_count - 1]);
+    char** const arguments_utf8 = process__to_utf8_array(arguments, arguments_count.data);
+    char** const environment_utf8 = environment != NULL ? process__to_utf8_array(environment, environment_count.data) : NULL;
+    char* const working_dir_utf8 = working_dir.type == string__type_number ? (char*)string__utf32_to_utf8(working_dir) : NULL;
+    int const std_fds[3] = {pipes[0][0], pipes[1][1], pipes[2][1]};
+    pid_t pid;
+    int const error_number = process__spawn(&pid, arguments_utf8, environment_utf8, working_dir_utf8, std_fds);
+    process__free_utf8_array(arguments_utf8);
+    if (environment_utf8 != NULL) {process__free_utf8_array(environment_utf8);}
+    if (working_dir_utf8 != NULL) {free(working_dir_utf8);}
+    close(pipes[0][0]);
+    close(pipes[1][1]);
+    close(pipes[2][1]);
+    if (error_number != 0) {
+        close(pipes[0][1]);
+        close(pipes[1][0]);
+        close(pipes[2][0]);
+        return net__error("Failed to start the program", error_number);
     }
-    if (sub_dirs_list != NULL) {free(sub_dirs_list);}
-    if (remove(dir_name) != 0) {
-        result = fs__delete_problem_solver(dir_name, problem_solver, problem_solver_func, int_to_dptype(fs__delete__problem__delete_empty_dir, th_data, false), th_data);
+    process* const result = malloc(sizeof(process));
+    *result = (process) {
+        .pid           = pid,
+        .exit_code     = 0,
+        .has_exited    = false,
+        .stdin_socket  = net__open_pipe(pipes[0][1], net__kind_pipe_out),
+        .stdout_socket = net__open_pipe(pipes[1][0], net__kind_pipe_in),
+        .stderr_socket = net__open_pipe(pipes[2][0], net__kind_pipe_in)
+    };
+    return (type){.data = (uint64_t)result, .type = int__type_number};
+}
+
+// The function returns the pipeline for the standard input of the process: byte buffers and strings (as UTF-8), "false" closes the input.
+// The pipeline must be freed by the caller.
+uint64_t env__process_get_stdin_pipe(type process_obj) {
+    return net__get_out_pipe((type){.data = (uint64_t)((const process*)process_obj.data)->stdin_socket, .type = int__type_number});
+}
+
+// The function returns the pipeline with the standard output of the process as byte buffers, the end of the output is "false".
+// The pipeline must be freed by the caller.
+uint64_t env__process_get_stdout_pipe(type process_obj) {
+    return net__get_in_pipe((type){.data = (uint64_t)((const process*)process_obj.data)->stdout_socket, .type = int__type_number});
+}
+
+// The same as "env__process_get_stdout_pipe", but for the standard error output.
+uint64_t env__process_get_stderr_pipe(type process_obj) {
+    return net__get_in_pipe((type){.data = (uint64_t)((const process*)process_obj.data)->stderr_socket, .type = int__type_number});
+}
+
+type env__process_get_id(type process_obj) {
+    return (type){.data = ((const process*)process_obj.data)->pid, .type = int__type_number};
+}
+
+static bool process__try_reap(process* process_ptr) {
+    if (process_ptr->has_exited) {return true;}
+    int status;
+    if (waitpid(process_ptr->pid, &status, WNOHANG) == process_ptr->pid) {
+        process_ptr->exit_code = process__exit_code(status);
+        process_ptr->has_exited = true;
     }
-    return result;
+    return process_ptr->has_exited;
 }
 
-// The function delete a file system object.
-// If a problem occurs during deleting, then control is transferred to the problem solver, if the solver solved the problem, the function continues its work.
-type fs__delete(type object, type* problem_solver, type (problem_solver_func)(type*, type, /*type -> uint64_t, uint32_t (because of a clang bug)*/ uint64_t, uint32_t, void*, bool), type (int_to_dptype)(type, void*, bool), void* th_data) {
-    struct stat fso_stat;
-    type result = (type){.data = 0, .type = nothing__type_number};
-    char* object_utf8 = (char*)string__utf32_to_utf8(object);
-    if (lstat(object_utf8, &fso_stat) != 0) {
-        result = problem_solver_func(problem_solver, object, int_to_dptype(fs__delete__problem__stat, th_data, false).data, int__type_number, th_data, false);
-        free(object_utf8);
-        return result;
+// The function waits for any of the processes to exit, a process is watched through its pidfd when the kernel supports it,
+// otherwise the processes are polled with growing intervals. Returns "false" if the deadline ("NULL" - without a deadline) has passed.
+static bool process__wait_any(const pid_t* pids, uint64_t count, const struct timespec* deadline) {
+    struct pollfd stack_fds[16];
+    struct pollfd* const fds = count <= 16 ? stack_fds : malloc(count * sizeof(struct pollfd));
+    bool use_pidfds = true;
+    for (uint64_t index = 0; index < count; index++) {
+        fds[index] = (struct pollfd){.fd = use_pidfds ? syscall(SYS_pidfd_open, pids[index], 0) : -1, .events = POLLIN};
+        if (fds[index].fd == -1) {use_pidfds = false;}
     }
-    if ((fso_stat.st_mode & S_IFDIR) == S_IFDIR) {
-        result = fs__delete_dir_utf8(object_utf8, problem_solver, problem_solver_func, int_to_dptype, th_data);
-    } else {
-        result = fs__delete_file_utf8(object_utf8, problem_solver, problem_solver_func, int_to_dptype, th_data);
+    bool result = true;
+    for (int64_t poll_interval_ms = 1;;) {
+        int64_t timeout_ms = use_pidfds ? -1 : poll_interval_ms;
+        if (deadline != NULL) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t const remaining_ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+            if (remaining_ms <= 0) {
+                result = false;
+                break;
+            }
+            if (timeout_ms == -1 || remaining_ms < timeout_ms) {timeout_ms = remaining_ms;}
+        }
+        if (use_pidfds) {
+            if (poll(fds, count, timeout_ms) > 0) {break;}
+        } else {
+            bool has_exited = false;
+            for (uint64_t index = 0; index < count && !has_exited; index++) {
+                siginfo_t info = {.si_pid = 0};
+                has_exited = waitid(P_PID, pids[index], &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid != 0;
+            }
+            if (has_exited) {break;}
+            poll(NULL, 0, timeout_ms);
+            if (poll_interval_ms < 50) {poll_interval_ms *= 2;}
+        }
     }
-    free(object_utf8);
+    for (uint64_t index = 0; index < count; index++) {
+        if (fds[index].fd != -1) {close(fds[index].fd);}
+    }
+    if (fds != stack_fds) {free(fds);}
     return result;
 }
 
-// The function move a file system object.
-// The function at the beginning tries to move the object without copying, if it doesn't work, it copies, and then the original object is deleted.
-type fs__move(type destination, type source, type* copy_problem_solver, type (copy_problem_solver_func)(type*, type, type, /*type -> uint64_t, uint32_t (because of a clang bug)*/ uint64_t, uint32_t, void*, bool), type (int_to_cptype)(type, void*, bool), type* delete_problem_solver, type (delete_problem_solver_func)(type*, type, /*type -> uint64_t, uint32_t (because of a clang bug)*/ uint64_t, uint32_t, void*, bool), type (int_to_dptype)(type, void*, bool), void* th_data) {
-    bool rename_ok = true;
-    {
-        char* source_utf8 = (char*)string__utf32_to_utf8(source);
-        char* const destination_utf8 = (char*)string__utf32_to_utf8(destination);
-        struct stat fso_stat;
-        rename_ok =
-            lstat(source_utf8, &fso_stat) == 0 &&
-            lstat(destination_utf8, &fso_stat) != 0 &&
-            rename(source_utf8, destination_utf8) == 0;
-        free(source_utf8);
-        free(destination_utf8);
+// The function waits for the process to exit and returns its exit code (128 + the signal number if it was killed by a signal).
+// If "timeout_ms" is negative, the function waits without a time limit, otherwise when the time runs out, "nothing" is returned.
+type env__process_wait(type process_obj, type timeout_ms) {
+    process* const process_ptr = (process*)process_obj.data;
+    if ((int64_t)timeout_ms.data < 0 && !process_ptr->has_exited) {
+        int status = 0;
+        while (waitpid(process_ptr->pid, &status, 0) == -1 && errno == EINTR) {}
+        process_ptr->exit_code = process__exit_code(status);
+        process_ptr->has_exited = true;
     }
-    type result = (type){.data = 0, .type = nothing__type_number};
-    if (!rename_ok){
-        result = fs__copy(destination, source, copy_problem_solver, copy_problem_solver_func, int_to_cptype, th_data);
-        if (result.type == nothing__type_number){
-            result = fs__delete(source, delete_problem_solver, delete_problem_solver_func, int_to_dptype, th_data);
-        }
+    struct timespec deadline;
+    pipeline__deadline((int64_t)timeout_ms.data, &deadline);
+    while (!process__try_reap(process_ptr)) {
+        if (!process__wait_any(&(process_ptr->pid), 1, &deadline)) {return (type){.data = 0, .type = nothing__type_number};}
     }
-    return result;
+    return (type){.data = process_ptr->exit_code, .type = int__type_number};
 }
 
-type fs__read_symlink(type link) {
-    uint8_t* const link_utf8 = string__utf32_to_utf8(link);
-    uint8_t stack_buffer[256];
-    uint8_t* heap_buffer = NULL;
-    uint8_t* buffer = stack_buffer;
-    uint64_t buffer_size = 256;
-    type result = (type){.data = 0, .type = nothing__type_number};
-    for (;;) {
-        uint64_t const readed_bytes_len = readlink((const char*)link_utf8, (char*)(buffer), buffer_size);
-        if (readed_bytes_len == -1) {break;}
-        if (readed_bytes_len < buffer_size) {
-            buffer[readed_bytes_len] = 0;
-            result = string__utf8_to_utf32(buffer);
-            break;
+// The function sends the signal to the process, if the signal was sent, it returns "true", otherwise "false".
+type env__process_kill(type process_obj, type signal_number) {
+    process* const process_ptr = (process*)process_obj.data;
+    bool const result = !process_ptr->has_exited && kill(process_ptr->pid, signal_number.data) == 0;
+    return (type){.data = result, .type = bool__type_numer};
+}
+
+// The function releases the process object, the standard input is closed after the data already pushed to it is written.
+// A process that is still running is not waited for, the event loop reaps it after it exits.
+void env__process_free(type process_obj) {
+    process* const process_ptr = (process*)process_obj.data;
+    if (!process__try_reap(process_ptr)) {net__add_orphan(process_ptr->pid);}
+    net__close((type){.data = (uint64_t)process_ptr->stdin_socket, .type = int__type_number});
+    net__close((type){.data = (uint64_t)process_ptr->stdout_socket, .type = int__type_number});
+    net__close((type){.data = (uint64_t)process_ptr->stderr_socket, .type = int__type_number});
+    free(process_ptr);
+}
+
+// The function splits the command into arguments by spaces, quotes ("..." or '...') group words with spaces.
+static char** process__split_command(type command) {
+    char* const command_utf8 = (char*)string__utf32_to_utf8(command);
+    uint64_t const length = strlen(command_utf8);
+    char** result = malloc(sizeof(char*));
+    uint64_t count = 0;
+    for (uint64_t index = 0; index < length;) {
+        if (command_utf8[index] == ' ' || command_utf8[index] == '\t') {
+            index++;
+            continue;
         }
-        buffer_size *= 2;
-        heap_buffer = realloc(heap_buffer, buffer_size);
-        buffer = heap_buffer;
+        char* const argument = malloc(length - index + 1);
+        uint64_t argument_length = 0;
+        char quote = 0;
+        for (; index < length && (quote != 0 || (command_utf8[index] != ' ' && command_utf8[index] != '\t')); index++) {
+            char const current = command_utf8[index];
+            if (quote == 0 && (current == '"' || current == '\'')) {quote = current;}
+            else if (current == quote) {quote = 0;}
+            else {
+                argument[argument_length] = current;
+                argument_length++;
+            }
+        }
+        argument[argument_length] = 0;
+        result = realloc(result, (count + 2) * sizeof(char*));
+        result[count] = argument;
+        count++;
     }
-    free(link_utf8);
-    if (heap_buffer != NULL) {free(heap_buffer);}
+    result[count] = NULL;
+    free(command_utf8);
     return result;
 }
 
-type fs__create_symlink(type link_path, type src_object) {
-    uint8_t* const link_path_utf8 = string__utf32_to_utf8(link_path);
-    uint8_t* const src_object_utf8 = string__utf32_to_utf8(src_object);
-    type result = (type){.data = 1 + symlink((const char*)src_object_utf8, (const char*)link_path_utf8), .type = bool__type_numer};
-    free(link_path_utf8);
-    free(src_object_utf8);
-    return result;
+// The function runs the commands (without a shell, see "process__split_command") with at most "parallelism" processes at a time.
+// The processes share the standard streams of the current process. The exit code of every command is written to "exit_codes"
+// (127 if the command could not be started). If all commands exited with 0, the function returns "true", otherwise "false".
+type env__run_commands(const type* commands, type commands_count, type parallelism, type* exit_codes) {
+    uint64_t const max_running = parallelism.data == 0 ? 1 : parallelism.data;
+    pid_t* const pids = malloc(max_running * sizeof(pid_t));
+    uint64_t* const indexes = malloc(max_running * sizeof(uint64_t));
+    uint64_t running = 0;
+    uint64_t next = 0;
+    bool result = true;
+    trace__event('B', "env__run_commands");
+    while (next < commands_count.data || running != 0) {
+        while (running < max_running && next < commands_count.data) {
+            char** const arguments = process__split_command(commands[next]);
+            int const error_number = arguments[0] != NULL ? process__spawn(&(pids[running]), arguments, NULL, NULL, NULL) : EINVAL;
+            process__free_utf8_array(arguments);
+            if (error_number != 0) {
+                exit_codes[next] = (type){.data = 127, .type = int__type_number};
+                result = false;
+            } else {
+                indexes[running] = next;
+                running++;
+            }
+            next++;
+        }
+        if (running == 0) {continue;}
+        process__wait_any(pids, running, NULL);
+        for (uint64_t index = 0; index < running;) {
+            int status;
+            if (waitpid(pids[index], &status, WNOHANG) != pids[index]) {
+                index++;
+                continue;
+            }
+            int const exit_code = process__exit_code(status);
+            exit_codes[indexes[index]] = (type){.data = exit_code, .type = int__type_number};
+            result &= exit_code == 0;
+            running--;
+            pids[index] = pids[running];
+            indexes[index] = indexes[running];
+        }
+    }
+    trace__event('E', NULL);
+    free(pids);
+    free(indexes);
+    return (type){.data = result, .type = bool__type_numer};
 }
 
-// The function copies attributes from one file system object to another.
-// The objects must be of the same type (file, directory, etc.).
-// The function returns "true" if successful, otherwise "false".
-type fs__copy_attributes(type destination, type source) {
-    type result = (type) {.data = 0, .type = bool__type_numer};
-    char* const destination_utf8 = (char*)string__utf32_to_utf8(destination);
-    char* const source_utf8 = (char*)string__utf32_to_utf8(source);
-    struct stat dest_stat;
-    struct stat src_stat;
-    if (
-        (stat(destination_utf8, &dest_stat) == 0) &&
-        (stat(source_utf8, &src_stat) == 0) &&
-        ((dest_stat.st_mode & S_IFMT) == (src_stat.st_mode & S_IFMT)) &&
-        ((chmod(destination_utf8, src_stat.st_mode & ~S_IFMT) | chown(destination_utf8, src_stat.st_uid, src_stat.st_gid)) == 0)
-    ) {result = (type) {.data = 1, .type = bool__type_numer};}
-    free(destination_utf8);
-    free(source_utf8);
-    return result;
-}
-#pragma endregion FS
+#undef alloc__category
+#pragma endregion Process
 
 #pragma region Time
 // The function returns the current time.
@@ -1310,6 +6948,60 @@ uint64_t time__current_utc() {
     gettimeofday(&time, NULL);
     return ((uint64_t)time.tv_sec) * 1000000ull + time.tv_usec;
 }
+
+static bool time__tsc_is_invariant = false;
+static uint64_t time__start_ticks;
+static uint64_t time__start_ns;
+static uint64_t time__ns_per_tick_q32;
+static pthread_once_t time__calibration_once = PTHREAD_ONCE_INIT;
+
+// The function returns the value of the monotonic clock in nanoseconds.
+// The clock is not affected by changes of the system time, it is suitable for measuring intervals.
+uint64_t time__monotonic_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+// The function returns the CPU time used by the current thread in nanoseconds.
+uint64_t time__cpu_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+static void time__init() {
+    uint32_t eax, ebx, ecx, edx;
+    time__tsc_is_invariant = __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8)) != 0;
+    time__start_ticks = time__tsc_is_invariant ? __rdtsc() : 0;
+    time__start_ns = time__monotonic_ns();
+}
+
+// The tick rate is measured against the monotonic clock over at least 10 ms since the start of the program.
+static void time__calibrate() {
+    uint64_t ticks;
+    uint64_t ns;
+    do {
+        ticks = __rdtsc();
+        ns = time__monotonic_ns();
+    } while (ns - time__start_ns < 10000000ull);
+    time__ns_per_tick_q32 = (uint64_t)(((unsigned __int128)(ns - time__start_ns) << 32) / (ticks - time__start_ticks));
+}
+
+// The function returns the value of the CPU time stamp counter, it is a very cheap way to measure short intervals.
+// The ticks are converted to nanoseconds by "time__ticks_to_ns".
+// If the CPU does not have an invariant time stamp counter, the monotonic clock is used instead.
+uint64_t time__ticks() {
+    if (__builtin_expect(time__tsc_is_invariant, true)) {return __rdtsc();}
+    return time__monotonic_ns();
+}
+
+// The function converts the number of ticks (the difference of two "time__ticks" values) to nanoseconds.
+uint64_t time__ticks_to_ns(uint64_t ticks) {
+    if (__builtin_expect(!time__tsc_is_invariant, false)) {return ticks;}
+    pthread_once(&time__calibration_once, time__calibrate);
+    return (uint64_t)(((unsigned __int128)ticks * time__ns_per_tick_q32) >> 32);
+}
 #pragma endregion Time
 
 #pragma region Libs
@@ -1377,8 +7069,46 @@ type locale__lang_code() {
 }
 #pragma endregion Locale
 
+#pragma region Runtime
+// The function returns a report about the memory used by the program.
+// Allocation counters are collected only if the "SHAR_MEMORY_STATS" environment variable is set.
+type runtime__memory_stats() {
+    char* report = NULL;
+    size_t report_size = 0;
+    FILE* const file = open_memstream(&report, &report_size);
+    if (__builtin_expect(file == NULL, false)) {alloc__out_of_memory();}
+    alloc__print_stats(file);
+    fclose(file);
+    type const result = string__utf8_to_utf32((const uint8_t*)report);
+    // The report is allocated by the C library and was never counted, so it is released past the accounting.
+    (free)(report);
+    return result;
+}
+
+// The function returns the number of bytes allocated by the runtime and not yet released by it.
+// If allocation accounting is disabled, "nothing" is returned as a result.
+type runtime__memory_live_bytes() {
+    if (!alloc__accounting) {return (type){.data = 0, .type = nothing__type_number};}
+    int64_t live_bytes = __atomic_load_n(&alloc__live_bytes, __ATOMIC_RELAXED);
+    for (const alloc_stats* stats = __atomic_load_n(&alloc__all_stats, __ATOMIC_ACQUIRE); stats != NULL; stats = stats->next) {live_bytes += __atomic_load_n(&(stats->pending_live_bytes), __ATOMIC_RELAXED);}
+    return (type){.data = live_bytes < 0 ? 0 : live_bytes, .type = int__type_number};
+}
+
+// The function returns the peak number of bytes allocated by the runtime and not released by it.
+// If allocation accounting is disabled, "nothing" is returned as a result.
+type runtime__memory_peak_bytes() {
+    if (!alloc__accounting) {return (type){.data = 0, .type = nothing__type_number};}
+    int64_t const peak_bytes = __atomic_load_n(&alloc__peak_bytes, __ATOMIC_RELAXED);
+    int64_t const live_bytes = (int64_t)runtime__memory_live_bytes().data;
+    return (type){.data = peak_bytes > live_bytes ? peak_bytes : live_bytes, .type = int__type_number};
+}
+#pragma endregion Runtime
+
 #pragma region Main
+#define alloc__category alloc__category__other
+
 void* shar__init(int argc, char** argv, type (free_func)(type, void*, bool), type (use_func)(type, void*, bool)) {
+    alloc__accounting = getenv("SHAR_MEMORY_STATS") != NULL;
     __argv__ = (uint8_t**) argv;
     __argc__ = argc;
     shar__rc_free = free_func;
@@ -1389,7 +7119,13 @@ void* shar__init(int argc, char** argv, type (free_func)(type, void*, bool), typ
     th_data->random_number_source[0] = int__get_cryptographic__random(th_data).data;
     th_data->random_number_source[1] = int__get_cryptographic__random(th_data).data;
     th_data->random_number_source[2] = int__get_cryptographic__random(th_data).data;
-    cpu_cores_number = get_nprocs();
+    string__hash_key[0] = int__get_cryptographic__random(th_data).data;
+    string__hash_key[1] = int__get_cryptographic__random(th_data).data;
+    cpu_cores_number = env__detect_cpu_cores_number();
+    cpu_has_avx2 = __builtin_cpu_supports("avx2");
+    time__init();
+    trace__file_name = getenv("SHAR_TRACE");
+    trace__start_thread(th_data->id);
     tzset();
     return th_data;
 }
@@ -1405,7 +7141,9 @@ bool shar__end(type main_func_result, void* th_data) {
         error__free(main_func_result, th_data);
     }
     for (;number_of_threads != 1;) {worker__sleep((type){.data = 100, .type = int__type_number});}
+    trace__export();
     free(th_data);
+    if (alloc__accounting) {alloc__print_stats(stderr);}
     return result || ignored_errors;
 }
 
@@ -1414,4 +7152,6 @@ __attribute__((noreturn, cold)) void shar__exit() { exit(EXIT_SUCCESS); }
 
 // The function terminates the program immediately, but the program is considered to have terminated incorrectly.
 __attribute__((noreturn, cold)) void shar__fail() { exit(EXIT_FAILURE); }
+
+#undef alloc__category
 #pragma endregion Main